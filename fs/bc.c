@@ -31,6 +31,7 @@ bc_pgfault(struct UTrapframe *utf)
 {
 	void *addr = (void *) utf->utf_fault_va;
 	uint32_t blockno = ((uint32_t)addr - DISKMAP) / BLKSIZE;
+	void *tmp;
 	int r;
 
 	// Check that the fault was within the block cache region
@@ -50,16 +51,25 @@ bc_pgfault(struct UTrapframe *utf)
     cprintf("bc pgfault block:%d, bitmap:%x\n", blockno, bitmap);
 
     addr = (void *)ROUNDDOWN(addr, PGSIZE);
-    if ((r = sys_page_alloc(0, addr, PTE_W|PTE_U|PTE_P))){
+
+	// The read may yield to other server threads.  If one of them is
+	// already reading this block, wait for it and retry the access;
+	// otherwise read into a private page and map it in only once it
+	// is complete, so no thread sees a half-read block.  The fresh
+	// mapping starts out clean.
+	if (thread_load_block(blockno))
+		return;
+	tmp = thread_scratch();
+    if ((r = sys_page_alloc(0, tmp, PTE_W|PTE_U|PTE_P))){
 		panic("in bc_pgfault, sys_page_alloc: %e", r);
 	}
         
-    ide_read(blockno*BLKSECTS, addr, BLKSECTS);//一次读一个block
+    ide_read(blockno*BLKSECTS, tmp, BLKSECTS);//一次读一个block
 
-	// Clear the dirty bit for the disk block page since we just read the
-	// block from disk
-	if ((r = sys_page_map(0, addr, 0, addr, uvpt[PGNUM(addr)] & PTE_SYSCALL)) < 0)
+	if ((r = sys_page_map(0, tmp, 0, addr, PTE_W|PTE_U|PTE_P)) < 0)
 		panic("in bc_pgfault, sys_page_map: %e", r);
+	sys_page_unmap(0, tmp);
+	thread_load_block(0);
 
 	// Check that the block we read was allocated. (exercise for
 	// the reader: why do we do this *after* reading the block
@@ -90,12 +100,41 @@ flush_block(void *addr)
 	}
 
     addr = (void *)ROUNDDOWN(addr, PGSIZE);
-    ide_write(blockno*BLKSECTS, addr, BLKSECTS);
     int r;
+	// Clear the dirty bit before writing: the write may yield to other
+	// server threads, and a block they dirty meanwhile must stay dirty.
     if ((r = sys_page_map(0, addr, 0, addr, uvpt[PGNUM(addr)] & PTE_SYSCALL)) < 0){
 		// 清空dirty位
 		panic("in bc_pgfault, sys_page_map: %e", r);
-	}        
+	}
+    ide_write(blockno*BLKSECTS, addr, BLKSECTS);
+}
+
+// Make the block cache page holding addr ours alone before the server
+// writes to it.  Clients may have it mapped read-only, as program text
+// or through FSREQ_MAP, and they keep the contents as they were: the
+// cache moves on to a private copy.  The copy is dirty if the old page
+// was, so no write-back is lost.
+void
+bc_unshare(void *addr)
+{
+	void *tmp;
+	bool dirty;
+	int r;
+
+	addr = (void *) ROUNDDOWN(addr, PGSIZE);
+	if (!va_is_mapped(addr) || pageref(addr) <= 1)
+		return;
+	dirty = va_is_dirty(addr);
+	tmp = thread_scratch();
+	if ((r = sys_page_alloc(0, tmp, PTE_W|PTE_U|PTE_P)) < 0)
+		panic("bc_unshare: sys_page_alloc: %e", r);
+	memmove(tmp, addr, PGSIZE);
+	if ((r = sys_page_map(0, tmp, 0, addr, PTE_W|PTE_U|PTE_P)) < 0)
+		panic("bc_unshare: sys_page_map: %e", r);
+	sys_page_unmap(0, tmp);
+	if (dirty)
+		*(volatile char *) addr = *(volatile char *) addr;
 }
 
 // Test that the block cache works, by smashing the superblock and
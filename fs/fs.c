@@ -117,6 +117,7 @@ fs_init(void)
 		ide_set_disk(1);
 	else
 		ide_set_disk(0);
+	ide_init_irq();
 	bc_init();
 
 	// Set "super" to point to the super block.
@@ -160,6 +161,7 @@ file_block_walk(struct File *f, uint32_t filebno, uint32_t **ppdiskbno, bool all
 				if (blockno < 0)
 					return -E_NO_DISK;
 
+				bc_unshare(diskaddr(blockno));
 				memset(diskaddr(blockno), 0, BLKSIZE);//给新的block初始化为0
 				f->f_indirect = blockno;
 			} else {
@@ -193,6 +195,7 @@ file_get_block(struct File *f, uint32_t filebno, char **blk)
 		if (blockno < 0)
 			return -E_NO_DISK;
 
+		bc_unshare(diskaddr(blockno));
 		memset(diskaddr(blockno), 0, BLKSIZE);
 		*ppdiskbno = blockno;
 	}
@@ -200,6 +203,24 @@ file_get_block(struct File *f, uint32_t filebno, char **blk)
 	return 0;
 }
 
+// Set *diskbno to the disk block holding block filebno of f, or to 0
+// if that block is not allocated yet.  Never allocates anything.
+// Returns 0 on success, < 0 on error.
+int
+file_block_diskno(struct File *f, uint32_t filebno, uint32_t *diskbno)
+{
+	uint32_t *ptr;
+	int r;
+
+	*diskbno = 0;
+	if ((r = file_block_walk(f, filebno, &ptr, 0)) == -E_NOT_FOUND)
+		return 0;
+	if (r < 0)
+		return r;
+	*diskbno = *ptr;
+	return 0;
+}
+
 // Try to find a file named "name" in dir.  If so, set *file to it.
 //
 // Returns 0 and sets *file on success, < 0 on error.  Errors are:
@@ -407,6 +428,7 @@ file_write(struct File *f, const void *buf, size_t count, off_t offset)
 		if ((r = file_get_block(f, pos / BLKSIZE, &blk)) < 0)
 			return r;
 		bn = MIN(BLKSIZE - pos % BLKSIZE, offset + count - pos);
+		bc_unshare(blk);
 		memmove(blk + pos % BLKSIZE, buf, bn);
 		pos += bn;
 		buf += bn;
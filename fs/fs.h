@@ -15,7 +15,10 @@ struct Super *super;		// superblock
 uint32_t *bitmap;		// bitmap blocks mapped in memory
 
 /* ide.c */
+#define IDE_NOTIFY_BIT	0	// Notification bit the disk interrupt signals
 bool	ide_probe_disk1(void);
+void	ide_init_irq(void);
+bool	ide_waiting_irq(void);
 void	ide_set_disk(int diskno);
 void	ide_set_partition(uint32_t first_sect, uint32_t nsect);
 int	ide_read(uint32_t secno, void *dst, size_t nsecs);
@@ -26,11 +29,13 @@ void*	diskaddr(uint32_t blockno);
 bool	va_is_mapped(void *va);
 bool	va_is_dirty(void *va);
 void	flush_block(void *addr);
+void	bc_unshare(void *addr);
 void	bc_init(void);
 
 /* fs.c */
 void	fs_init(void);
 int	file_get_block(struct File *f, uint32_t file_blockno, char **pblk);
+int	file_block_diskno(struct File *f, uint32_t filebno, uint32_t *diskbno);
 int	file_create(const char *path, struct File **f);
 int	file_open(const char *path, struct File **f);
 ssize_t	file_read(struct File *f, void *buf, size_t count, off_t offset);
@@ -44,6 +49,18 @@ void	fs_sync(void);
 bool	block_is_free(uint32_t blockno);
 int	alloc_block(void);
 
+/* thread.c */
+#define NTHREAD		8		// request threads in the server
+extern uint32_t thread_switches;
+void	thread_init(void);
+int	thread_create(void (*func)(void *), void *arg);
+void	thread_yield(void);
+int	thread_nbusy(void);
+void	*thread_scratch(void);
+int	thread_load_block(uint32_t blockno);
+void	file_lock(struct File *f);
+void	file_unlock(struct File *f);
+
 /* test.c */
 void	fs_test(void);
 
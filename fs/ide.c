@@ -6,6 +6,7 @@
 
 #include "fs.h"
 #include <inc/x86.h>
+#include <inc/trap.h>
 
 #define IDE_BSY		0x80
 #define IDE_DRDY	0x40
@@ -14,13 +15,26 @@
 
 static int diskno = 1;
 
+// Set while a transfer owns the controller.  Other server threads
+// wait for it in ide_acquire instead of issuing commands mid-transfer.
+static bool ide_busy;
+
+// Set if the disk's interrupts arrive as notification IDE_NOTIFY, and
+// then ide_waiting is set while a thread waits for one.
+static bool ide_irq;
+static bool ide_waiting;
+
 static int
 ide_wait_ready(bool check_error)
 {
 	int r;
 
-	while (((r = inb(0x1F7)) & (IDE_BSY|IDE_DRDY)) != IDE_DRDY)
-		/* do nothing */;
+	// Let other server threads run while the disk works.
+	while (((r = inb(0x1F7)) & (IDE_BSY|IDE_DRDY)) != IDE_DRDY) {
+		ide_waiting = ide_irq;
+		thread_yield();
+	}
+	ide_waiting = 0;
 
 	if (check_error && (r & (IDE_DF|IDE_ERR)) != 0)
 		return -1;
@@ -51,6 +65,29 @@ ide_probe_disk1(void)
 	return (x < 1000);
 }
 
+// Have the disk interrupt us when it finishes a command, so that a
+// server with nothing else to do can sleep until then instead of
+// polling the controller.  Without that we poll as before.
+void
+ide_init_irq(void)
+{
+	int r;
+
+	if ((r = sys_irq_bind(IRQ_IDE, IDE_NOTIFY_BIT)) < 0) {
+		cprintf("ide: cannot bind irq %d, polling: %e\n", IRQ_IDE, r);
+		return;
+	}
+	outb(0x3F6, 0);		// device control: nIEN clear, interrupts on
+	ide_irq = 1;
+}
+
+// Whether a server thread is waiting for the disk to interrupt.
+bool
+ide_waiting_irq(void)
+{
+	return ide_waiting;
+}
+
 void
 ide_set_disk(int d)
 {
@@ -60,6 +97,14 @@ ide_set_disk(int d)
 }
 
 
+static void
+ide_acquire(void)
+{
+	while (ide_busy)
+		thread_yield();
+	ide_busy = 1;
+}
+
 int
 ide_read(uint32_t secno, void *dst, size_t nsecs)
 {
@@ -67,6 +112,7 @@ ide_read(uint32_t secno, void *dst, size_t nsecs)
 
 	assert(nsecs <= 256);
 
+	ide_acquire();
 	ide_wait_ready(0);
 
 	outb(0x1F2, nsecs);
@@ -78,11 +124,13 @@ ide_read(uint32_t secno, void *dst, size_t nsecs)
 
 	for (; nsecs > 0; nsecs--, dst += SECTSIZE) {
 		if ((r = ide_wait_ready(1)) < 0)
-			return r;
+			goto out;
 		insl(0x1F0, dst, SECTSIZE/4);
 	}
-
-	return 0;
+	r = 0;
+out:
+	ide_busy = 0;
+	return r;
 }
 
 int
@@ -92,6 +140,7 @@ ide_write(uint32_t secno, const void *src, size_t nsecs)
 
 	assert(nsecs <= 256);
 
+	ide_acquire();
 	ide_wait_ready(0);
 
 	outb(0x1F2, nsecs);
@@ -103,10 +152,12 @@ ide_write(uint32_t secno, const void *src, size_t nsecs)
 
 	for (; nsecs > 0; nsecs--, src += SECTSIZE) {
 		if ((r = ide_wait_ready(1)) < 0)
-			return r;
+			goto out;
 		outsl(0x1F0, src, SECTSIZE/4);
 	}
-
-	return 0;
+	r = 0;
+out:
+	ide_busy = 0;
+	return r;
 }
 
@@ -48,6 +48,42 @@ struct OpenFile opentab[MAXOPEN] = {
 // Virtual address at which to receive page mappings containing client requests.
 union Fsipc *fsreq = (union Fsipc *)0x0ffff000;
 
+// Bulk transfer buffers.  A client registers FSBUFPAGES pages of its own
+// memory with FSREQ_SETBUF, one page per request, and the server keeps
+// them mapped at FSBUFVA + ENVX(client) * FSBUFSIZE.  FSREQ_READV and
+// FSREQ_WRITEV then move up to FSBUFSIZE bytes per round trip through
+// that shared region instead of through the one-page request.
+#define FSBUFVA		0xE0000000
+
+struct ClientBuf {
+	envid_t cb_envid;	// env that registered the buffer
+	uint32_t cb_mapped;	// bitmask of registered pages
+};
+
+struct ClientBuf clientbuf[NENV];
+
+static char *
+clientbuf_va(envid_t envid)
+{
+	return (char *) (FSBUFVA + ENVX(envid) * FSBUFSIZE);
+}
+
+// Look up the bulk buffer registered by envid.
+// Returns 0 and sets *buf on success, -E_INVAL if envid has not
+// registered (all of) its buffer.
+static int
+clientbuf_lookup(envid_t envid, char **buf)
+{
+	struct ClientBuf *cb = &clientbuf[ENVX(envid)];
+
+	static_assert(FSBUFPAGES <= 32);
+	if (cb->cb_envid != envid
+	    || cb->cb_mapped != (uint32_t) ((1ULL << FSBUFPAGES) - 1))
+		return -E_INVAL;
+	*buf = clientbuf_va(envid);
+	return 0;
+}
+
 void
 serve_init(void)
 {
@@ -161,6 +197,7 @@ try_open:
 
 	// Fill out the Fd structure
 	o->o_fd->fd_file.id = o->o_fileid;
+	strcpy(o->o_fd->fd_file.name, f->f_name);
 	o->o_fd->fd_omode = req->req_omode & O_ACCMODE;
 	o->o_fd->fd_dev_id = devfile.dev_id;
 	o->o_mode = req->req_omode;
@@ -176,28 +213,28 @@ try_open:
 	return 0;
 }
 
-// Set the size of req->req_fileid to req->req_size bytes, truncating
-// or extending the file as necessary.
+// Set the size of file words[1] to words[2] bytes, truncating or
+// extending the file as necessary.
 int
-serve_set_size(envid_t envid, struct Fsreq_set_size *req)
+serve_set_size(envid_t envid, uint32_t *words)
 {
 	struct OpenFile *o;
 	int r;
 
 	if (debug)
-		cprintf("serve_set_size %08x %08x %08x\n", envid, req->req_fileid, req->req_size);
+		cprintf("serve_set_size %08x %08x %08x\n", envid, words[1], words[2]);
 
 	// Every file system IPC call has the same general structure.
 	// Here's how it goes.
 
 	// First, use openfile_lookup to find the relevant open file.
 	// On failure, return the error code to the client with ipc_send.
-	if ((r = openfile_lookup(envid, req->req_fileid, &o)) < 0)
+	if ((r = openfile_lookup(envid, words[1], &o)) < 0)
 		return r;
 
 	// Second, call the relevant file system function (from fs/fs.c).
 	// On failure, return the error code to the client.
-	return file_set_size(o->o_file, req->req_size);
+	return file_set_size(o->o_file, words[2]);
 }
 
 // 在ipc->read.req_fileid中，从当前seek的位置开始读，最多读 ipc-read.req_n个字节
@@ -253,47 +290,564 @@ serve_write(envid_t envid, struct Fsreq_write *req)
 	return r;
 }
 
-// Stat ipc->stat.req_fileid.  Return the file's struct Stat to the
-// caller in ipc->statRet.
+// Stat file words[1].  Return its size to the caller in words[1] and
+// whether it is a directory in words[2]; the caller has its name from
+// the Fd page.
+int
+serve_stat(envid_t envid, uint32_t *words)
+{
+	struct OpenFile *o;
+	int r;
+
+	if (debug)
+		cprintf("serve_stat %08x %08x\n", envid, words[1]);
+
+	if ((r = openfile_lookup(envid, words[1], &o)) < 0)
+		return r;
+
+	words[1] = o->o_file->f_size;
+	words[2] = (o->o_file->f_type == FTYPE_DIR);
+	return 0;
+}
+
+// Flush all data and metadata of file words[1] to disk.
+int
+serve_flush(envid_t envid, uint32_t *words)
+{
+	struct OpenFile *o;
+	int r;
+
+	if (debug)
+		cprintf("serve_flush %08x %08x\n", envid, words[1]);
+
+	if ((r = openfile_lookup(envid, words[1], &o)) < 0)
+		return r;
+	file_flush(o->o_file);
+	return 0;
+}
+
+
+// Register the page at 'pg' (received with permissions 'perm') as page
+// req->req_page of envid's bulk buffer.  A new env reusing the same
+// envs[] slot simply replaces the previous owner's mappings.
+int
+serve_setbuf(envid_t envid, struct Fsreq_setbuf *req, int perm)
+{
+	struct ClientBuf *cb = &clientbuf[ENVX(envid)];
+	int i, r;
+
+	if (debug)
+		cprintf("serve_setbuf %08x %d\n", envid, req->req_page);
+
+	i = req->req_page;
+	if (i < 0 || i >= FSBUFPAGES || !(perm & PTE_W))
+		return -E_INVAL;
+	if (cb->cb_envid != envid) {
+		cb->cb_envid = envid;
+		cb->cb_mapped = 0;
+	}
+	if ((r = sys_page_map(0, req, 0, clientbuf_va(envid) + i * PGSIZE,
+			      PTE_P|PTE_U|PTE_W)) < 0)
+		return r;
+	cb->cb_mapped |= 1 << i;
+	return 0;
+}
+
+// Read at most req->req_n bytes from the current seek position of
+// req->req_fileid into the caller's bulk buffer.
+// Returns the number of bytes read, < 0 on error.
 int
-serve_stat(envid_t envid, union Fsipc *ipc)
+serve_readv(envid_t envid, struct Fsreq_readv *req)
 {
-	struct Fsreq_stat *req = &ipc->stat;
-	struct Fsret_stat *ret = &ipc->statRet;
 	struct OpenFile *o;
+	char *buf;
 	int r;
 
 	if (debug)
-		cprintf("serve_stat %08x %08x\n", envid, req->req_fileid);
+		cprintf("serve_readv %08x %08x %08x\n", envid, req->req_fileid, req->req_n);
 
 	if ((r = openfile_lookup(envid, req->req_fileid, &o)) < 0)
 		return r;
+	if ((r = clientbuf_lookup(envid, &buf)) < 0)
+		return r;
 
-	strcpy(ret->ret_name, o->o_file->f_name);
-	ret->ret_size = o->o_file->f_size;
-	ret->ret_isdir = (o->o_file->f_type == FTYPE_DIR);
+	r = file_read(o->o_file, buf, MIN(req->req_n, FSBUFSIZE), o->o_fd->fd_offset);
+	if (r < 0)
+		return r;
+
+	o->o_fd->fd_offset += r;
+	return r;
+}
+
+// Write req->req_n bytes from the caller's bulk buffer at the current
+// seek position of req->req_fileid, extending the file if necessary.
+// Returns the number of bytes written, < 0 on error.
+int
+serve_writev(envid_t envid, struct Fsreq_writev *req)
+{
+	struct OpenFile *o;
+	char *buf;
+	int r;
+
+	if (debug)
+		cprintf("serve_writev %08x %08x %08x\n", envid, req->req_fileid, req->req_n);
+
+	if ((r = openfile_lookup(envid, req->req_fileid, &o)) < 0)
+		return r;
+	if ((r = clientbuf_lookup(envid, &buf)) < 0)
+		return r;
+
+	r = file_write(o->o_file, buf, MIN(req->req_n, FSBUFSIZE), o->o_fd->fd_offset);
+	if (r < 0)
+		return r;
+
+	o->o_fd->fd_offset += r;
+	return r;
+}
+
+// Copy at most req->req_n bytes of req->req_srcid, starting at
+// req->req_offset, to the current seek position of req->req_fileid.
+// The data moves straight from one block cache page to another.
+// Returns the number of bytes copied, < 0 on error.
+int
+serve_copy(envid_t envid, struct Fsreq_copy *req)
+{
+	struct OpenFile *dst, *src;
+	off_t off, size;
+	char *blk;
+	int n, r, total;
+
+	if (debug)
+		cprintf("serve_copy %08x %08x %08x %08x %08x\n", envid,
+			req->req_fileid, req->req_srcid, req->req_offset, req->req_n);
+
+	if ((r = openfile_lookup(envid, req->req_fileid, &dst)) < 0
+	    || (r = openfile_lookup(envid, req->req_srcid, &src)) < 0)
+		return r;
+	if ((dst->o_mode & O_ACCMODE) == O_RDONLY || req->req_offset < 0)
+		return -E_INVAL;
+
+	// A thread holds one file lock at a time, so the source block is
+	// looked up under the source's lock and then written out under
+	// the destination's.
+	off = req->req_offset;
+	for (total = 0; total < req->req_n; off += n, total += n) {
+		file_lock(src->o_file);
+		size = src->o_file->f_size;
+		r = off < size ? file_get_block(src->o_file, off / BLKSIZE, &blk) : 0;
+		file_unlock(src->o_file);
+		if (r < 0)
+			return total > 0 ? total : r;
+		if (off >= size)
+			break;
+
+		n = MIN(BLKSIZE - off % BLKSIZE, size - off);
+		if (n > req->req_n - total)
+			n = req->req_n - total;
+		file_lock(dst->o_file);
+		r = file_write(dst->o_file, blk + off % BLKSIZE, n, dst->o_fd->fd_offset);
+		if (r > 0)
+			dst->o_fd->fd_offset += r;
+		file_unlock(dst->o_file);
+		if (r < 0)
+			return total > 0 ? total : r;
+	}
+	return total;
+}
+
+// Return the block cache page holding byte req->req_offset of
+// req->req_fileid, read-only, in *pg_store, so the caller can copy out
+// of it directly.  Returns the number of file bytes in the page from
+// req->req_offset on, 0 at end of file, < 0 on error.
+int
+serve_map(envid_t envid, struct Fsreq_map *req, void **pg_store, int *perm_store)
+{
+	struct OpenFile *o;
+	char *blk;
+	int r;
+
+	if (debug)
+		cprintf("serve_map %08x %08x %08x\n", envid, req->req_fileid, req->req_offset);
+
+	if ((r = openfile_lookup(envid, req->req_fileid, &o)) < 0)
+		return r;
+	if (req->req_offset < 0)
+		return -E_INVAL;
+	if (req->req_offset >= o->o_file->f_size)
+		return 0;
+	if ((r = file_get_block(o->o_file, req->req_offset / BLKSIZE, &blk)) < 0)
+		return r;
+
+	*pg_store = blk;
+	*perm_store = PTE_P|PTE_U;
+	return MIN(BLKSIZE - req->req_offset % BLKSIZE,
+		   o->o_file->f_size - req->req_offset);
+}
+
+// Asynchronous I/O contexts, registered with FSREQ_AIO_SETUP much like
+// bulk buffers and mapped at FSAIOVA + ENVX(client) * FSAIOSIZE.
+#define FSAIOSIZE	(FSAIO_NPAGES * PGSIZE)
+#define FSAIOVA		(FSBUFVA + NENV * FSBUFSIZE)
+
+struct AioCtx {
+	envid_t ac_envid;	// env that registered the context
+	uint32_t ac_mapped;	// bitmask of registered pages
+	bool ac_pending;	// on the aio_pending list
+};
+
+struct AioCtx aioctx[NENV];
+
+// Contexts with submissions the server has not drained yet.
+struct AioCtx *aio_pending[NENV];
+int naio_pending;
+
+static char *
+aioctx_va(struct AioCtx *ac)
+{
+	return (char *) (FSAIOVA + (ac - aioctx) * FSAIOSIZE);
+}
+
+// Register the page at 'pg' as page req->req_page of envid's async I/O
+// area: page 0 is the ring, page 1 + i is the data page of entry i.
+int
+serve_aio_setup(envid_t envid, struct Fsreq_setbuf *req, int perm)
+{
+	struct AioCtx *ac = &aioctx[ENVX(envid)];
+	int i, r;
+
+	if (debug)
+		cprintf("serve_aio_setup %08x %d\n", envid, req->req_page);
+
+	i = req->req_page;
+	if (i < 0 || i >= FSAIO_NPAGES || !(perm & PTE_W))
+		return -E_INVAL;
+	if (ac->ac_envid != envid) {
+		ac->ac_envid = envid;
+		ac->ac_mapped = 0;
+	}
+	if ((r = sys_page_map(0, req, 0, aioctx_va(ac) + i * PGSIZE,
+			      PTE_P|PTE_U|PTE_W)) < 0)
+		return r;
+	ac->ac_mapped |= 1 << i;
 	return 0;
 }
 
-// Flush all data and metadata of req->req_fileid to disk.
+// Note that envid has queued new submissions.  They are carried out by
+// serve_aio() after this reply has gone out.
 int
-serve_flush(envid_t envid, struct Fsreq_flush *req)
+serve_aio_submit(envid_t envid, uint32_t *words)
+{
+	struct AioCtx *ac = &aioctx[ENVX(envid)];
+
+	static_assert(FSAIO_NPAGES <= 32);
+	static_assert(sizeof(struct Fsaio_ring) <= PGSIZE);
+	if (ac->ac_envid != envid
+	    || ac->ac_mapped != (uint32_t) ((1ULL << FSAIO_NPAGES) - 1))
+		return -E_INVAL;
+	if (!ac->ac_pending) {
+		ac->ac_pending = 1;
+		aio_pending[naio_pending++] = ac;
+	}
+	return 0;
+}
+
+// A submission taken off a client's ring, waiting to be carried out.
+struct AioReq {
+	struct AioCtx *ar_ctx;
+	struct Fsaio_sqe ar_sqe;
+	uint32_t ar_diskbno;	// sort key: where on disk the data lives
+};
+
+#define AIOBATCH	64
+
+// Carry out one submission and return its result.
+static int
+aio_run(struct AioReq *ar)
 {
+	struct Fsaio_sqe *sqe = &ar->ar_sqe;
 	struct OpenFile *o;
+	char *data;
 	int r;
 
+	if (sqe->sqe_slot < 0 || sqe->sqe_slot >= FSAIO_NENTRY
+	    || sqe->sqe_n > PGSIZE || sqe->sqe_offset < 0)
+		return -E_INVAL;
+	if ((r = openfile_lookup(ar->ar_ctx->ac_envid, sqe->sqe_fileid, &o)) < 0)
+		return r;
+
+	data = aioctx_va(ar->ar_ctx) + (1 + sqe->sqe_slot) * PGSIZE;
+	file_lock(o->o_file);
+	switch (sqe->sqe_op) {
+	case FSAIO_READ:
+		r = file_read(o->o_file, data, sqe->sqe_n, sqe->sqe_offset);
+		break;
+	case FSAIO_WRITE:
+		if ((o->o_mode & O_ACCMODE) == O_RDONLY)
+			r = -E_INVAL;
+		else
+			r = file_write(o->o_file, data, sqe->sqe_n, sqe->sqe_offset);
+		break;
+	default:
+		r = -E_INVAL;
+	}
+	file_unlock(o->o_file);
+	return r;
+}
+
+static bool aio_running;
+
+// Dirty blocks are written back once the server has been idle for
+// WRITEBACK_US.  wb_pending is set by any request that may have
+// dirtied the cache since the last writeback.
+#define WRITEBACK_US	500000
+
+static bool wb_pending;
+
+// Write back every dirty block.  Runs on a server thread of its own,
+// so requests keep being served while it waits for the disk.
+static void
+serve_writeback(void *arg)
+{
+	fs_sync();
+}
+
+// Drain the submission rings of all pending contexts.  Each batch is
+// gathered from every client first and then carried out in disk block
+// order, so requests queued by different clients are merged into one
+// sweep across the disk.  Runs on a server thread of its own.
+//
+// The ring indices are client-writable, so each is read once and a
+// ring whose indices make no sense is dropped.  Only as many
+// submissions are taken as there is room for completions: a client
+// that does not reap its completions is parked until it submits again.
+static void
+serve_aio(void *arg)
+{
+	static struct AioReq batch[AIOBATCH];
+	struct Fsaio_ring *ring;
+	struct Fsaio_cqe *cqe;
+	struct OpenFile *o;
+	struct AioReq ar;
+	uint32_t head, tail, room;
+	int i, j, n;
+
+	while (naio_pending > 0) {
+		// Gather a batch, insertion-sorted by disk block.
+		n = 0;
+		for (i = 0; i < naio_pending && n < AIOBATCH; ) {
+			ar.ar_ctx = aio_pending[i];
+			ring = (struct Fsaio_ring *) aioctx_va(ar.ar_ctx);
+			head = ring->sq_head;
+			tail = ring->sq_tail;
+			room = ring->cq_tail - ring->cq_head;
+			if (tail - head > FSAIO_NENTRY || room > FSAIO_NENTRY) {
+				cprintf("aio ring of %08x is corrupt\n",
+					ar.ar_ctx->ac_envid);
+				head = tail;
+				room = 0;
+			} else
+				room = FSAIO_NENTRY - room;
+			for (; head != tail && room > 0 && n < AIOBATCH; head++, room--) {
+				ar.ar_sqe = ring->sq[head % FSAIO_NENTRY];
+				ar.ar_diskbno = 0;
+				if (openfile_lookup(ar.ar_ctx->ac_envid, ar.ar_sqe.sqe_fileid, &o) >= 0
+				    && ar.ar_sqe.sqe_offset >= 0)
+					file_block_diskno(o->o_file, ar.ar_sqe.sqe_offset / BLKSIZE,
+							  &ar.ar_diskbno);
+				for (j = n++; j > 0 && batch[j - 1].ar_diskbno > ar.ar_diskbno; j--)
+					batch[j] = batch[j - 1];
+				batch[j] = ar;
+			}
+			ring->sq_head = head;
+			if (head == tail || room == 0) {
+				aio_pending[i]->ac_pending = 0;
+				aio_pending[i] = aio_pending[--naio_pending];
+			} else
+				i++;
+		}
+
+		// Carry it out and post the completions, for which the
+		// gathering left room.
+		for (i = 0; i < n; i++) {
+			ring = (struct Fsaio_ring *) aioctx_va(batch[i].ar_ctx);
+			cqe = &ring->cq[ring->cq_tail % FSAIO_NENTRY];
+			cqe->cqe_tag = batch[i].ar_sqe.sqe_tag;
+			cqe->cqe_slot = batch[i].ar_sqe.sqe_slot;
+			cqe->cqe_res = aio_run(&batch[i]);
+			ring->cq_tail++;
+			sys_wakeup(&ring->cq_tail, 0);
+		}
+	}
+	aio_running = 0;
+}
+
+// Demand paging.  spawn registers the loadable segments of a new child
+// with FSREQ_PAGER and makes this server the child's pager.  The kernel
+// then forwards the child's faults on those segments here, and
+// pager_fill maps the missing pages in.  Children forked from it
+// inherit the pager and are looked up through env_pager_key, the full
+// envid of the child registered, which outlives the child itself.
+// Registrations live in an open-addressed table hashed on ENVX(key),
+// and each holds a reference to the program's Fd page at
+// PAGERVA + (its index) * PGSIZE, which keeps the file open until the
+// entry is reused.  An entry is reused only once no env pages through
+// it any more.
+#define PAGERVA		(FSAIOVA + NENV * FSAIOSIZE)
+
+struct Pager {
+	envid_t pg_envid;	// the child registered, or 0 if never used
+	uint32_t pg_fileid;	// its program file
+	int pg_nseg;
+	struct Fspager_seg pg_seg[FSPAGER_NSEG];
+};
+
+struct Pager pagers[NENV];
+
+// Is pg still in use: is the child it was registered for, or any env
+// forked from it, still around?  Only registration scans for this.
+static bool
+pager_busy(struct Pager *pg)
+{
+	const volatile struct Env *e;
+
+	if (envs[ENVX(pg->pg_envid)].env_id == pg->pg_envid
+	    && envs[ENVX(pg->pg_envid)].env_status != ENV_FREE)
+		return 1;
+	for (e = envs; e < envs + NENV; e++)
+		if (e->env_status != ENV_FREE
+		    && e->env_pager == thisenv->env_id
+		    && e->env_pager_key == pg->pg_envid)
+			return 1;
+	return 0;
+}
+
+// Find the registration for key, or if alloc is set and there is none,
+// a free entry for it.  Returns NULL if there is neither.
+static struct Pager *
+pager_lookup(envid_t key, bool alloc)
+{
+	struct Pager *pg;
+	int i;
+
+	for (i = 0; i < NENV; i++) {
+		pg = &pagers[(ENVX(key) + i) % NENV];
+		if (pg->pg_envid == key)
+			return pg;
+		if (alloc && (pg->pg_envid == 0 || !pager_busy(pg)))
+			return pg;
+		// Probes for key stop at entries never used.
+		if (pg->pg_envid == 0)
+			return NULL;
+	}
+	return NULL;
+}
+
+// Register req->req_nseg segments of file req->req_fileid for demand
+// paging into req->req_env, which must be a child of envid.
+int
+serve_pager(envid_t envid, struct Fsreq_pager *req)
+{
+	const volatile struct Env *child = &envs[ENVX(req->req_env)];
+	struct Fspager_seg *seg;
+	struct OpenFile *o;
+	struct Pager *pg;
+	int i, r;
+
 	if (debug)
-		cprintf("serve_flush %08x %08x\n", envid, req->req_fileid);
+		cprintf("serve_pager %08x %08x %08x %d\n", envid, req->req_fileid,
+			req->req_env, req->req_nseg);
 
+	if (child->env_id != req->req_env || child->env_parent_id != envid)
+		return -E_BAD_ENV;
 	if ((r = openfile_lookup(envid, req->req_fileid, &o)) < 0)
 		return r;
-	file_flush(o->o_file);
+	if (req->req_nseg < 0 || req->req_nseg > FSPAGER_NSEG)
+		return -E_INVAL;
+	for (i = 0; i < req->req_nseg; i++) {
+		seg = &req->req_seg[i];
+		if (seg->ps_filesz > seg->ps_memsz || seg->ps_offset < 0
+		    || PGOFF(seg->ps_offset) != PGOFF(seg->ps_va)
+		    || seg->ps_va + seg->ps_memsz < seg->ps_va
+		    || seg->ps_va + seg->ps_memsz > UTOP)
+			return -E_INVAL;
+		seg->ps_perm = PTE_P | PTE_U | (seg->ps_perm & PTE_W);
+	}
+
+	if (!(pg = pager_lookup(req->req_env, 1)))
+		return -E_NO_MEM;
+	if ((r = sys_page_map(0, o->o_fd, 0,
+			      (void *) (PAGERVA + (pg - pagers) * PGSIZE),
+			      PTE_P|PTE_U)) < 0)
+		return r;
+	pg->pg_envid = req->req_env;
+	pg->pg_fileid = req->req_fileid;
+	pg->pg_nseg = req->req_nseg;
+	memmove(pg->pg_seg, req->req_seg, req->req_nseg * sizeof(req->req_seg[0]));
 	return 0;
 }
 
+// Map the page at va into envid, which faulted on it.  tmp is a free
+// page-sized address to build writable pages at.
+// Returns 0 on success, < 0 if the page cannot be paged in.
+static int
+pager_fill(envid_t envid, uintptr_t va, void *tmp)
+{
+	envid_t key = envs[ENVX(envid)].env_pager_key;
+	struct Pager *pg;
+	struct Fspager_seg *seg;
+	struct OpenFile *o;
+	uintptr_t start;
+	size_t i, filesz;
+	off_t off;
+	char *blk;
+	int r;
+
+	if (!(pg = pager_lookup(key, 0)))
+		return -E_BAD_ENV;
+	for (seg = pg->pg_seg; seg < pg->pg_seg + pg->pg_nseg; seg++)
+		if (va >= ROUNDDOWN(seg->ps_va, PGSIZE)
+		    && va < seg->ps_va + seg->ps_memsz)
+			break;
+	if (seg == pg->pg_seg + pg->pg_nseg)
+		return -E_INVAL;
+	if ((r = openfile_lookup(key, pg->pg_fileid, &o)) < 0)
+		return r;
+
+	// Work in whole pages, as spawn's map_segment does.
+	start = ROUNDDOWN(seg->ps_va, PGSIZE);
+	i = va - start;
+	filesz = seg->ps_filesz + (seg->ps_va - start);
+	off = seg->ps_offset - (seg->ps_va - start);
+
+	// Bss: a fresh zero page.
+	if (i >= filesz)
+		return sys_page_alloc(envid, (void *) va, seg->ps_perm);
+
+	// Read-only and filled by the file: share the block cache page,
+	// which bc_unshare keeps unchanged for the child.
+	if (!(seg->ps_perm & PTE_W) && i + PGSIZE <= filesz) {
+		file_lock(o->o_file);
+		r = file_get_block(o->o_file, (off + i) / BLKSIZE, &blk);
+		file_unlock(o->o_file);
+		if (r < 0)
+			return r;
+		return sys_page_map(0, blk, envid, (void *) va, PTE_P|PTE_U);
+	}
+
+	// Anything else gets a private copy.
+	if ((r = sys_page_alloc(0, tmp, PTE_P|PTE_U|PTE_W)) < 0)
+		return r;
+	file_lock(o->o_file);
+	r = file_read(o->o_file, tmp, MIN(PGSIZE, filesz - i), off + i);
+	file_unlock(o->o_file);
+	if (r >= 0)
+		r = sys_page_map(0, tmp, envid, (void *) va, seg->ps_perm);
+	sys_page_unmap(0, tmp);
+	return r < 0 ? r : 0;
+}
 
 int
-serve_sync(envid_t envid, union Fsipc *req)
+serve_sync(envid_t envid, uint32_t *words)
 {
 	fs_sync();
 	return 0;
@@ -305,45 +859,372 @@ fshandler handlers[] = {
 	// Open is handled specially because it passes pages
 	/* [FSREQ_OPEN] =	(fshandler)serve_open, */
 	[FSREQ_READ] =		serve_read,
-	[FSREQ_STAT] =		serve_stat,
-	[FSREQ_FLUSH] =		(fshandler)serve_flush,
 	[FSREQ_WRITE] =		(fshandler)serve_write,
-	[FSREQ_SET_SIZE] =	(fshandler)serve_set_size,
-	[FSREQ_SYNC] =		serve_sync
+	[FSREQ_READV] =		(fshandler)serve_readv,
+	[FSREQ_WRITEV] =	(fshandler)serve_writev,
+	[FSREQ_COPY] =		(fshandler)serve_copy,
+	[FSREQ_PAGER] =		(fshandler)serve_pager
 };
 
+// Short requests take their arguments from words[1..] and leave any
+// values they return there; words[0] is the request code.
+typedef int (*fshandler_short)(envid_t envid, uint32_t *words);
+
+fshandler_short short_handlers[] = {
+	[FSREQ_STAT] =		serve_stat,
+	[FSREQ_FLUSH] =		serve_flush,
+	[FSREQ_SET_SIZE] =	serve_set_size,
+	[FSREQ_SYNC] =		serve_sync,
+	[FSREQ_AIO_SUBMIT] =	serve_aio_submit
+};
+
+// Requests that cannot dirty the block cache.
+static bool
+req_read_only(uint32_t req)
+{
+	switch (req) {
+	case FSREQ_READ:
+	case FSREQ_READV:
+	case FSREQ_STAT:
+	case FSREQ_FLUSH:
+	case FSREQ_SYNC:
+	case FSREQ_SETBUF:
+	case FSREQ_AIO_SETUP:
+		return 1;
+	default:
+		return 0;
+	}
+}
+
+// Requests whose first word is the file id they operate on.
+static bool
+req_has_fileid(uint32_t req)
+{
+	switch (req) {
+	case FSREQ_READ:
+	case FSREQ_WRITE:
+	case FSREQ_STAT:
+	case FSREQ_FLUSH:
+	case FSREQ_SET_SIZE:
+	case FSREQ_READV:
+	case FSREQ_WRITEV:
+	case FSREQ_MAP:
+		return 1;
+	default:
+		return 0;
+	}
+}
+
+// A client request handed to a server thread.  The request page is
+// moved from fsreq to r_ipc so the next request can be received while
+// this one is in progress; a short request keeps its words in r_words
+// instead, and its reply goes back in them.  Once served, the request
+// holds its reply until the main loop sends it.
+struct Request {
+	bool r_busy;
+	bool r_done;		// Served; the reply is below
+	uint32_t r_type;
+	envid_t r_whom;
+	int r_perm;
+	union Fsipc *r_ipc;
+	bool r_short;		// Short request, with no page
+	uint32_t r_words[IPC_NWORDS];
+	int32_t r_ret;		// Reply value
+	void *r_pg;		// ... page, or NULL
+	int r_rperm;		// ... and its permissions
+};
+
+#define REQVA		0x0ffe0000
+
+struct Request requests[NTHREAD];
+
+static void
+serve_request(void *arg)
+{
+	struct Request *rq = arg;
+	struct OpenFile *o;
+	struct File *lock;
+	uint32_t fileid;
+	int perm, r;
+	void *pg;
+
+	// Requests on an open file hold that file's lock, and open holds
+	// the root directory's, so no thread sees a file or directory
+	// half-updated by another thread that is waiting on the disk.
+	lock = NULL;
+	fileid = rq->r_short ? rq->r_words[1] : rq->r_ipc->read.req_fileid;
+	if (rq->r_type == FSREQ_OPEN)
+		lock = &super->s_root;
+	else if (req_has_fileid(rq->r_type)
+		 && openfile_lookup(rq->r_whom, fileid, &o) >= 0)
+		lock = o->o_file;
+	if (lock)
+		file_lock(lock);
+
+	pg = NULL;
+	perm = rq->r_perm;
+	if (rq->r_short) {
+		if (rq->r_type < ARRAY_SIZE(short_handlers)
+		    && short_handlers[rq->r_type])
+			r = short_handlers[rq->r_type](rq->r_whom, rq->r_words);
+		else {
+			cprintf("Invalid short request code %d from %08x\n",
+				rq->r_type, rq->r_whom);
+			r = -E_INVAL;
+		}
+		rq->r_words[0] = r;
+	} else if (rq->r_type == FSREQ_OPEN) {
+		r = serve_open(rq->r_whom, (struct Fsreq_open*)rq->r_ipc, &pg, &perm);
+	} else if (rq->r_type == FSREQ_MAP) {
+		// Map is also special: it passes back a block cache page
+		r = serve_map(rq->r_whom, (struct Fsreq_map*)rq->r_ipc, &pg, &perm);
+	} else if (rq->r_type == FSREQ_SETBUF) {
+		// Setbuf is also special: it keeps the request page
+		r = serve_setbuf(rq->r_whom, (struct Fsreq_setbuf*)rq->r_ipc, perm);
+	} else if (rq->r_type == FSREQ_AIO_SETUP) {
+		r = serve_aio_setup(rq->r_whom, (struct Fsreq_setbuf*)rq->r_ipc, perm);
+	} else if (rq->r_type < ARRAY_SIZE(handlers) && handlers[rq->r_type]) {
+		r = handlers[rq->r_type](rq->r_whom, rq->r_ipc);
+	} else {
+		cprintf("Invalid request code %d from %08x\n", rq->r_type, rq->r_whom);
+		r = -E_INVAL;
+	}
+
+	if (lock)
+		file_unlock(lock);
+	if (!req_read_only(rq->r_type))
+		wb_pending = 1;
+
+	// The main loop sends the reply, so that it can go out together
+	// with the wait for the next request.
+	rq->r_ret = r;
+	rq->r_pg = pg;
+	rq->r_rperm = perm;
+	rq->r_done = 1;
+}
+
+// Free a request whose reply has been sent.
+static void
+serve_done(struct Request *rq)
+{
+	if (!rq->r_short)
+		sys_page_unmap(0, rq->r_ipc);
+	rq->r_done = 0;
+	rq->r_busy = 0;
+}
+
+// Send rq's reply on its own, and free rq.  Clients wait for replies
+// in ipc_call, so the send goes through at once unless the client is
+// not calling the usual way; then let the other threads run meanwhile,
+// as the client may have to wait for us to page something in before it
+// gets to receive.
+static void
+serve_reply(struct Request *rq)
+{
+	int r;
+
+	while ((r = rq->r_short
+		    ? sys_ipc_try_send_short(rq->r_whom, rq->r_words)
+		    : sys_ipc_try_send(rq->r_whom, rq->r_ret,
+				       rq->r_pg ? rq->r_pg : (void *) UTOP,
+				       rq->r_rperm)) == -E_IPC_NOT_RECV) {
+		thread_yield();
+		sys_yield();
+	}
+	if (r < 0)
+		cprintf("reply to %08x failed: %e\n", rq->r_whom, r);
+	serve_done(rq);
+}
+
+// Send the replies of the requests that have been served.  If keep is
+// set, hold one back, for the caller to send along with its next
+// receive, and return it.
+static struct Request *
+serve_replies(bool keep)
+{
+	struct Request *rq, *kept = NULL;
+
+	for (rq = requests; rq < requests + NTHREAD; rq++) {
+		if (!rq->r_done)
+			continue;
+		if (keep && !kept)
+			kept = rq;
+		else
+			serve_reply(rq);
+	}
+	return kept;
+}
+
+// Block until the next request arrives, first replying to rq in the
+// same system call if rq is not NULL.  Every receive here is at
+// fsreq, which is where a short reply's receive goes too.
+static uint32_t
+serve_recv(struct Request *rq, envid_t *whom, int *perm)
+{
+	uint32_t req;
+
+	if (!rq)
+		return ipc_recv(whom, fsreq, perm);
+	if (rq->r_short)
+		req = ipc_reply_recv_short(rq->r_whom, rq->r_words, whom, perm);
+	else
+		req = ipc_reply_recv(rq->r_whom, rq->r_ret, rq->r_pg,
+				     rq->r_rperm, whom, fsreq, perm);
+	if (*whom == 0) {
+		// Neither the reply nor the receive happened.  A client
+		// that is not receiving yet gets the reply on its own.
+		if ((int32_t) req == -E_IPC_NOT_RECV)
+			serve_reply(rq);
+		else {
+			cprintf("reply to %08x failed: %e\n", rq->r_whom, req);
+			serve_done(rq);
+		}
+		return ipc_recv(whom, fsreq, perm);
+	}
+	serve_done(rq);
+	return req;
+}
+
+// Page in the fault the kernel forwarded in rq (r_type holds the
+// address), then let the faulting env retry.  If the page cannot be
+// paged in, setting the env runnable without it makes the kernel
+// destroy the env.  There is no reply.
+static void
+serve_fault(void *arg)
+{
+	struct Request *rq = arg;
+	int r;
+
+	if ((r = pager_fill(rq->r_whom, rq->r_type, rq->r_ipc)) < 0)
+		cprintf("[%08x] cannot page in %08x: %e\n",
+			rq->r_whom, rq->r_type, r);
+	if ((r = sys_env_set_status(rq->r_whom, ENV_RUNNABLE)) < 0)
+		cprintf("[%08x] cannot resume after paging: %e\n", rq->r_whom, r);
+	rq->r_busy = 0;
+}
+
+// Hand a request to a free thread.  One is free here: none is busy,
+// or the receive was only armed while one was.  words holds a short
+// request, or is NULL.
+static void
+serve_start(void (*func)(void *), uint32_t req, envid_t whom, int perm,
+	    const volatile uint32_t *words)
+{
+	struct Request *rq;
+	int i, r;
+
+	for (rq = requests; rq->r_busy; rq++)
+		/* do nothing */;
+	rq->r_ipc = (union Fsipc *) (REQVA + (rq - requests) * PGSIZE);
+	if (perm & PTE_P) {
+		if ((r = sys_page_map(0, fsreq, 0, rq->r_ipc, perm & PTE_SYSCALL)) < 0)
+			panic("serve: sys_page_map: %e", r);
+		sys_page_unmap(0, fsreq);
+	}
+	rq->r_short = (words != NULL);
+	for (i = 0; words && i < IPC_NWORDS; i++)
+		rq->r_words[i] = words[i];
+	rq->r_busy = 1;
+	rq->r_type = req;
+	rq->r_whom = whom;
+	rq->r_perm = perm;
+	if ((r = thread_create(func, rq)) < 0)
+		panic("serve: thread_create: %e", r);
+	thread_yield();
+}
+
 void
 serve(void)
 {
-	uint32_t req, whom;
+	struct Request *rq;
+	uint32_t req;
+	envid_t whom;
 	int perm, r;
-	void *pg;
+	bool armed = 0, arrived;
 
 	while (1) {
-		perm = 0;
-		req = ipc_recv((int32_t *) &whom, fsreq, &perm);
+		// Queued asynchronous I/O runs on a thread of its own, while
+		// the clients that submitted it get on with other work.
+		if (naio_pending > 0 && !aio_running && !armed
+		    && thread_create(serve_aio, NULL) == 0)
+			aio_running = 1;
+
+		// Reply to the requests that have been served, but if we
+		// are about to block, save one to go out with the receive.
+		// Not while a writeback is due, as that receive cannot time
+		// out.
+		arrived = armed && !thisenv->env_ipc_recving;
+		rq = serve_replies(!arrived && thread_nbusy() == 0 && !wb_pending);
+
+		if (arrived) {
+			// A request arrived while other requests were running.
+			armed = 0;
+			req = thisenv->env_ipc_value;
+			whom = thisenv->env_ipc_from;
+			perm = thisenv->env_ipc_perm;
+		} else if (thread_nbusy() == 0 && wb_pending) {
+			// Nothing in progress, but the cache may be dirty:
+			// wait for a request, and if none comes for a while,
+			// write it back.
+			armed = 0;
+			perm = 0;
+			req = ipc_recv_timeout(&whom, fsreq, &perm, WRITEBACK_US);
+			if (whom == 0 && req == -E_TIMEOUT) {
+				wb_pending = 0;
+				if (thread_create(serve_writeback, NULL) < 0)
+					wb_pending = 1;
+				continue;
+			}
+		} else if (thread_nbusy() == 0) {
+			// Nothing in progress: block until a request arrives.
+			armed = 0;
+			perm = 0;
+			req = serve_recv(rq, &whom, &perm);
+		} else {
+			// Some threads are waiting on the disk.  Keep accepting
+			// requests without blocking, and give the threads and
+			// the clients the CPU in turn.  Once the threads are
+			// down to waiting for a disk interrupt, sleep until it
+			// or a request comes in.
+			if (!armed && thread_nbusy() < NTHREAD) {
+				if ((r = sys_ipc_recv_nb(fsreq)) < 0)
+					panic("serve: sys_ipc_recv_nb: %e", r);
+				armed = 1;
+			}
+			thread_yield();
+			if (ide_waiting_irq())
+				sys_notify_wait((1 << IDE_NOTIFY_BIT)
+						| (armed ? NOTIFY_IPC : 0));
+			else
+				sys_yield();
+			continue;
+		}
+
 		if (debug)
 			cprintf("fs req %d from %08x [page %08x: %s]\n",
 				req, whom, uvpt[PGNUM(fsreq)], fsreq);
 
-		// All requests must contain an argument page
+		// Short requests carry their arguments in the message.
+		if (thisenv->env_ipc_nwords) {
+			serve_start(serve_request, req, whom, 0,
+				    thisenv->env_ipc_words);
+			continue;
+		}
+
+		// Page faults forwarded by the kernel carry no page; all
+		// other requests must contain an argument page
 		if (!(perm & PTE_P)) {
+			if (envs[ENVX(whom)].env_id == whom
+			    && envs[ENVX(whom)].env_pager == thisenv->env_id) {
+				serve_start(serve_fault, req, whom, perm, NULL);
+				continue;
+			}
 			cprintf("Invalid request from %08x: no argument page\n",
 				whom);
 			continue; // just leave it hanging...
 		}
 
-		pg = NULL;
-		if (req == FSREQ_OPEN) {
-			r = serve_open(whom, (struct Fsreq_open*)fsreq, &pg, &perm);
-		} else if (req < ARRAY_SIZE(handlers) && handlers[req]) {
-			r = handlers[req](whom, fsreq);
-		} else {
-			cprintf("Invalid request code %d from %08x\n", req, whom);
-			r = -E_INVAL;
-		}
-		ipc_send(whom, r, pg, perm);
-		sys_page_unmap(0, fsreq);
+		serve_start(serve_request, req, whom, perm, NULL);
 	}
 }
 
@@ -361,6 +1242,7 @@ umain(int argc, char **argv)
 	serve_init();
 	fs_init();
         fs_test();
+	thread_init();
 	serve();
 }
 
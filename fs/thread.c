@@ -0,0 +1,263 @@
+/*
+ * Cooperative threads for the file system server.
+ *
+ * The server runs each client request on its own small thread so that
+ * a request stuck waiting for the disk does not hold up requests that
+ * can be answered from the block cache.  Threads only switch in
+ * thread_yield(), which the disk driver calls while it polls the
+ * controller, so everything between two yields runs atomically.
+ *
+ * Most disk waits happen inside bc_pgfault, on the user exception
+ * stack.  That stack lives at a fixed address, so each thread gets a
+ * private page for it and a switch remaps UXSTACKTOP - PGSIZE to the
+ * incoming thread's page.  The remap runs on a separate switch stack
+ * because the outgoing thread may be standing on the page being
+ * replaced.
+ *
+ * Thread 0 is the main server loop; threads 1..NTHREAD serve requests.
+ */
+
+#include "fs.h"
+
+// Per-thread memory, starting at THREADVA, which lies above the
+// per-client windows of serv.c and clear of lib/fd.c's FDTABLE and
+// FILEDATA ranges:
+//	pages 0 .. THREAD_STKPAGES-1	normal stack
+//	page  THREAD_STKPAGES		unmapped guard
+//	page  THREAD_STKPAGES+1		scratch page for bc_pgfault
+//	page  THREAD_STKPAGES+2		exception stack
+#define THREADVA	0xEA000000
+#define THREAD_STKPAGES	4
+#define THREAD_PAGES	(THREAD_STKPAGES + 3)
+
+#define THREAD_BASE(t)	(THREADVA + ((t) - threads) * THREAD_PAGES * PGSIZE)
+#define THREAD_XSTK(t)	((void *) (THREAD_BASE(t) + (THREAD_STKPAGES + 2) * PGSIZE))
+
+enum {
+	T_FREE = 0,
+	T_RUNNING,
+};
+
+struct Thread {
+	int t_status;
+	uint32_t t_esp;		// saved stack pointer while switched out
+	uint32_t t_loading;	// block being read in by bc_pgfault, or 0
+	struct File *t_lock;	// file lock held, or NULL
+	void (*t_func)(void *);
+	void *t_arg;
+};
+
+static struct Thread threads[NTHREAD + 1] = {
+	{ T_RUNNING }
+};
+static struct Thread *curthread = &threads[0];
+static bool thread_inited;
+
+char switch_stack[PGSIZE] __attribute__((aligned(16)));
+
+uint32_t thread_switches;
+
+uint32_t thread_remap_xstack(struct Thread *next);
+void thread_switch(uint32_t *save_esp, struct Thread *next);
+
+// Save callee-saved registers on the current stack, hop onto
+// switch_stack to remap the exception stack, then resume next.
+asm(".text\n"
+    ".globl thread_switch\n"
+    "thread_switch:\n"
+    "	movl 4(%esp), %eax\n"
+    "	movl 8(%esp), %ecx\n"
+    "	pushl %ebp\n"
+    "	pushl %ebx\n"
+    "	pushl %esi\n"
+    "	pushl %edi\n"
+    "	movl %esp, (%eax)\n"
+    "	movl $switch_stack + 4096, %esp\n"
+    "	pushl %ecx\n"
+    "	call thread_remap_xstack\n"
+    "	movl %eax, %esp\n"
+    "	popl %edi\n"
+    "	popl %esi\n"
+    "	popl %ebx\n"
+    "	popl %ebp\n"
+    "	ret\n");
+
+uint32_t
+thread_remap_xstack(struct Thread *next)
+{
+	int r;
+
+	if ((r = sys_page_map(0, THREAD_XSTK(next), 0,
+			      (void *) (UXSTACKTOP - PGSIZE),
+			      PTE_P|PTE_U|PTE_W)) < 0)
+		panic("thread_remap_xstack: %e", r);
+	curthread = next;
+	return next->t_esp;
+}
+
+static void
+thread_entry(void)
+{
+	struct Thread *t = curthread;
+
+	t->t_func(t->t_arg);
+	t->t_status = T_FREE;
+	thread_yield();
+	panic("freed thread rescheduled");
+}
+
+// Set up the exception and request pages of every thread.
+// Must be called after the page fault handler is installed.
+void
+thread_init(void)
+{
+	struct Thread *t;
+	int r;
+
+	// The main thread keeps the exception stack it already has.
+	if ((r = sys_page_map(0, (void *) (UXSTACKTOP - PGSIZE),
+			      0, THREAD_XSTK(&threads[0]),
+			      PTE_P|PTE_U|PTE_W)) < 0)
+		panic("thread_init: %e", r);
+	for (t = &threads[1]; t <= &threads[NTHREAD]; t++)
+		if ((r = sys_page_alloc(0, THREAD_XSTK(t),
+					PTE_P|PTE_U|PTE_W)) < 0)
+			panic("thread_init: %e", r);
+	thread_inited = 1;
+}
+
+// Start func(arg) on a free thread.
+// Returns 0 on success, -E_NO_MEM if every thread is busy.
+int
+thread_create(void (*func)(void *), void *arg)
+{
+	struct Thread *t;
+	uint32_t *sp;
+	int i, r;
+
+	for (t = &threads[1]; t <= &threads[NTHREAD]; t++)
+		if (t->t_status == T_FREE)
+			break;
+	if (t > &threads[NTHREAD])
+		return -E_NO_MEM;
+
+	// The stack is only allocated the first time a thread is used.
+	sp = (uint32_t *) (THREAD_BASE(t) + THREAD_STKPAGES * PGSIZE);
+	if (!va_is_mapped(sp - 1)) {
+		for (i = 1; i <= THREAD_STKPAGES; i++)
+			if ((r = sys_page_alloc(0, (char *) sp - i * PGSIZE,
+						PTE_P|PTE_U|PTE_W)) < 0)
+				return r;
+	}
+
+	// Initial frame popped by thread_switch: four callee-saved
+	// registers, then the return address.
+	*--sp = 0;
+	*--sp = (uint32_t) thread_entry;
+	*--sp = 0;	// ebp
+	*--sp = 0;	// ebx
+	*--sp = 0;	// esi
+	*--sp = 0;	// edi
+	t->t_esp = (uint32_t) sp;
+	t->t_func = func;
+	t->t_arg = arg;
+	t->t_loading = 0;
+	t->t_lock = NULL;
+	t->t_status = T_RUNNING;
+	return 0;
+}
+
+// Let the next running thread go, round-robin, coming back here once
+// every other thread has had a turn.  A no-op if no other thread is
+// running, so waiting loops built on it degrade to plain spinning.
+void
+thread_yield(void)
+{
+	struct Thread *next;
+	int i;
+
+	if (!thread_inited)
+		return;
+	next = curthread;
+	for (i = 0; i < NTHREAD + 1; i++) {
+		if (++next > &threads[NTHREAD])
+			next = &threads[0];
+		if (next->t_status == T_RUNNING)
+			break;
+	}
+	if (next == curthread)
+		return;
+	thread_switches++;
+	thread_switch(&curthread->t_esp, next);
+}
+
+// Number of request threads currently in use.
+int
+thread_nbusy(void)
+{
+	int n = 0;
+	struct Thread *t;
+
+	for (t = &threads[1]; t <= &threads[NTHREAD]; t++)
+		if (t->t_status != T_FREE)
+			n++;
+	return n;
+}
+
+// A page-sized scratch address private to the current thread.
+void *
+thread_scratch(void)
+{
+	return (void *) (THREAD_BASE(curthread) + (THREAD_STKPAGES + 1) * PGSIZE);
+}
+
+// Note that the current thread is reading blockno into the cache
+// (or has finished, if blockno is 0).  Returns 1 if some other
+// thread was already reading it in, after waiting for that to finish;
+// the caller should then just retry its access.
+int
+thread_load_block(uint32_t blockno)
+{
+	struct Thread *t;
+	int waited = 0;
+
+	if (blockno) {
+	again:
+		for (t = &threads[0]; t <= &threads[NTHREAD]; t++)
+			if (t != curthread && t->t_status == T_RUNNING
+			    && t->t_loading == blockno) {
+				waited = 1;
+				thread_yield();
+				goto again;
+			}
+		if (waited)
+			return 1;
+	}
+	curthread->t_loading = blockno;
+	return 0;
+}
+
+// Take the per-file lock on f, waiting for whichever thread holds it.
+// A thread holds at most one file lock at a time.
+void
+file_lock(struct File *f)
+{
+	struct Thread *t;
+
+	assert(curthread->t_lock == NULL);
+again:
+	for (t = &threads[0]; t <= &threads[NTHREAD]; t++)
+		if (t != curthread && t->t_status == T_RUNNING
+		    && t->t_lock == f) {
+			thread_yield();
+			goto again;
+		}
+	curthread->t_lock = f;
+}
+
+void
+file_unlock(struct File *f)
+{
+	assert(curthread->t_lock == f);
+	curthread->t_lock = NULL;
+}
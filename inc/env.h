@@ -9,6 +9,8 @@
 
 typedef int32_t envid_t;
 
+struct IpcMsg;
+
 // An environment ID 'envid_t' has three parts:
 //
 // +1+---------------21-----------------+--------10--------+
@@ -26,6 +28,20 @@ typedef int32_t envid_t;
 #define NENV			(1 << LOG2NENV)
 #define ENVX(envid)		((envid) & (NENV - 1))
 
+// Number of words in a short IPC message, which travels in registers
+// instead of on a page: ecx, ebx, edi and esi, in order, both ways.
+#define IPC_NWORDS		4
+
+// Number of messages that can wait in an environment's queue.
+#define IPC_QUEUE_MAX		16
+
+// Notification bits an environment can be signalled with.  Bit 31 is
+// left out so that sys_notify_wait's result never looks like an error.
+#define NOTIFY_ALL		0x7fffffff
+// Signalled by the kernel when a message arrives at a receive armed
+// with sys_ipc_recv_nb while the receiver is not blocked in sys_ipc_recv.
+#define NOTIFY_IPC		0x40000000
+
 // Values of env_status in struct Env
 enum {
 	ENV_FREE = 0,
@@ -35,6 +51,22 @@ enum {
 	ENV_NOT_RUNNABLE
 };
 
+// Scheduling priorities: 0 is the highest, ENV_NPRIO - 1 the lowest.
+#define ENV_NPRIO		4
+#define ENV_PRIO_AUTO		(-1)	// Let the scheduler adjust it
+
+// Tickets for stride scheduling: CPU shares are proportional to them.
+#define ENV_TICKETS_DEFAULT	100
+#define ENV_TICKETS_MAX		(1 << 16)
+
+// CPU affinity: bit i of env_affinity allows the env to run on CPU i.
+#define ENV_AFFINITY_ALL	0xffffffff
+
+// Exit status of an environment that was destroyed, by itself or by
+// another, rather than exiting through sys_env_exit.  Statuses passed
+// to sys_env_exit are cut down to 0..255.
+#define ENV_EXIT_KILLED		0x100
+
 // Special environment types
 enum EnvType {
 	ENV_TYPE_USER = 0,
@@ -51,6 +83,28 @@ struct Env {
 	uint32_t env_runs;		// Number of times environment has run：应该是用于换入、换出策略的
 	int env_cpunum;			// The CPU that the env is running on
 
+	// Scheduling
+	struct Env *env_rq_next;	// Links on a CPU's run queue
+	struct Env *env_rq_prev;
+	int env_rq_cpu;			// CPU whose run queue we are on, or -1
+	int env_prio;			// Current priority level
+	bool env_prio_fixed;		// Set by sys_env_set_priority
+	uint32_t env_tickets;		// Stride scheduling share
+	uint64_t env_pass;		// Stride scheduling virtual time
+	int env_rq_pos;			// Index in the run queue heap
+	uint32_t env_affinity;		// CPUs we may run on
+	uint32_t env_migrations;	// Runs that started on a new CPU
+
+	// Wait queues
+	struct Env *env_wq_next;	// Next sleeper on our wait queue
+	physaddr_t env_wq_key;		// Address we sleep on, or 0
+	int env_exit_status;		// For sys_env_wait, once we are gone
+
+	// Timer
+	uint64_t env_timer_expire;	// Tick our timer fires on, or 0
+	struct Env *env_timer_next;	// Next timer in its wheel slot
+	void (*env_timer_fn)(struct Env *); // Called when it fires
+
 	// Address space
 	pde_t *env_pgdir;		// Kernel virtual address of page dir
 
@@ -58,11 +112,35 @@ struct Env {
 	void *env_pgfault_upcall;	// Page fault upcall entry point
 
 	// Lab 4 IPC
-	bool env_ipc_recving;		// Env is blocked receiving
+	bool env_ipc_recving;		// Env is receiving
+	envid_t env_ipc_waitfor;	// ... or waiting for this env's reply
+	bool env_ipc_blocked;		// ... and blocked until it arrives
 	void *env_ipc_dstva;		// VA at which to map received page
 	uint32_t env_ipc_value;		// Data value sent to us
 	envid_t env_ipc_from;		// envid of the sender
 	int env_ipc_perm;		// Perm of page mapping received
+	envid_t env_ipc_handoff;	// Receiver we just woke, to run if we block
+	uint32_t env_ipc_words[IPC_NWORDS]; // Short message sent to us
+	int env_ipc_nwords;		// IPC_NWORDS if it was short, else 0
+	bool env_ipc_inregs;		// Reply goes to our registers
+	struct IpcMsg *env_ipc_qhead;	// Messages waiting to be received
+	struct IpcMsg *env_ipc_qtail;	// ... the newest of them
+	uint32_t env_ipc_qlen;		// Number waiting, <= IPC_QUEUE_MAX
+	uint32_t env_ipc_qmax;		// ... at most, so far
+
+	// Notifications
+	uint32_t env_notify_pending;	// Bits signalled, not yet waited for
+	uint32_t env_notify_mask;	// Bits waited for in sys_notify_wait
+
+	// Demand paging
+	envid_t env_pager;		// Env that pages in our missing pages
+	uintptr_t env_pager_lo;		// ... in [env_pager_lo, env_pager_hi)
+	uintptr_t env_pager_hi;
+	envid_t env_pager_key;		// Env the pager knows this range by
+	uintptr_t env_pager_fault;	// Fault the pager is to page in, or 0
+	struct Env *env_pager_link;	// ... next env waiting for that pager
+	struct Env *env_pager_qhead;	// As pager: envs whose faults wait
+	struct Env *env_pager_qtail;	// ... the last of them
 };
 
 #endif // !JOS_INC_ENV_H
@@ -16,6 +16,9 @@ enum {
 
 	E_IPC_NOT_RECV	,	// Attempt to send to env that is not recving
 	E_EOF		,	// Unexpected end of file
+	E_AGAIN		,	// Condition changed; try again
+	E_IPC_QUEUE_FULL,	// Receiver's message queue is full
+	E_TIMEOUT	,	// Timed out
 
 	// File system error codes -- only seen in user-level
 	E_NO_DISK	,	// No free space left on disk
@@ -21,10 +21,13 @@ struct Dev {
 	int (*dev_close)(struct Fd *fd);
 	int (*dev_stat)(struct Fd *fd, struct Stat *stat);
 	int (*dev_trunc)(struct Fd *fd, off_t length);
+	int (*dev_seek)(struct Fd *fd, off_t offset);
+	ssize_t (*dev_sendfile)(struct Fd *out, struct Fd *in, off_t offset, size_t len);
 };
 
 struct FdFile {
 	int id;
+	char name[MAXNAMELEN];	// set by the file server on open
 };
 
 struct Fd {
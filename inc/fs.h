@@ -26,6 +26,12 @@
 
 #define MAXFILESIZE	((NDIRECT + NINDIRECT) * BLKSIZE)
 
+// Pages in the bulk transfer buffer each client shares with the file
+// server (see FSREQ_SETBUF).  FSREQ_READV and FSREQ_WRITEV move up to
+// FSBUFSIZE bytes through it per round trip.
+#define FSBUFPAGES	16
+#define FSBUFSIZE	(FSBUFPAGES * PGSIZE)
+
 struct File { // 一个文件的meta data。实际的数据块 由f_direct和f_indirect来指定
 	char f_name[MAXNAMELEN];	// filename
 	off_t f_size;			// file size in bytes
@@ -59,18 +65,90 @@ struct Super {
 	struct File s_root;		// Root directory node
 };
 
-// Definitions for requests from clients to file system
+// Definitions for requests from clients to file system.  Most requests
+// carry a page; the short ones, marked below, go as a short IPC message
+// instead, with the request code in words[0] and arguments after it.
+// Their replies hold the result in words[0] and any returned values
+// after it.
 enum {
 	FSREQ_OPEN = 1,
+	// Short: set_size(fileid, size)
 	FSREQ_SET_SIZE,
 	// Read returns a Fsret_read on the request page
 	FSREQ_READ,
 	FSREQ_WRITE,
-	// Stat returns a Fsret_stat on the request page
+	// Short: stat(fileid) returns the size and whether the file is a
+	// directory; the name is on the Fd page, put there by open
 	FSREQ_STAT,
+	// Short: flush(fileid)
 	FSREQ_FLUSH,
 	FSREQ_REMOVE,
-	FSREQ_SYNC
+	// Short: sync()
+	FSREQ_SYNC,
+	// Setbuf passes one page of the client's bulk transfer buffer;
+	// the request page *is* that buffer page
+	FSREQ_SETBUF,
+	// Readv/writev transfer their data through the bulk buffer
+	FSREQ_READV,
+	FSREQ_WRITEV,
+	// Aio_setup passes one page of the client's async I/O area, like
+	// setbuf; aio_submit, short, tells the server new entries are queued
+	FSREQ_AIO_SETUP,
+	FSREQ_AIO_SUBMIT,
+	// Copy copies between two open files inside the server; map
+	// returns the block cache page holding an offset, read-only
+	FSREQ_COPY,
+	FSREQ_MAP,
+	// Pager registers a spawned child's segments for demand paging
+	FSREQ_PAGER
+};
+
+// One loadable program segment, as registered with FSREQ_PAGER.
+struct Fspager_seg {
+	uintptr_t ps_va;
+	size_t ps_memsz;
+	size_t ps_filesz;
+	off_t ps_offset;	// file offset of ps_va
+	int ps_perm;
+};
+
+#define FSPAGER_NSEG	8
+
+// Asynchronous I/O.  A client shares FSAIO_NPAGES pages with the server:
+// a struct Fsaio_ring followed by one data page per ring entry.  The
+// client fills submission entries and advances sq_tail; the server
+// advances sq_head as it takes them, and posts a completion for each.
+#define FSAIO_NENTRY	16
+#define FSAIO_NPAGES	(1 + FSAIO_NENTRY)
+
+// Submission opcodes
+enum {
+	FSAIO_READ = 1,
+	FSAIO_WRITE
+};
+
+struct Fsaio_sqe {
+	uint32_t sqe_tag;	// returned in the completion
+	int sqe_op;		// FSAIO_READ or FSAIO_WRITE
+	int sqe_fileid;
+	off_t sqe_offset;	// file position of the transfer
+	size_t sqe_n;		// at most PGSIZE
+	int sqe_slot;		// data page index for the transfer
+};
+
+struct Fsaio_cqe {
+	uint32_t cqe_tag;
+	int cqe_slot;
+	int cqe_res;		// bytes transferred, < 0 on error
+};
+
+struct Fsaio_ring {
+	volatile uint32_t sq_head;	// advanced by the server
+	volatile uint32_t sq_tail;	// advanced by the client
+	volatile uint32_t cq_head;	// advanced by the client
+	volatile uint32_t cq_tail;	// advanced by the server
+	struct Fsaio_sqe sq[FSAIO_NENTRY];
+	struct Fsaio_cqe cq[FSAIO_NENTRY];
 };
 
 union Fsipc { // 传递 文件系统 相关的IPC的 参数
@@ -78,10 +156,6 @@ union Fsipc { // 传递 文件系统 相关的IPC的 参数
 		char req_path[MAXPATHLEN];
 		int req_omode;
 	} open;
-	struct Fsreq_set_size {
-		int req_fileid;
-		off_t req_size;
-	} set_size;
 	struct Fsreq_read {
 		int req_fileid;
 		size_t req_n;
@@ -94,20 +168,37 @@ union Fsipc { // 传递 文件系统 相关的IPC的 参数
 		size_t req_n;
 		char req_buf[PGSIZE - (sizeof(int) + sizeof(size_t))];
 	} write;
-	struct Fsreq_stat {
-		int req_fileid;
-	} stat;
-	struct Fsret_stat {
-		char ret_name[MAXNAMELEN];
-		off_t ret_size;
-		int ret_isdir;
-	} statRet;
-	struct Fsreq_flush {
-		int req_fileid;
-	} flush;
 	struct Fsreq_remove {
 		char req_path[MAXPATHLEN];
 	} remove;
+	struct Fsreq_setbuf {
+		int req_page;		// index of this page in the buffer
+	} setbuf;
+	struct Fsreq_setbuf aio_setup;
+	struct Fsreq_readv {
+		int req_fileid;
+		size_t req_n;		// at most FSBUFSIZE
+	} readv;
+	struct Fsreq_writev {
+		int req_fileid;
+		size_t req_n;		// at most FSBUFSIZE
+	} writev;
+	struct Fsreq_copy {
+		int req_fileid;		// destination, written at its position
+		int req_srcid;		// source, read at req_offset
+		off_t req_offset;
+		size_t req_n;
+	} copy;
+	struct Fsreq_map {
+		int req_fileid;
+		off_t req_offset;
+	} map;
+	struct Fsreq_pager {
+		int req_fileid;		// the program file
+		int32_t req_env;	// the child, not yet running (envid_t)
+		int req_nseg;
+		struct Fspager_seg req_seg[FSPAGER_NSEG];
+	} pager;
 
 	// Ensure Fsipc is one page
 	char _pad[PGSIZE];
@@ -20,6 +20,7 @@
 #include <inc/fs.h>
 #include <inc/fd.h>
 #include <inc/args.h>
+#include <inc/sync.h>
 
 #define USED(x)		(void)(x)
 
@@ -28,12 +29,30 @@ void	umain(int argc, char **argv);
 
 // libmain.c or entry.S
 extern const char *binaryname;
-extern const volatile struct Env *thisenv;
 extern const volatile struct Env envs[NENV];
 extern const volatile struct PageInfo pages[];
 
+// Each environment's Env pointer lives on a private page below the
+// stack, so that threads sharing everything else with sfork still see
+// their own.  A page is left unmapped between it and the stack.  So
+// does what lib/file.c registered with the file server, which the
+// server knows by envid.
+struct Uthread {
+	const volatile struct Env *ut_env;
+	envid_t ut_fsbuf_owner;		// Env that registered FSBUF
+	envid_t ut_fsaio_owner;		// ... and the async I/O ring
+	uint32_t ut_fsaio_submitted;	// sq_tail the server knows about
+	struct {
+		bool busy;
+		void *buf;		// where a read's data goes, else NULL
+	} ut_fsaio_slot[FSAIO_NENTRY];	// Transfers in flight, by data page
+};
+#define UTHREAD		(USTACKTOP - 3 * PGSIZE)
+#define thisenv		(((struct Uthread *) UTHREAD)->ut_env)
+
 // exit.c
 void	exit(void);
+void	exit_status(int status);
 
 // pgfault.c
 void	set_pgfault_handler(void (*handler)(struct UTrapframe *utf));
@@ -57,6 +76,25 @@ int	sys_page_map(envid_t src_env, void *src_pg,
 int	sys_page_unmap(envid_t env, void *pg);
 int	sys_ipc_try_send(envid_t to_env, uint32_t value, void *pg, int perm);
 int	sys_ipc_recv(void *rcv_pg);
+int	sys_ipc_recv_nb(void *rcv_pg);
+int	sys_ipc_recv_timeout(void *rcv_pg, uint32_t us);
+int	sys_env_set_pager(envid_t env, envid_t pager, uintptr_t lo, uintptr_t hi);
+int	sys_env_set_priority(envid_t env, int prio);
+int	sys_env_set_tickets(envid_t env, uint32_t tickets);
+int	sys_env_set_affinity(envid_t env, uint32_t mask);
+int	sys_sleep(const volatile void *va, uint32_t val, int ref);
+int	sys_wakeup(const volatile void *va, int n);
+void	sys_env_exit(int status);
+int	sys_env_wait(envid_t envid);
+int	sys_ipc_call(envid_t envid, uint32_t value, void *srcva, int perm, void *dstva);
+int	sys_ipc_reply_recv(envid_t envid, uint32_t value, void *srcva, int perm, void *dstva);
+int	sys_ipc_send(envid_t envid, uint32_t value, void *srcva, int perm);
+int	sys_ipc_try_send_short(envid_t envid, const uint32_t *words);
+int	sys_ipc_call_short(envid_t envid, uint32_t *words);
+int	sys_ipc_reply_recv_short(envid_t envid, const uint32_t *words);
+int	sys_notify(envid_t envid, uint32_t bits);
+int	sys_notify_wait(uint32_t mask);
+int	sys_irq_bind(int irq, int bit);
 
 // This must be inlined.  Exercise for reader: why?
 static inline envid_t __attribute__((always_inline))
@@ -72,12 +110,21 @@ sys_exofork(void)
 // ipc.c
 void	ipc_send(envid_t to_env, uint32_t value, void *pg, int perm);
 int32_t ipc_recv(envid_t *from_env_store, void *pg, int *perm_store);
+int32_t ipc_recv_timeout(envid_t *from_env_store, void *pg, int *perm_store,
+			 uint32_t us);
+int32_t ipc_call(envid_t to_env, uint32_t value, void *pg, int perm,
+		 void *dstpg, int *perm_store);
+int32_t ipc_reply_recv(envid_t to_env, uint32_t value, void *pg, int perm,
+		       envid_t *from_env_store, void *dstpg, int *perm_store);
+int32_t ipc_call_short(envid_t to_env, uint32_t *words);
+int32_t ipc_reply_recv_short(envid_t to_env, const uint32_t *words,
+			     envid_t *from_env_store, int *perm_store);
 envid_t	ipc_find_env(enum EnvType type);
 
 // fork.c
 #define	PTE_SHARE	0x400
 envid_t	fork(void);
-envid_t	sfork(void);	// Challenge!
+envid_t	sfork(void);
 
 // fd.c
 int	close(int fd);
@@ -89,12 +136,23 @@ ssize_t	readn(int fd, void *buf, size_t nbytes);
 int	dup(int oldfd, int newfd);
 int	fstat(int fd, struct Stat *statbuf);
 int	stat(const char *path, struct Stat *statbuf);
+ssize_t	sendfile(int out_fd, int in_fd, off_t offset, size_t count);
 
 // file.c
+extern uint32_t fsipc_nreq;
 int	open(const char *path, int mode);
 int	ftruncate(int fd, off_t size);
 int	remove(const char *path);
 int	sync(void);
+int	aio_read(int fd, void *buf, size_t n, off_t offset, uint32_t tag);
+int	aio_write(int fd, const void *buf, size_t n, off_t offset, uint32_t tag);
+int	aio_submit(void);
+int	aio_poll(uint32_t *tag_store, int *res_store);
+int	aio_wait(uint32_t *tag_store, int *res_store);
+int	file_flushbuf(struct Fd *fd);
+int	file_mapblock(int fileid, off_t offset, char **pg_store);
+void	file_unmapblock(void);
+int	file_pager(int fd, envid_t child, const struct Fspager_seg *seg, int nseg);
 
 // pageref.c
 int	pageref(void *addr);
@@ -102,6 +160,8 @@ int	pageref(void *addr);
 
 // spawn.c
 envid_t	spawn(const char *program, const char **argv);
+envid_t	spawn_eager(const char *program, const char **argv);
+envid_t	spawn_copy(const char *program, const char **argv);
 envid_t	spawnl(const char *program, const char *arg0, ...);
 
 // console.c
@@ -115,7 +175,20 @@ int	pipe(int pipefds[2]);
 int	pipeisclosed(int pipefd);
 
 // wait.c
-void	wait(envid_t env);
+int	wait(envid_t env);
+
+// chan.c
+struct Chan;
+#define CHAN_SIZE	(2 * PGSIZE)	// Page-aligned space for a Chan
+int	chan_create(struct Chan *ch, int bit);
+void	chan_send(struct Chan *ch, uint32_t v);
+uint32_t chan_recv(struct Chan *ch);
+void	chan_stat(struct Chan *ch, uint32_t *pwaits, uint32_t *cwaits);
+
+// uthread.c
+envid_t	uthread_create(int (*fn)(void *), void *arg);
+int	uthread_join(envid_t t);
+void	uthread_exit(int status) __attribute__((noreturn));
 
 /* File open modes */
 #define	O_RDONLY	0x0000		/* open for reading only */
@@ -127,5 +200,6 @@ void	wait(envid_t env);
 #define	O_TRUNC		0x0200		/* truncate to zero length */
 #define	O_EXCL		0x0400		/* error if already exists */
 #define O_MKDIR		0x0800		/* create directory, not regular file */
+#define O_DIRECT	0x1000		/* no client-side buffering */
 
 #endif	// !JOS_INC_LIB_H
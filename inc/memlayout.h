@@ -182,6 +182,9 @@ struct PageInfo { //就是物理页
 	// 在OS启动时，使用boot_alloc分配的物理页，还没有 有效的pp_ref的域的。
 
 	uint16_t pp_ref;
+
+	// Environments asleep on a word in this page (kern/wait.c).
+	uint16_t pp_sleepers;
 };
 
 #endif /* !__ASSEMBLER__ */
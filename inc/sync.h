@@ -0,0 +1,42 @@
+// Public definitions for the user-level synchronization primitives in
+// lib/sync.c.  They work between environments that share the memory
+// they live in: a PTE_SHARE page, or anything shared by sfork.
+
+#ifndef JOS_INC_SYNC_H
+#define JOS_INC_SYNC_H
+
+#include <inc/types.h>
+
+// 0 when unlocked, 1 when locked, 2 when locked and someone may be
+// sleeping for it.
+struct Mutex {
+	volatile uint32_t m_state;
+};
+
+// Bumped by every signal; waiters sleep on the value they last saw.
+struct Cond {
+	volatile uint32_t c_seq;
+	volatile uint32_t c_nwait;	// Waiters that may be asleep
+};
+
+struct Sem {
+	volatile uint32_t s_count;
+	volatile uint32_t s_nwait;	// Waiters that may be asleep
+};
+
+void	mutex_init(struct Mutex *m);
+void	mutex_lock(struct Mutex *m);
+bool	mutex_trylock(struct Mutex *m);
+void	mutex_unlock(struct Mutex *m);
+
+void	cond_init(struct Cond *c);
+void	cond_wait(struct Cond *c, struct Mutex *m);
+void	cond_signal(struct Cond *c);
+void	cond_broadcast(struct Cond *c);
+
+void	sem_init(struct Sem *s, uint32_t count);
+void	sem_wait(struct Sem *s);
+bool	sem_trywait(struct Sem *s);
+void	sem_post(struct Sem *s);
+
+#endif	// !JOS_INC_SYNC_H
@@ -17,6 +17,25 @@ enum {
 	SYS_yield,
 	SYS_ipc_try_send,
 	SYS_ipc_recv,
+	SYS_ipc_recv_nb,
+	SYS_env_set_pager,
+	SYS_env_set_priority,
+	SYS_env_set_tickets,
+	SYS_env_set_affinity,
+	SYS_sleep,
+	SYS_wakeup,
+	SYS_env_exit,
+	SYS_env_wait,
+	SYS_ipc_call,
+	SYS_ipc_reply_recv,
+	SYS_ipc_try_send_short,
+	SYS_ipc_call_short,
+	SYS_ipc_reply_recv_short,
+	SYS_ipc_send,
+	SYS_notify,
+	SYS_notify_wait,
+	SYS_irq_bind,
+	SYS_ipc_recv_timeout,
 	NSYSCALLS
 };
 
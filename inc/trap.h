@@ -38,6 +38,7 @@
 #define IRQ_SPURIOUS     7
 #define IRQ_IDE         14
 #define IRQ_ERROR       19
+#define IRQ_SHOOTDOWN   20	// IPI: flush the TLB (tlb_shootdown)
 
 #ifndef __ASSEMBLER__
 
@@ -248,6 +248,31 @@ read_tsc(void)
 	return tsc;
 }
 
+// Atomically add v to *addr, returning the old value.
+static inline uint32_t
+xadd(volatile uint32_t *addr, uint32_t v)
+{
+	asm volatile("lock; xaddl %0, %1"
+		     : "+r" (v), "+m" (*addr)
+		     :
+		     : "cc", "memory");
+	return v;
+}
+
+// Atomically set *addr to newval if it is old.  Returns the value
+// *addr had, which is old on success.
+static inline uint32_t
+cmpxchg(volatile uint32_t *addr, uint32_t old, uint32_t newval)
+{
+	uint32_t result;
+
+	asm volatile("lock; cmpxchgl %2, %1"
+		     : "=a" (result), "+m" (*addr)
+		     : "r" (newval), "0" (old)
+		     : "cc", "memory");
+	return result;
+}
+
 static inline uint32_t
 xchg(volatile uint32_t *addr, uint32_t newval)
 {
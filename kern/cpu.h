@@ -23,6 +23,17 @@ struct CpuInfo {
 	volatile unsigned cpu_status;   // The status of the CPU
 	struct Env *cpu_env;            // The currently-running environment.
 	struct Taskstate cpu_ts;        // Used by x86 to find stack for interrupt
+	struct Env *cpu_rq_head[ENV_NPRIO]; // Runnable environments, one
+	struct Env *cpu_rq_tail[ENV_NPRIO]; // queue per priority level
+	int cpu_rq_len;
+	unsigned cpu_ticks;             // Timer ticks, for priority boosts
+	uint64_t cpu_pass;              // Stride pass of the last env picked
+	uint64_t cpu_run_tsc;           // When curenv last went on this CPU
+	bool cpu_tickless;              // Idle, timer stopped or one-shot
+	bool cpu_unlocked;              // In a syscall without the BKL
+	struct PageInfo *cpu_wake_page; // ... whose sleepers need waking
+	volatile uint32_t cpu_in_user;  // Running user code (tlb_shootdown)
+	volatile uint32_t cpu_tlb_stale; // Page tables changed under us
 };
 
 // Initialized in mpconfig.c
@@ -42,5 +53,10 @@ void lapic_init(void);
 void lapic_startap(uint8_t apicid, uint32_t addr);
 void lapic_eoi(void);
 void lapic_ipi(int vector);
+void lapic_ipi_cpu(uint8_t apicid, int vector);
+void lapic_timer(uint32_t us, bool periodic);
+
+extern uint32_t lapic_timer_hz;     // Calibrated in lapic.c
+extern uint64_t tsc_hz;
 
 #endif
@@ -26,7 +26,18 @@ pde_t entry_pgdir[NPDENTRIES] = {
 
 	// Map VA's [KERNBASE, KERNBASE+4MB) to PA's [0, 4MB)
 	[KERNBASE>>PDXSHIFT]
-		= ((uintptr_t)entry_pgtable - KERNBASE) + PTE_P + PTE_W
+		= ((uintptr_t)entry_pgtable - KERNBASE) + PTE_P + PTE_W,
+
+	// Map VA's [KERNBASE+4MB, KERNBASE+16MB) to PA's [4MB, 16MB)
+	// with 4MB pages (entry.S and mpentry.S turn on CR4_PSE).  The
+	// user programs linked into the kernel can push its end, and so
+	// the first boot_alloc'd pages and the AP boot stacks, past 4MB.
+	[(KERNBASE>>PDXSHIFT) + 1]
+		= 0x400000 + PTE_P + PTE_W + PTE_PS,
+	[(KERNBASE>>PDXSHIFT) + 2]
+		= 0x800000 + PTE_P + PTE_W + PTE_PS,
+	[(KERNBASE>>PDXSHIFT) + 3]
+		= 0xc00000 + PTE_P + PTE_W + PTE_PS
 };
 //KERNBASE>>PDXSHIFT=960
 //
@@ -14,10 +14,14 @@
 #include <kern/sched.h>
 #include <kern/cpu.h>
 #include <kern/spinlock.h>
+#include <kern/wait.h>
+#include <kern/timer.h>
+#include <kern/syscall.h>
 
 struct Env *envs = NULL;		// All environments
 static struct Env *env_free_list;	// Free environment list
 					// (linked by Env->env_link)
+static struct spinlock env_locks[NENV];	// Page table locks, see env_lock
 
 #define ENVGENSHIFT	12		// >= LOGNENV
 
@@ -123,6 +127,8 @@ env_init(void)
     for(i=NENV-1; i>=0; i--){
         envs[i].env_id = 0;
         envs[i].env_status = ENV_FREE;
+        envs[i].env_rq_cpu = -1;
+        spin_initlock(&env_locks[i]);
         envs[i].env_link = env_free_list;
         env_free_list = &envs[i];
     }
@@ -187,7 +193,7 @@ env_setup_vm(struct Env *e)
 
 	// LAB 3: Your code here.
 	e->env_pgdir = (pde_t *)page2kva(p);
-    p->pp_ref++;
+    page_incref(p);
 
     // 低于UTOP的页目录的内容设为空
     for(i = 0; i < PDX(UTOP); i++) {
@@ -240,8 +246,15 @@ env_alloc(struct Env **newenv_store, envid_t parent_id)
 	// Set the basic status variables.
 	e->env_parent_id = parent_id;
 	e->env_type = ENV_TYPE_USER;
-	e->env_status = ENV_RUNNABLE;
 	e->env_runs = 0;
+	e->env_prio = 0;
+	e->env_prio_fixed = 0;
+	e->env_tickets = ENV_TICKETS_DEFAULT;
+	e->env_pass = 0;
+	e->env_affinity = ENV_AFFINITY_ALL;
+	e->env_migrations = 0;
+	e->env_exit_status = ENV_EXIT_KILLED;
+	env_set_status(e, ENV_RUNNABLE);
 
 	// 清空寄存器的值
 	memset(&e->env_tf, 0, sizeof(e->env_tf));
@@ -270,6 +283,19 @@ env_alloc(struct Env **newenv_store, envid_t parent_id)
 
 	// Also clear the IPC receiving flag.
 	e->env_ipc_recving = 0;
+	e->env_ipc_handoff = 0;
+	e->env_ipc_waitfor = 0;
+	e->env_ipc_blocked = 0;
+	e->env_ipc_inregs = 0;
+	e->env_ipc_qhead = e->env_ipc_qtail = NULL;
+	e->env_ipc_qlen = e->env_ipc_qmax = 0;
+	e->env_notify_pending = e->env_notify_mask = 0;
+
+	// No pager until one is set.
+	e->env_pager = 0;
+	e->env_pager_fault = 0;
+	e->env_pager_link = NULL;
+	e->env_pager_qhead = e->env_pager_qtail = NULL;
 
 	// 完成分配
 	env_free_list = e->env_link; //将这个e移出env_free_list
@@ -416,6 +442,8 @@ env_create(uint8_t *binary, enum EnvType type)
 	// LAB 5: Your code here.
 	if (type == ENV_TYPE_FS) { //如果是文件系统，为他设置IO访问权限
         e->env_tf.tf_eflags |= FL_IOPL_MASK;
+        // Everyone waits on the file server; never let it sink.
+        sched_set_priority(e, 0);
     }
 }
 
@@ -435,6 +463,14 @@ env_free(struct Env *e)
 	if (e == curenv)
 		lcr3(PADDR(kern_pgdir));
 
+	// Stop sleeping before the pages we sleep on go, drop the
+	// messages and faults nobody will receive now, and fail the calls
+	// nobody will answer.
+	wq_remove(e);
+	ipc_queue_free(e);
+	ipc_call_abort(e);
+	pager_cancel(e);
+
 	// Note the environment's demise.
 	// cprintf("[%08x] free env %08x\n", curenv ? curenv->env_id : 0, e->env_id);
 
@@ -466,12 +502,118 @@ env_free(struct Env *e)
 	e->env_pgdir = 0;
 	page_decref(pa2page(pa));
 
+	// hand the exit status to sys_env_wait
+	wq_wakeup_ret(PADDR(&e->env_exit_status), 0, e->env_exit_status);
+
 	// return the environment to the free list
-	e->env_status = ENV_FREE;
+	env_set_status(e, ENV_FREE);
 	e->env_link = env_free_list;
 	env_free_list = e;
 }
 
+//
+// Lock e's page tables.  Anything that changes e->env_pgdir once e
+// may be running must hold this: e itself can be changing its own
+// mappings on another CPU without the big kernel lock.
+//
+void
+env_lock(struct Env *e)
+{
+	spin_lock(&env_locks[e - envs]);
+}
+
+void
+env_unlock(struct Env *e)
+{
+	spin_unlock(&env_locks[e - envs]);
+}
+
+// Add the counters of every environment's lock to sum, clearing them
+// if reset is set.
+void
+env_lock_stat(struct spinlock_stat *sum, bool reset)
+{
+	int i;
+
+	for (i = 0; i < NENV; i++) {
+		spin_stat_add(sum, &env_locks[i]);
+		if (reset)
+			memset(&env_locks[i].stat, 0, sizeof(env_locks[i].stat));
+	}
+}
+
+// Lock the page tables of a and b, which may be the same environment,
+// in envs[] order so that two CPUs cannot deadlock.
+void
+env_lock2(struct Env *a, struct Env *b)
+{
+	if (a > b) {
+		struct Env *t = a;
+		a = b;
+		b = t;
+	}
+	env_lock(a);
+	if (b != a)
+		env_lock(b);
+}
+
+void
+env_unlock2(struct Env *a, struct Env *b)
+{
+	env_unlock(a);
+	if (b != a)
+		env_unlock(b);
+}
+
+//
+// Change e's status, keeping the scheduler's run queues in step:
+// an environment is on a run queue exactly when it is ENV_RUNNABLE.
+// Everything outside env_init should go through here rather than
+// writing env_status directly.
+//
+void
+env_set_status(struct Env *e, unsigned status)
+{
+	if (status != ENV_NOT_RUNNABLE) {
+		wq_remove(e);
+		timer_cancel(e);
+		pager_cancel(e);
+		e->env_notify_mask = 0;
+		e->env_ipc_blocked = 0;
+	}
+	e->env_status = status;
+	if (status == ENV_RUNNABLE)
+		sched_enqueue(e);
+	else
+		sched_dequeue(e);
+
+	// sys_env_wait sleeps on env_exit_status, which env_free wakes.
+	// These wake user code that sleeps with sys_sleep on e's words
+	// in UENVS, waiting for e to change status or to receive, so it
+	// does not sleep on forever once e is gone.
+	static_assert(offsetof(struct Env, env_ipc_recving) % 4 == 0);
+	if (status == ENV_DYING || status == ENV_FREE) {
+		wq_wakeup_kva(&e->env_status);
+		wq_wakeup_kva(&e->env_ipc_recving);
+	}
+}
+
+// Signal notification bits to e.  They stay pending until e waits for
+// them; if e is already waiting for any of them, wake it and hand them
+// over.  Never blocks, so anything can signal, the kernel included.
+void
+env_notify(struct Env *e, uint32_t bits)
+{
+	uint32_t got;
+
+	e->env_notify_pending |= bits & NOTIFY_ALL;
+	if (!(got = e->env_notify_pending & e->env_notify_mask))
+		return;
+	e->env_notify_pending &= ~got;
+	env_set_status(e, ENV_RUNNABLE);
+	e->env_tf.tf_regs.reg_eax = got;
+}
+
 //
 // Frees environment e.
 // If e was the current env, then runs a new environment (and does not return
@@ -484,7 +626,7 @@ env_destroy(struct Env *e)
 	// ENV_DYING. A zombie environment will be freed the next time
 	// it traps to the kernel.
 	if (e->env_status == ENV_RUNNING && curenv != e) {
-		e->env_status = ENV_DYING;
+		env_set_status(e, ENV_DYING);
 		return;
 	}
 
@@ -508,6 +650,7 @@ env_pop_tf(struct Trapframe *tf)
 {
 	// Record the CPU we are running on for user-space debugging
 	curenv->env_cpunum = cpunum();
+	tlb_leave_kernel();
 
 	asm volatile(
 		"\tmovl %0,%%esp\n" //把tf的内容放到esp中
@@ -544,12 +687,19 @@ env_run(struct Env *e)
 	// 在env_alloc中，设置了别的寄存器的内容。
 	
 	// LAB 3: Your code here.
+	// Start the clock sched_charge bills e by and sched_tick
+	// measures its quantum with, unless e is only returning from a
+	// trap.
+	if (e->env_status != ENV_RUNNING)
+		thiscpu->cpu_run_tsc = read_tsc();
 	if(curenv != NULL && curenv->env_status == ENV_RUNNING) {
-        curenv->env_status = ENV_RUNNABLE;
+        env_set_status(curenv, ENV_RUNNABLE);
     }
 
     curenv = e;
-    curenv->env_status = ENV_RUNNING;
+    env_set_status(curenv, ENV_RUNNING);
+    if (curenv->env_runs && curenv->env_cpunum != cpunum())
+        curenv->env_migrations++;
     curenv->env_runs++;
     lcr3(PADDR(curenv->env_pgdir));
 	unlock_kernel();//释放锁
@@ -16,6 +16,14 @@ int	env_alloc(struct Env **e, envid_t parent_id);
 void	env_free(struct Env *e);
 void	env_create(uint8_t *binary, enum EnvType type);
 void	env_destroy(struct Env *e);	// Does not return if e == curenv
+void	env_set_status(struct Env *e, unsigned status);
+void	env_notify(struct Env *e, uint32_t bits);
+void	env_lock(struct Env *e);
+void	env_unlock(struct Env *e);
+void	env_lock2(struct Env *a, struct Env *b);
+struct spinlock_stat;
+void	env_lock_stat(struct spinlock_stat *sum, bool reset);
+void	env_unlock2(struct Env *a, struct Env *b);
 
 int	envid2env(envid_t envid, struct Env **env_store, bool checkperm);
 // The following two functions do not return
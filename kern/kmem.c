@@ -0,0 +1,74 @@
+/*
+ * Kernel object allocator.
+ *
+ * Kernel objects that come and go at run time, unlike the fixed
+ * tables set up at boot, are allocated from a kmem_cache: a free list
+ * of equal-sized objects carved out of whole pages from page_alloc.
+ * Freed objects go back on the list for the next allocation; the
+ * pages themselves are kept by the cache for good, so a cache only
+ * grows to the most objects it has ever had in use at once.
+ *
+ * Caches are only used under the big kernel lock.
+ */
+
+#include <inc/assert.h>
+#include <inc/error.h>
+#include <inc/stdio.h>
+
+#include <kern/kmem.h>
+#include <kern/pmap.h>
+
+// Carve a fresh page into free objects.
+// Returns 0 on success, -E_NO_MEM if there is no page to be had.
+static int
+kmem_grow(struct kmem_cache *kc)
+{
+	struct PageInfo *pp;
+	char *obj;
+
+	if (!(pp = page_alloc(0)))
+		return -E_NO_MEM;
+	page_incref(pp);	// never freed, like the boot-time tables
+	for (obj = page2kva(pp); obj + kc->kc_size <= (char *) page2kva(pp) + PGSIZE;
+	     obj += kc->kc_size) {
+		*(void **) obj = kc->kc_free;
+		kc->kc_free = obj;
+	}
+	kc->kc_npages++;
+	return 0;
+}
+
+// Allocate an object from kc.  Its contents are undefined.
+// Returns NULL if out of memory.
+void *
+kmem_alloc(struct kmem_cache *kc)
+{
+	void *obj;
+
+	assert(kc->kc_size >= sizeof(void *) && kc->kc_size <= PGSIZE);
+	if (!kc->kc_free && kmem_grow(kc) < 0)
+		return NULL;
+	obj = kc->kc_free;
+	kc->kc_free = *(void **) obj;
+	if (++kc->kc_nalloc > kc->kc_maxalloc)
+		kc->kc_maxalloc = kc->kc_nalloc;
+	return obj;
+}
+
+// Return obj, which came from kmem_alloc(kc), to kc.
+void
+kmem_free(struct kmem_cache *kc, void *obj)
+{
+	assert(kc->kc_nalloc > 0);
+	*(void **) obj = kc->kc_free;
+	kc->kc_free = obj;
+	kc->kc_nalloc--;
+}
+
+void
+kmem_stat_print(struct kmem_cache *kc)
+{
+	cprintf("%-12s %u-byte objects: %u in use, %u at most, %u pages\n",
+		kc->kc_name, kc->kc_size, kc->kc_nalloc, kc->kc_maxalloc,
+		kc->kc_npages);
+}
@@ -0,0 +1,29 @@
+/* See COPYRIGHT for copyright information. */
+
+#ifndef JOS_KERN_KMEM_H
+#define JOS_KERN_KMEM_H
+#ifndef JOS_KERNEL
+# error "This is a JOS kernel header; user programs should not #include it"
+#endif
+
+#include <inc/types.h>
+
+// A cache of fixed-size kernel objects.
+struct kmem_cache {
+	const char *kc_name;
+	size_t kc_size;		// Object size, a multiple of 4
+	void *kc_free;		// Free objects, linked through their first word
+	uint32_t kc_npages;	// Pages taken from the page allocator
+	uint32_t kc_nalloc;	// Objects in use
+	uint32_t kc_maxalloc;	// ... at most, so far
+};
+
+// Initializer for a cache of objects of type.
+#define KMEM_CACHE(name, type) \
+	{ .kc_name = (name), .kc_size = (sizeof(type) + 3) & ~3 }
+
+void *kmem_alloc(struct kmem_cache *kc);
+void kmem_free(struct kmem_cache *kc, void *obj);
+void kmem_stat_print(struct kmem_cache *kc);
+
+#endif	// !JOS_KERN_KMEM_H
@@ -32,6 +32,7 @@
 #define ICRHI   (0x0310/4)   // Interrupt Command [63:32]
 #define TIMER   (0x0320/4)   // Local Vector Table 0 (TIMER)
 	#define X1         0x0000000B   // divide counts by 1
+	#define ONESHOT    0x00000000   // One-shot
 	#define PERIODIC   0x00020000   // Periodic
 #define PCINT   (0x0340/4)   // Performance Counter LVT
 #define LINT0   (0x0350/4)   // Local Vector Table 1 (LINT0)
@@ -42,10 +43,22 @@
 #define TCCR    (0x0390/4)   // Timer Current Count
 #define TDCR    (0x03E0/4)   // Timer Divide Configuration
 
+// 8253/8254 programmable interval timer, channel 2, used as the
+// reference clock for calibration.  Channel 2's gate and output are
+// wired to bits 0 and 5 of the keyboard controller's port B.
+#define IO_PIT_CH2	0x42
+#define IO_PIT_MODE	0x43
+#define IO_PORTB	0x61
+#define PIT_HZ		1193182
+#define CALIBRATE_MS	10
+
 physaddr_t lapicaddr;        // Initialized in mpconfig.c
 volatile uint32_t *lapic; // 应该是每个CPU都会运行lapic.c的代码
 // 所以每个CPU都会有lapic这个变量???
 
+uint32_t lapic_timer_hz;	// LAPIC timer counts per second, at X1
+uint64_t tsc_hz;		// TSC counts per second
+
 static void
 lapicw(int index, int value)
 {
@@ -53,6 +66,64 @@ lapicw(int index, int value)
 	lapic[ID];  // wait for write to finish, by reading
 }
 
+// Measure the LAPIC timer and the TSC against the PIT: run PIT
+// channel 2 down from CALIBRATE_MS worth of counts while the LAPIC
+// timer free-runs, and see how far both moved.
+static void
+lapic_calibrate(void)
+{
+	uint16_t count = PIT_HZ / (1000 / CALIBRATE_MS);
+	uint32_t lstart, lend;
+	uint64_t tstart, tend;
+
+	// Gate channel 2 on, with the speaker off.
+	outb(IO_PORTB, (inb(IO_PORTB) & ~0x02) | 0x01);
+	lapicw(TDCR, X1);
+	lapicw(TIMER, MASKED);
+	lapicw(TICR, 0xffffffff);
+
+	// Channel 2, low then high byte, mode 0 (out goes high at the
+	// end of the count).  Counting starts once the count is written.
+	outb(IO_PIT_MODE, 0xB0);
+	outb(IO_PIT_CH2, count & 0xff);
+	outb(IO_PIT_CH2, count >> 8);
+	lstart = lapic[TCCR];
+	tstart = read_tsc();
+	while (!(inb(IO_PORTB) & 0x20))
+		;
+	lend = lapic[TCCR];
+	tend = read_tsc();
+	lapicw(TICR, 0);
+
+	lapic_timer_hz = (lstart - lend) * (1000 / CALIBRATE_MS);
+	tsc_hz = (tend - tstart) * (1000 / CALIBRATE_MS);
+	cprintf("lapic: timer %u kHz, TSC %u MHz\n",
+		lapic_timer_hz / 1000, (uint32_t) (tsc_hz / 1000000));
+}
+
+// Program this CPU's timer to interrupt after us microseconds, and
+// every us microseconds after that if periodic.  us == 0 stops it.
+// Longer than the timer can count, it interrupts as late as it can.
+void
+lapic_timer(uint32_t us, bool periodic)
+{
+	uint64_t count;
+
+	if (!lapic)
+		return;
+	if (us == 0) {
+		lapicw(TICR, 0);
+		return;
+	}
+	if (lapic_timer_hz)
+		count = MIN((uint64_t) lapic_timer_hz * us / 1000000, 0xffffffff);
+	else
+		count = 10000000;	// Uncalibrated: the old guess
+	lapicw(TDCR, X1);
+	lapicw(TIMER, (periodic ? PERIODIC : ONESHOT) | (IRQ_OFFSET + IRQ_TIMER));
+	lapicw(TICR, count ? count : 1);
+}
+
 void
 lapic_init(void)
 {
@@ -66,13 +137,13 @@ lapic_init(void)
 	// Enable local APIC; set spurious interrupt vector.
 	lapicw(SVR, ENABLE | (IRQ_OFFSET + IRQ_SPURIOUS));
 
-	// The timer repeatedly counts down at bus frequency
-	// from lapic[TICR] and then issues an interrupt.  
-	// If we cared more about precise timekeeping,
-	// TICR would be calibrated using an external time source.
-	lapicw(TDCR, X1);
-	lapicw(TIMER, PERIODIC | (IRQ_OFFSET + IRQ_TIMER));
-	lapicw(TICR, 10000000); 
+	// The timer repeatedly counts down at bus frequency and then
+	// issues an interrupt, once every scheduling quantum.  The boot
+	// CPU calibrates it against the PIT first; all CPUs share a bus
+	// clock, so the others reuse its numbers.
+	if (thiscpu == bootcpu)
+		lapic_calibrate();
+	lapic_timer(QUANTUM_US, 1);
 
 	// Leave LINT0 of the BSP enabled so that it can get
 	// interrupts from the 8259A chip.
@@ -129,10 +200,13 @@ lapic_eoi(void)
 }
 
 // Spin for a given number of microseconds.
-// On real hardware would want to tune this dynamically.
 static void
 microdelay(int us)
 {
+	uint64_t end = read_tsc() + tsc_hz * us / 1000000;
+
+	while (read_tsc() < end)
+		;
 }
 
 #define IO_RTC  0x70
@@ -174,6 +248,16 @@ lapic_startap(uint8_t apicid, uint32_t addr)
 	}
 }
 
+// Send an interrupt to the CPU with local APIC ID apicid.
+void
+lapic_ipi_cpu(uint8_t apicid, int vector)
+{
+	lapicw(ICRHI, apicid << 24);
+	lapicw(ICRLO, FIXED | vector);
+	while (lapic[ICRLO] & DELIVS)
+		;
+}
+
 void
 lapic_ipi(int vector)
 {
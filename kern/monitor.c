@@ -11,6 +11,10 @@
 #include <kern/monitor.h>
 #include <kern/kdebug.h>
 #include <kern/trap.h>
+#include <kern/env.h>
+#include <kern/spinlock.h>
+#include <kern/syscall.h>
+#include <kern/kmem.h>
 
 #define CMDBUF_SIZE	80	// enough for one VGA text line
 
@@ -25,6 +29,8 @@ struct Command {
 static struct Command commands[] = {
 	{ "help", "Display this list of commands", mon_help },
 	{ "kerninfo", "Display information about the kernel", mon_kerninfo },
+	{ "lockstat", "Display spinlock contention counters; 'lockstat reset' clears them", mon_lockstat },
+	{ "ipcstat", "Display IPC message queue counters", mon_ipcstat },
 };
 
 /***** Implementations of basic kernel monitor commands *****/
@@ -55,6 +61,51 @@ mon_kerninfo(int argc, char **argv, struct Trapframe *tf)
 	return 0;
 }
 
+int
+mon_lockstat(int argc, char **argv, struct Trapframe *tf)
+{
+	static struct {
+		const char *name;
+		struct spinlock *lock;
+	} locks[] = {
+		{ "kernel_lock", &kernel_lock },
+		{ "page_lock", &page_lock },
+		{ "console_lock", &console_lock },
+	};
+	struct spinlock_stat st;
+	bool reset = (argc > 1 && strcmp(argv[1], "reset") == 0);
+	int i;
+
+	for (i = 0; i < ARRAY_SIZE(locks); i++) {
+		memset(&st, 0, sizeof(st));
+		spin_stat_add(&st, locks[i].lock);
+		spin_stat_print(locks[i].name, &st);
+		if (reset)
+			memset(&locks[i].lock->stat, 0, sizeof(st));
+	}
+	memset(&st, 0, sizeof(st));
+	env_lock_stat(&st, reset);
+	spin_stat_print("env locks", &st);
+	return 0;
+}
+
+int
+mon_ipcstat(int argc, char **argv, struct Trapframe *tf)
+{
+	struct Env *e;
+
+	cprintf("ipc: %llu sent, %llu queued, %llu refused as full\n",
+		ipcq_stat.sent, ipcq_stat.queued, ipcq_stat.full);
+	cprintf("ipc: %u messages queued, %u at most\n",
+		ipcq_stat.depth, ipcq_stat.maxdepth);
+	for (e = envs; e < envs + NENV; e++)
+		if (e->env_status != ENV_FREE && e->env_ipc_qmax)
+			cprintf("  [%08x] %u queued, %u at most\n",
+				e->env_id, e->env_ipc_qlen, e->env_ipc_qmax);
+	kmem_stat_print(&ipcmsg_cache);
+	return 0;
+}
+
 int
 mon_backtrace(int argc, char **argv, struct Trapframe *tf)
 {
@@ -84,3 +84,11 @@ irq_setmask_8259A(uint16_t mask)
 	cprintf("\n");
 }
 
+// Acknowledge interrupt irq.  The master runs in automatic EOI mode,
+// so only the slave's IRQs need this.
+void
+irq_eoi_8259A(int irq)
+{
+	if (irq >= 8)
+		outb(IO_PIC2, 0x20);	// OCW2: non-specific EOI
+}
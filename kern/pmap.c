@@ -7,9 +7,12 @@
 #include <inc/assert.h>
 
 #include <kern/pmap.h>
+#include <kern/trap.h>
 #include <kern/kclock.h>
 #include <kern/env.h>
 #include <kern/cpu.h>
+#include <kern/spinlock.h>
+#include <kern/wait.h>
 
 // These variables are set by i386_detect_memory()
 size_t npages;			// Amount of physical memory (in pages)
@@ -20,6 +23,13 @@ pde_t *kern_pgdir;		// Kernel's initial page directory 就是 页目录的位置
 struct PageInfo *pages;		// Physical page state array
 static struct PageInfo *page_free_list;	// Free list of physical pages
 
+// Protects page_free_list and every pp_ref
+struct spinlock page_lock = {
+#ifdef DEBUG_SPINLOCK
+	.name = "page_lock"
+#endif
+};
+
 
 // --------------------------------------------------------------
 // Detect machine's physical memory setup.
@@ -75,6 +85,7 @@ static void check_kern_pgdir(void);
 static physaddr_t check_va2pa(pde_t *pgdir, uintptr_t va);
 static void check_page(void);
 static void check_page_installed_pgdir(void);
+static void tlb_shootdown(pde_t *pgdir);
 
 // 只有在JOS开始设置它的虚拟内存系统时，这个简单的物理内存分配器 才被使用。
 // page_alloc()才是真正的分配器
@@ -362,12 +373,16 @@ page_alloc(int alloc_flags)
 {
 	// Fill this function in
 	struct PageInfo *result;
+
+    spin_lock(&page_lock);
     if (page_free_list == NULL){
+        spin_unlock(&page_lock);
 		return NULL;
 	}        
 
     result= page_free_list;
     page_free_list = result->pp_link; //page_free_list指向下一个空的值
+    spin_unlock(&page_lock);
     result->pp_link = NULL;
 
     if (alloc_flags & ALLOC_ZERO){
@@ -390,8 +405,10 @@ page_free(struct PageInfo *pp)
 	assert(pp->pp_ref == 0);
     assert(pp->pp_link == NULL);
 
+    spin_lock(&page_lock);
     pp->pp_link = page_free_list;
     page_free_list = pp;
+    spin_unlock(&page_lock);
 }
 
 //
@@ -400,10 +417,29 @@ page_free(struct PageInfo *pp)
 void
 page_decref(struct PageInfo* pp)
 {
-	if (--pp->pp_ref == 0)
+	uint16_t ref, sleepers;
+
+	spin_lock(&page_lock);
+	ref = --pp->pp_ref;
+	sleepers = pp->pp_sleepers;
+	spin_unlock(&page_lock);
+	if (sleepers)
+		wq_page_released(pp);
+	if (ref == 0)
 		page_free(pp);
 }
 
+//
+// 对一个物理页的引用数进行自增
+//
+void
+page_incref(struct PageInfo* pp)
+{
+	spin_lock(&page_lock);
+	pp->pp_ref++;
+	spin_unlock(&page_lock);
+}
+
 // 给定一个指向页目录的指针pgdir，函数pgdir_walk通过现行地址va返回
 // 一个指向page table entry的指针。
 // 这需要 2级页表的操作(page dir entry+page table entry)
@@ -434,7 +470,7 @@ pte_t * pgdir_walk(pde_t *pgdir, const void * va, int create)
 			if (newPageTablePage==NULL){ //分配失败
 				return NULL;
 			}else{
-				newPageTablePage->pp_ref++;
+				page_incref(newPageTablePage);
 				*pde = (page2pa(newPageTablePage) | PTE_P | PTE_W | PTE_U);
 			}
 		}else{
@@ -504,7 +540,7 @@ page_insert(pde_t *pgdir, struct PageInfo *pp, void *va, int perm)
     if(entry == NULL) 
 		return -E_NO_MEM;
 
-    pp->pp_ref++;
+    page_incref(pp);
 	//pp->pp_ref++这条语句，一定要放在page_remove之前，这是为了处理一种特殊情况：pp已经映射到va上了
 	//因为page_remove应该会--
     if((*entry) & PTE_P) //已经有一个物理页pp被映射在这个va上了
@@ -585,6 +621,60 @@ tlb_invalidate(pde_t *pgdir, void *va)
 	// Flush the entry only if we're modifying the current address space.
 	if (!curenv || curenv->env_pgdir == pgdir)
 		invlpg(va);
+	tlb_shootdown(pgdir);
+}
+
+// Make other CPUs running on pgdir drop what their TLBs hold of it.
+// A CPU in the kernel is only marked, and flushes before it returns
+// to user mode (tlb_leave_kernel); one in user mode is interrupted,
+// and we wait for it to flush, so that a page unmapped here is out of
+// every TLB before it can be freed.  The wait needs no lock the target
+// could be spinning on: the IPI is handled before trap() takes any.
+static void
+tlb_shootdown(pde_t *pgdir)
+{
+	struct CpuInfo *c;
+	struct Env *e;
+
+	for (c = cpus; c < cpus + ncpu; c++) {
+		e = c->cpu_env;
+		if (c == thiscpu || !e || e->env_pgdir != pgdir)
+			continue;
+		xchg(&c->cpu_tlb_stale, 1);
+		if (!c->cpu_in_user)
+			continue;
+		lapic_ipi_cpu(c->cpu_id, IRQ_OFFSET + IRQ_SHOOTDOWN);
+		while (c->cpu_tlb_stale && c->cpu_in_user)
+			asm volatile("pause");
+	}
+}
+
+// Flush this CPU's TLB if another CPU changed the page tables it uses.
+static void
+tlb_catch_up(void)
+{
+	if (thiscpu->cpu_tlb_stale) {
+		lcr3(rcr3());
+		thiscpu->cpu_tlb_stale = 0;
+	}
+}
+
+// Called on every entry to the kernel from a trap.
+void
+tlb_enter_kernel(void)
+{
+	thiscpu->cpu_in_user = 0;
+	tlb_catch_up();
+}
+
+// Called just before returning to user mode.  The xchg orders our
+// cpu_in_user against tlb_shootdown's cpu_tlb_stale: either it sees
+// us in user mode and waits, or we see its mark here.
+void
+tlb_leave_kernel(void)
+{
+	xchg(&thiscpu->cpu_in_user, 1);
+	tlb_catch_up();
 }
 
 // 
@@ -652,9 +742,16 @@ user_mem_check(struct Env *env, const void *va, size_t len, int perm)
     end = ROUNDUP((char *)(va + len), PGSIZE);//对齐一下
     pte_t *cur = NULL;
 
+    // A user access needs a present, user-accessible page, whatever
+    // else the caller asks for.
+    perm |= PTE_U | PTE_P;
+    if ((uintptr_t) va + len < (uintptr_t) va) {
+        user_mem_check_addr = (uintptr_t) va;
+        return -E_FAULT;
+    }
     for(; start < end; start += PGSIZE) {
         cur = pgdir_walk(env->env_pgdir, (void *)start, 0);
-        if((int)start > ULIM || cur == NULL || ((uint32_t)(*cur) & perm) != perm) {
+        if((uintptr_t)start >= ULIM || cur == NULL || ((uint32_t)(*cur) & perm) != perm) {
               if(start == ROUNDDOWN((char *)va, PGSIZE)) {
                     user_mem_check_addr = (uintptr_t)va;
               }
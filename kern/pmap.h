@@ -62,8 +62,11 @@ int	page_insert(pde_t *pgdir, struct PageInfo *pp, void *va, int perm);
 void	page_remove(pde_t *pgdir, void *va);
 struct PageInfo *page_lookup(pde_t *pgdir, void *va, pte_t **pte_store);
 void	page_decref(struct PageInfo *pp);
+void	page_incref(struct PageInfo *pp);
 
 void	tlb_invalidate(pde_t *pgdir, void *va);
+void	tlb_enter_kernel(void);
+void	tlb_leave_kernel(void);
 
 void *	mmio_map_region(physaddr_t pa, size_t size);
 
@@ -4,6 +4,14 @@
 #include <inc/types.h>
 #include <inc/stdio.h>
 #include <inc/stdarg.h>
+#include <kern/spinlock.h>
+
+// Keeps messages from different CPUs from interleaving
+struct spinlock console_lock = {
+#ifdef DEBUG_SPINLOCK
+	.name = "console_lock"
+#endif
+};
 
 
 static void
@@ -16,9 +24,17 @@ putch(int ch, int *cnt) //就是输出一个字符串而已
 int
 vcprintf(const char *fmt, va_list ap)
 {
+	extern char *panicstr;
 	int cnt = 0;
+	bool locked;
 
+	// A panic must get its message out even if it struck while this
+	// CPU, or one now stopped, held the lock.
+	if ((locked = !panicstr))
+		spin_lock(&console_lock);
 	vprintfmt((void*)putch, &cnt, fmt, ap);
+	if (locked)
+		spin_unlock(&console_lock);
 	return cnt;
 }
 
@@ -4,42 +4,468 @@
 #include <kern/env.h>
 #include <kern/pmap.h>
 #include <kern/monitor.h>
+#include <kern/sched.h>
+#include <kern/timer.h>
 
 void sched_halt(void);
 
+// Per-CPU run queues.
+//
+// Every ENV_RUNNABLE environment is on exactly one CPU's run queue;
+// env_set_status() keeps the queues in step with env_status, so
+// picking the next environment never has to look at envs[].  A CPU
+// only looks at other CPUs' queues when its own is empty, then steals
+// from the one with the most waiting.  All of this runs under the big
+// kernel lock.
+//
+// Placement tries to keep an environment's cache and TLB state warm:
+// it goes back to the CPU it last ran on, and a new one starts on the
+// CPU that created it and is left for idle CPUs to steal.  Its
+// affinity mask (sys_env_set_affinity) limits both where it is queued
+// and who may steal it.
+//
+// How each CPU orders its queue depends on the policy the kernel was
+// built with (make SCHED=mlfq or SCHED=stride).
+
+#define CPU_ALLOWED(e, c)	((e)->env_affinity & (1 << ((c) - cpus)))
+
+// The CPU whose queue e should join.
+static struct CpuInfo *
+sched_home(struct Env *e)
+{
+	struct CpuInfo *c, *best = NULL;
+
+	c = e->env_runs ? &cpus[e->env_cpunum] : thiscpu;
+	if (CPU_ALLOWED(e, c))
+		return c;
+	for (c = cpus; c < cpus + ncpu; c++)
+		if (CPU_ALLOWED(e, c)
+		    && (!best || c->cpu_rq_len < best->cpu_rq_len))
+			best = c;
+	return best ? best : thiscpu;
+}
+
+static struct Env *sched_steal_from(struct CpuInfo *victim);
+
+// Idle CPUs stop their timers (see sched_halt), so when e is queued
+// on c, make sure some CPU will get to it: wake c if it is idle, or
+// else an idle CPU that may steal e.  The current environment being
+// requeued as it yields needs nobody else if it is all we have.
+static void
+sched_kick(struct CpuInfo *c, struct Env *e)
+{
+	struct CpuInfo *h;
+
+	if (e == curenv && c->cpu_rq_len <= 1)
+		return;
+	if (c != thiscpu && c->cpu_status == CPU_HALTED) {
+		lapic_ipi_cpu(c->cpu_id, IRQ_OFFSET + IRQ_TIMER);
+		return;
+	}
+	for (h = cpus; h < cpus + ncpu; h++)
+		if (h != thiscpu && h->cpu_status == CPU_HALTED
+		    && CPU_ALLOWED(e, h)) {
+			lapic_ipi_cpu(h->cpu_id, IRQ_OFFSET + IRQ_TIMER);
+			return;
+		}
+}
+
+// Find something this CPU can take from another CPU's queue: an
+// environment that may run here, from the longest queue that has one.
+static struct Env *
+sched_steal(void)
+{
+	struct CpuInfo *c, *victim = NULL;
+	struct Env *e, *best = NULL;
+
+	for (c = cpus; c < cpus + ncpu; c++)
+		if (c != thiscpu && c->cpu_rq_len > 0
+		    && (!victim || c->cpu_rq_len > victim->cpu_rq_len)
+		    && (e = sched_steal_from(c))) {
+			victim = c;
+			best = e;
+		}
+	return best;
+}
+
+// Restrict e to the CPUs in mask, moving it if it is queued on a CPU
+// it may no longer use.  A running environment moves when it next
+// yields.
+void
+sched_set_affinity(struct Env *e, uint32_t mask)
+{
+	e->env_affinity = mask;
+	if (e->env_rq_cpu >= 0 && !CPU_ALLOWED(e, &cpus[e->env_rq_cpu])) {
+		sched_dequeue(e);
+		sched_enqueue(e);
+	}
+}
+
+#ifdef SCHED_STRIDE
+
+// Stride scheduling.
+//
+// An environment's share of the CPU is proportional to its tickets.
+// Its pass advances by STRIDE1 / tickets each time it is descheduled,
+// and each CPU runs the runnable environment with the lowest pass,
+// found at the root of a per-CPU binary min-heap (env_rq_pos is an
+// environment's index in it).  An environment that was blocked rejoins
+// at the CPU's current pass rather than its old one, so it cannot bank
+// CPU time while asleep.  Priorities are recorded but have no effect.
+
+#define STRIDE1		(1 << 20)
+
+static struct Env *rq_heap[NCPU][NENV];
+
+static void
+heap_set(struct Env **h, int i, struct Env *e)
+{
+	h[i] = e;
+	e->env_rq_pos = i;
+}
+
+static void
+heap_up(struct Env **h, int i)
+{
+	struct Env *e = h[i];
+
+	while (i > 0 && e->env_pass < h[(i - 1) / 2]->env_pass) {
+		heap_set(h, i, h[(i - 1) / 2]);
+		i = (i - 1) / 2;
+	}
+	heap_set(h, i, e);
+}
+
+static void
+heap_down(struct Env **h, int n, int i)
+{
+	struct Env *e = h[i];
+	int c;
+
+	while ((c = 2 * i + 1) < n) {
+		if (c + 1 < n && h[c + 1]->env_pass < h[c]->env_pass)
+			c++;
+		if (e->env_pass <= h[c]->env_pass)
+			break;
+		heap_set(h, i, h[c]);
+		i = c;
+	}
+	heap_set(h, i, e);
+}
+
+// Add e to a run queue, if it is not on one already.
+void
+sched_enqueue(struct Env *e)
+{
+	struct CpuInfo *c;
+	struct Env **h;
+
+	if (e->env_rq_cpu >= 0)
+		return;
+	c = sched_home(e);
+	if (e->env_pass < c->cpu_pass)
+		e->env_pass = c->cpu_pass;
+	e->env_rq_cpu = c - cpus;
+	h = rq_heap[e->env_rq_cpu];
+	heap_set(h, c->cpu_rq_len, e);
+	heap_up(h, c->cpu_rq_len++);
+	sched_kick(c, e);
+}
+
+// Take e off its run queue, if it is on one.
+void
+sched_dequeue(struct Env *e)
+{
+	struct CpuInfo *c;
+	struct Env **h, *last;
+
+	if (e->env_rq_cpu < 0)
+		return;
+	c = &cpus[e->env_rq_cpu];
+	h = rq_heap[e->env_rq_cpu];
+	last = h[--c->cpu_rq_len];
+	if (last != e) {
+		heap_set(h, e->env_rq_pos, last);
+		heap_up(h, last->env_rq_pos);
+		heap_down(h, c->cpu_rq_len, last->env_rq_pos);
+	}
+	e->env_rq_cpu = -1;
+}
+
+void
+sched_set_priority(struct Env *e, int prio)
+{
+	e->env_prio_fixed = (prio != ENV_PRIO_AUTO);
+	e->env_prio = (prio == ENV_PRIO_AUTO ? 0 : prio);
+}
+
+void
+sched_block(struct Env *e)
+{
+}
+
+void
+sched_tick(void)
+{
+}
+
+// e is coming off the CPU: charge it for the time it had, a full
+// stride per quantum, so one that blocks or yields early pays only for
+// what it used.
+static void
+sched_charge(struct Env *e)
+{
+	uint64_t now = read_tsc();
+	uint64_t quantum = tsc_hz * QUANTUM_US / 1000000;
+	uint64_t stride = STRIDE1 / e->env_tickets;
+
+	if (quantum == 0)
+		quantum = 1;
+	e->env_pass += MAX(stride * (now - thiscpu->cpu_run_tsc) / quantum, 1);
+	thiscpu->cpu_run_tsc = now;
+}
+
+// An environment on victim's heap that may run here.  Leaves first:
+// any will do, and a leaf is far from the front.
+static struct Env *
+sched_steal_from(struct CpuInfo *victim)
+{
+	struct Env **h = rq_heap[victim - cpus];
+	int i;
+
+	for (i = victim->cpu_rq_len - 1; i >= 0; i--)
+		if (CPU_ALLOWED(h[i], thiscpu))
+			return h[i];
+	return NULL;
+}
+
+// The next environment this CPU should run, or NULL if there is
+// nothing runnable anywhere.  A yielding environment (skip) competes
+// on its pass like everyone else.
+static struct Env *
+sched_pick(struct Env *skip)
+{
+	struct Env *e;
+
+	if (thiscpu->cpu_rq_len > 0)
+		e = rq_heap[cpunum()][0];
+	else
+		e = sched_steal();
+	if (e && e->env_pass > thiscpu->cpu_pass)
+		thiscpu->cpu_pass = e->env_pass;
+	return e;
+}
+
+#else	// !SCHED_STRIDE
+
+// Multilevel feedback queues.
+//
+// Each CPU has one queue per priority level, linked through
+// env_rq_next/env_rq_prev, and runs the head of its highest non-empty
+// level.  Priorities follow the usual feedback rules:
+//  - new environments start at the top level;
+//  - an environment still running when the timer fires used its whole
+//    quantum and drops a level (sched_tick);
+//  - one that blocks before then moves up a level (sched_block);
+//  - every SCHED_BOOST_TICKS ticks a CPU moves everything it owns back
+//    to the top, so CPU-bound environments are not starved for good.
+// sys_env_set_priority pins an environment to a level instead; the
+// file server is pinned to the top.
+
+#define SCHED_BOOST_TICKS	100
+
+// Put e at the tail of its level's queue, if it is not queued already.
+void
+sched_enqueue(struct Env *e)
+{
+	struct CpuInfo *c;
+	int p = e->env_prio;
+
+	if (e->env_rq_cpu >= 0)
+		return;
+	c = sched_home(e);
+	e->env_rq_next = NULL;
+	e->env_rq_prev = c->cpu_rq_tail[p];
+	if (c->cpu_rq_tail[p])
+		c->cpu_rq_tail[p]->env_rq_next = e;
+	else
+		c->cpu_rq_head[p] = e;
+	c->cpu_rq_tail[p] = e;
+	c->cpu_rq_len++;
+	e->env_rq_cpu = c - cpus;
+	sched_kick(c, e);
+}
+
+// Take e off its run queue, if it is on one.
+void
+sched_dequeue(struct Env *e)
+{
+	struct CpuInfo *c;
+	int p = e->env_prio;
+
+	if (e->env_rq_cpu < 0)
+		return;
+	c = &cpus[e->env_rq_cpu];
+	if (e->env_rq_prev)
+		e->env_rq_prev->env_rq_next = e->env_rq_next;
+	else
+		c->cpu_rq_head[p] = e->env_rq_next;
+	if (e->env_rq_next)
+		e->env_rq_next->env_rq_prev = e->env_rq_prev;
+	else
+		c->cpu_rq_tail[p] = e->env_rq_prev;
+	c->cpu_rq_len--;
+	e->env_rq_cpu = -1;
+}
+
+// Move e to priority level prio, requeueing it if it is runnable.
+static void
+sched_move(struct Env *e, int prio)
+{
+	if (e->env_prio == prio)
+		return;
+	if (e->env_rq_cpu >= 0) {
+		sched_dequeue(e);
+		e->env_prio = prio;
+		sched_enqueue(e);
+	} else
+		e->env_prio = prio;
+}
+
+// Pin e at level prio, or hand it back to the feedback rules if prio
+// is ENV_PRIO_AUTO.
+void
+sched_set_priority(struct Env *e, int prio)
+{
+	e->env_prio_fixed = (prio != ENV_PRIO_AUTO);
+	sched_move(e, prio == ENV_PRIO_AUTO ? 0 : prio);
+}
+
+// e is about to block waiting for another environment or a device:
+// it gave up the CPU early, so raise it a level.
+void
+sched_block(struct Env *e)
+{
+	if (!e->env_prio_fixed && e->env_prio > 0)
+		sched_move(e, e->env_prio - 1);
+}
+
+// Called on every timer interrupt, before sched_yield.
+void
+sched_tick(void)
+{
+	struct CpuInfo *c = thiscpu;
+	uint64_t quantum = tsc_hz * QUANTUM_US / 1000000;
+	struct Env *e, *next;
+	int p;
+
+	// The current environment has used a whole quantum without
+	// giving up the CPU.  One that only just got the CPU, say with
+	// what was left of a sender's slice, keeps its level.
+	if (curenv && curenv->env_status == ENV_RUNNING
+	    && !curenv->env_prio_fixed && curenv->env_prio < ENV_NPRIO - 1
+	    && read_tsc() - c->cpu_run_tsc >= quantum)
+		curenv->env_prio++;
+
+	if (++c->cpu_ticks % SCHED_BOOST_TICKS)
+		return;
+	if (curenv && !curenv->env_prio_fixed)
+		curenv->env_prio = 0;
+	for (p = 1; p < ENV_NPRIO; p++)
+		for (e = c->cpu_rq_head[p]; e; e = next) {
+			next = e->env_rq_next;
+			if (!e->env_prio_fixed)
+				sched_move(e, 0);
+		}
+}
+
+// The next environment this CPU should run, or NULL if there is
+// nothing runnable anywhere.  Prefers anything other than skip, which
+// only comes back if it is the one runnable environment.
+static struct Env *
+sched_pick(struct Env *skip)
+{
+	struct Env *e;
+	int p;
+
+	for (p = 0; p < ENV_NPRIO; p++)
+		for (e = thiscpu->cpu_rq_head[p]; e; e = e->env_rq_next)
+			if (e != skip)
+				return e;
+	if ((e = sched_steal()))
+		return e;
+	// skip may only come back if it is queued here and may run here.
+	if (skip && skip->env_rq_cpu == thiscpu - cpus
+	    && CPU_ALLOWED(skip, thiscpu))
+		return skip;
+	return NULL;
+}
+
+// An environment on victim's queues that may run here: the highest
+// level first, and the back of each level, which would wait longest.
+static struct Env *
+sched_steal_from(struct CpuInfo *victim)
+{
+	struct Env *e;
+	int p;
+
+	for (p = 0; p < ENV_NPRIO; p++)
+		for (e = victim->cpu_rq_tail[p]; e; e = e->env_rq_prev)
+			if (CPU_ALLOWED(e, thiscpu))
+				return e;
+	return NULL;
+}
+
+static void
+sched_charge(struct Env *e)
+{
+}
+
+#endif	// !SCHED_STRIDE
+
 // 选择一个用户进程，并运行它
 void
 sched_yield(void)
 {
-	struct Env *idle;
-
-	// 实现简单的 round-robin scheduling
-	// 
-	// 在envs中找到一个ENV_RUNNABLE的进程，然后 从上次CPU结束运行的地方开始运行。
-	// 
-	// 如果 没有可用的进程，那么直接 运行原来的进程，不用 切换进程了。
-	// 
-	// 千万不能选择一个ENV_RUNNING的集成。
-	// 如果真的没有可运行的进程了，CPU直接暂停sched_halt()即可。
-	// 
-	// LAB 4: Your code here.
+	struct Env *idle, *e;
+	envid_t to;
+
+	// The current environment goes back on this CPU's queue.  Under
+	// MLFQ anything else runnable goes first, even at a lower level:
+	// a yield means "let someone else run", and environments that
+	// poll with sys_yield would otherwise starve whoever they are
+	// waiting for.
 	idle = curenv;
-	int start_envid = idle ? ENVX(idle->env_id)+1 : 0; 
-	//检查curenv是否为NULL(还没运行过用户进程之前，会是NULL)
+	if (idle)
+		sched_charge(idle);
 
-	for (int i = 0; i < NENV; i++) {
-		int j = (start_envid + i) % NENV;//拿到下一个进程的index值
-		if (envs[j].env_status == ENV_RUNNABLE) {
-			env_run(&envs[j]);
-		}
+	// A sender that blocks right after waking up its receiver, the
+	// way a client goes on to wait for the reply, hands this CPU and
+	// what is left of the quantum straight to the receiver.  The hint
+	// only lasts until the sender's next trip through here.
+	if (idle && (to = idle->env_ipc_handoff)) {
+		idle->env_ipc_handoff = 0;
+		if (idle->env_status == ENV_NOT_RUNNABLE
+		    && envid2env(to, &e, 0) == 0
+		    && e->env_status == ENV_RUNNABLE
+		    && CPU_ALLOWED(e, thiscpu))
+			env_run(e);
 	}
 
-	if (idle && idle->env_status == ENV_RUNNING) {
-		env_run(idle); //没找到一个可运行的进程，那么直接 运行之前那个进程
+	if (idle && idle->env_status == ENV_RUNNING)
+		env_set_status(idle, ENV_RUNNABLE);
+
+	if ((e = sched_pick(idle))) {
+		if (thiscpu->cpu_tickless) {
+			lapic_timer(QUANTUM_US, 1);
+			thiscpu->cpu_tickless = 0;
+		}
+		env_run(e);
 	}
 
 	// sched_halt never returns 如果真的没有可运行的进程了，CPU直接暂停sched_halt()即可。
 	sched_halt();
+	panic("sched_halt returned");
 }
 
 // Halt this CPU when there is nothing to do. Wait until the
@@ -58,7 +484,7 @@ sched_halt(void)
 		     envs[i].env_status == ENV_DYING))
 			break;
 	}
-	if (i == NENV) {
+	if (i == NENV && !timer_pending()) {
 		cprintf("No runnable environments in the system!\n");
 		while (1)
 			monitor(NULL);
@@ -68,6 +494,14 @@ sched_halt(void)
 	curenv = NULL;
 	lcr3(PADDR(kern_pgdir));
 
+	// Nothing here needs the periodic tick: sched_kick sends an IPI
+	// when there is work for us, and device interrupts wake us as
+	// usual.  The boot CPU, which turns the timer wheel, only wakes
+	// for the next timer that is due, and timer_set wakes it early
+	// for one due sooner.
+	lapic_timer(thiscpu == bootcpu ? timer_next() : 0, 0);
+	thiscpu->cpu_tickless = 1;
+
 	// Mark that this CPU is in the HALT state, so that when
 	// timer interupts come in, we know we should re-acquire the
 	// big kernel lock
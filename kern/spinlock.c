@@ -39,17 +39,18 @@ get_caller_pcs(uint32_t pcs[])
 static int
 holding(struct spinlock *lock)
 {
-	return lock->locked && lock->cpu == thiscpu;
+	return lock->cpu == thiscpu;
 }
 #endif
 
 void
 __spin_initlock(struct spinlock *lk, char *name)
 {
-	lk->locked = 0;
+	static_assert(SPINLOCK_NCPU == NCPU);
+
+	memset(lk, 0, sizeof(*lk));
 #ifdef DEBUG_SPINLOCK
 	lk->name = name;
-	lk->cpu = 0;
 #endif
 }
 
@@ -60,16 +61,59 @@ __spin_initlock(struct spinlock *lk, char *name)
 void
 spin_lock(struct spinlock *lk)
 {
+	uint64_t start, wait;
+	uint32_t spins = 0;
+
 #ifdef DEBUG_SPINLOCK
 	if (holding(lk))
 		panic("CPU %d cannot acquire %s: already holding", cpunum(), lk->name);
 #endif
 
+	start = read_tsc();
+#if defined(SPINLOCK_TAS)
 	// The xchg is atomic.
 	// It also serializes, so that reads after acquire are not
 	// reordered before it. 
-	while (xchg(&lk->locked, 1) != 0)
+	while (xchg(&lk->locked, 1) != 0) {
+		spins++;
+		asm volatile ("pause");
+	}
+#elif defined(SPINLOCK_TICKET)
+	// Take a ticket and wait for it to come up.  xadd serializes
+	// like xchg; the loads of owner are ordered by x86 anyway.
+	uint32_t ticket = xadd(&lk->next, 1);
+
+	while (lk->owner != ticket) {
+		spins++;
 		asm volatile ("pause");
+	}
+#else
+	// Join the queue, then spin on our own node until the CPU ahead
+	// of us hands the lock over.
+	struct mcs_node *me = &lk->mcs[cpunum()], *prev;
+
+	me->next = NULL;
+	me->wait = 1;
+	prev = (struct mcs_node *) xchg((volatile uint32_t *) &lk->tail,
+					(uint32_t) me);
+	if (prev) {
+		prev->next = me;
+		while (me->wait) {
+			spins++;
+			asm volatile ("pause");
+		}
+	}
+#endif
+
+	// We hold the lock now, so the counters are ours to update.
+	wait = read_tsc() - start;
+	lk->stat.acquires++;
+	if (spins) {
+		lk->stat.contended++;
+		lk->stat.spins += spins;
+	}
+	if (wait > lk->stat.maxwait)
+		lk->stat.maxwait = wait;
 
 	// Record info about lock acquisition for debugging.
 #ifdef DEBUG_SPINLOCK
@@ -107,10 +151,51 @@ spin_unlock(struct spinlock *lk)
 	lk->cpu = 0;
 #endif
 
+#if defined(SPINLOCK_TAS)
 	// The xchg instruction is atomic (i.e. uses the "lock" prefix) with
 	// respect to any other instruction which references the same memory.
 	// x86 CPUs will not reorder loads/stores across locked instructions
 	// (vol 3, 8.2.2). Because xchg() is implemented using asm volatile,
 	// gcc will not reorder C statements across the xchg.
 	xchg(&lk->locked, 0);
+#elif defined(SPINLOCK_TICKET)
+	// Only the holder writes owner, and x86 does not reorder stores,
+	// so a plain increment after a compiler barrier releases the lock.
+	asm volatile("" ::: "memory");
+	lk->owner++;
+#else
+	struct mcs_node *me = &lk->mcs[cpunum()];
+
+	asm volatile("" ::: "memory");
+	if (!me->next) {
+		// Nobody queued behind us: empty the queue, unless someone
+		// is joining right now, in which case wait for them to link
+		// themselves in.
+		if (cmpxchg((volatile uint32_t *) &lk->tail, (uint32_t) me, 0)
+		    == (uint32_t) me)
+			return;
+		while (!me->next)
+			asm volatile ("pause");
+	}
+	me->next->wait = 0;
+#endif
+}
+
+// Add lk's counters to sum.
+void
+spin_stat_add(struct spinlock_stat *sum, struct spinlock *lk)
+{
+	sum->acquires += lk->stat.acquires;
+	sum->contended += lk->stat.contended;
+	sum->spins += lk->stat.spins;
+	if (lk->stat.maxwait > sum->maxwait)
+		sum->maxwait = lk->stat.maxwait;
+}
+
+void
+spin_stat_print(const char *name, struct spinlock_stat *st)
+{
+	cprintf("%-14s %10llu acquires %10llu contended %12llu spins "
+		"%10llu max wait\n", name, st->acquires, st->contended,
+		st->spins, st->maxwait);
 }
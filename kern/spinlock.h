@@ -6,9 +6,44 @@
 // Comment this to disable spinlock debugging
 #define DEBUG_SPINLOCK
 
+// How locks are taken is chosen at build time (make SPINLOCK=...):
+//	tas	test-and-set on one word; unfair, and every waiter
+//		hammers the same cache line
+//	ticket	FIFO ticket lock (the default)
+//	mcs	MCS queue lock: FIFO, and each waiter spins on its own
+//		queue node
+#if !defined(SPINLOCK_TAS) && !defined(SPINLOCK_MCS)
+# define SPINLOCK_TICKET
+#endif
+
+#define SPINLOCK_NCPU	8	// == NCPU, which needs kern/cpu.h
+
+// An MCS queue node; each CPU has its own in every lock.
+struct mcs_node {
+	struct mcs_node *volatile next;
+	volatile uint32_t wait;
+};
+
+// Contention counters, updated by the holder.
+struct spinlock_stat {
+	uint64_t acquires;	// Times taken
+	uint64_t contended;	// ... of which had to wait
+	uint64_t spins;		// Wait loop iterations
+	uint64_t maxwait;	// Longest wait, in TSC cycles
+};
+
 // Mutual exclusion lock.
 struct spinlock {
-	unsigned locked;       // Is the lock held?
+#if defined(SPINLOCK_TAS)
+	volatile uint32_t locked;	// Is the lock held?
+#elif defined(SPINLOCK_TICKET)
+	volatile uint32_t next;		// Next ticket to hand out
+	volatile uint32_t owner;	// Ticket now being served
+#else
+	struct mcs_node *volatile tail;	// Last waiter, or the holder
+	struct mcs_node mcs[SPINLOCK_NCPU];
+#endif
+	struct spinlock_stat stat;
 
 #ifdef DEBUG_SPINLOCK
 	// For debugging:
@@ -22,10 +57,35 @@ struct spinlock {
 void __spin_initlock(struct spinlock *lk, char *name);
 void spin_lock(struct spinlock *lk);
 void spin_unlock(struct spinlock *lk);
+void spin_stat_add(struct spinlock_stat *sum, struct spinlock *lk);
+void spin_stat_print(const char *name, struct spinlock_stat *st);
 
 #define spin_initlock(lock)   __spin_initlock(lock, #lock)
 
+// Kernel locks, in the order they must be taken:
+//
+//	kernel_lock	The big kernel lock.  There is no scheduler lock
+//			of its own: kernel_lock still serializes all
+//			kernel work but the paths below, including
+//			env_status and the run queues, IPC, the wait
+//			queues, timers, the pager and environment
+//			creation and destruction.
+//	env_lock(e)	Environment e's page tables.  Taken around every
+//			change to e->env_pgdir made after e first runs;
+//			with two, the lower envs[] index first
+//			(env_lock2).
+//	page_lock	The physical page free list and the pp_ref and
+//			pp_sleepers counts.
+//	console_lock	Console output, one cprintf at a time.
+//
+// Only these run with just the locks below kernel_lock:
+// sys_getenvid, sys_cputs, and sys_page_alloc, sys_page_map and
+// sys_page_unmap on the caller itself (see syscall_unlocked() in
+// kern/syscall.c), and page faults reflected to the caller's upcall
+// (see page_fault_unlocked() in kern/trap.c).
 extern struct spinlock kernel_lock;
+extern struct spinlock page_lock;
+extern struct spinlock console_lock;
 
 static inline void
 lock_kernel(void)
@@ -11,6 +11,73 @@
 #include <kern/syscall.h>
 #include <kern/console.h>
 #include <kern/sched.h>
+#include <kern/wait.h>
+#include <kern/kmem.h>
+#include <kern/timer.h>
+
+// Before a system call touches curenv's memory in [va, va + len), have
+// its pager bring in any page there that it has not paged in yet, as a
+// user access would fault it in.  Nothing else is checked here.  If a
+// page is missing, the fault goes to the pager and the system call is
+// restarted once the page is in: the trap frame is rewound to the
+// int $T_SYSCALL, whose arguments are still in the saved registers.
+// Does not return in that case, so call it before any side effects.
+static void
+user_page_in(const void *va, size_t len)
+{
+	uintptr_t a, end;
+	pte_t *pte;
+
+	if (!curenv->env_pager || len == 0)
+		return;
+	end = MIN((uintptr_t) va + len, curenv->env_pager_hi);
+	a = MAX(ROUNDDOWN((uintptr_t) va, PGSIZE), curenv->env_pager_lo);
+	for (; a < end; a += PGSIZE) {
+		pte = pgdir_walk(curenv->env_pgdir, (void *) a, 0);
+		if (pte && (*pte & PTE_P))
+			continue;
+		curenv->env_tf.tf_eip -= 2;	// sizeof "int $T_SYSCALL"
+		pager_fault(curenv, a);
+		sched_yield();
+	}
+}
+
+// Look up envid as envid2env(envid, env_store, 1) does for a system
+// call that changes the mapping at va, also letting the caller name an
+// environment that it is the pager for if va is in its paged range.
+// That is all a pager needs to page memory in.
+static int
+envid2env_pager(envid_t envid, struct Env **env_store, void *va)
+{
+	struct Env *e;
+	int r;
+
+	if ((r = envid2env(envid, env_store, 1)) == 0)
+		return 0;
+	if (envid2env(envid, &e, 0) < 0 || e->env_pager != curenv->env_id
+	    || (uintptr_t) va < e->env_pager_lo
+	    || (uintptr_t) va >= e->env_pager_hi)
+		return r;
+	*env_store = e;
+	return 0;
+}
+
+// e's pager is done with its fault and sets it runnable.  Let e retry
+// the access, or destroy it if the page is still not there.
+static int
+pager_resume(struct Env *e)
+{
+	pte_t *pte = pgdir_walk(e->env_pgdir, (void *) e->env_pager_fault, 0);
+
+	if (!pte || !(*pte & PTE_P)) {
+		cprintf("[%08x] pager did not page in %08x\n",
+			e->env_id, e->env_pager_fault);
+		env_destroy(e);
+		return 0;
+	}
+	env_set_status(e, ENV_RUNNABLE);
+	return 0;
+}
 
 // Print a string to the system console.
 // The string is exactly 'len' characters long.
@@ -22,6 +89,7 @@ sys_cputs(const char *s, size_t len)
 	// Destroy the environment if not.
 
 	// LAB 3: Your code here.
+	user_page_in(s, len);
 	user_mem_assert(curenv, s, len, 0);
 	//检查用户程序 是否有 对虚拟地址空间[s, s+len]的访问权限
 
@@ -61,6 +129,101 @@ sys_env_destroy(envid_t envid)
 	return 0;
 }
 
+// Destroy the current environment, leaving status & 0xff as the exit
+// status for sys_env_wait.  Does not return.
+static void
+sys_env_exit(int status)
+{
+	curenv->env_exit_status = status & 0xff;
+	env_destroy(curenv);
+	panic("sys_env_exit: env_destroy returned");
+}
+
+// Wait for environment envid to exit.  Returns at once if it already
+// has, as long as its slot has not been reused since.
+//
+// Returns envid's exit status, the one it gave sys_env_exit or
+// ENV_EXIT_KILLED if it was destroyed instead; < 0 on error.
+// Errors are:
+//	-E_BAD_ENV if there is no environment envid, or no trace of it.
+//	-E_INVAL if envid is the caller.
+static int
+sys_env_wait(envid_t envid)
+{
+	struct Env *e = &envs[ENVX(envid)];
+
+	if (envid == 0 || envid == curenv->env_id)
+		return -E_INVAL;
+	if (e->env_id != envid)
+		return -E_BAD_ENV;
+	if (e->env_status == ENV_FREE)
+		return e->env_exit_status;
+	wq_sleep_kva(curenv, &e->env_exit_status);
+	sched_yield();
+}
+
+// Set envid's scheduling priority: pin it at prio (0 is the highest,
+// ENV_NPRIO - 1 the lowest), or let the scheduler adjust it from how
+// the environment behaves if prio is ENV_PRIO_AUTO.
+//
+// Returns 0 on success, < 0 on error.  Errors are:
+//	-E_BAD_ENV if environment envid doesn't currently exist,
+//		or the caller doesn't have permission to change envid.
+//	-E_INVAL if prio is not a valid priority.
+static int
+sys_env_set_priority(envid_t envid, int prio)
+{
+	struct Env *e;
+
+	if (envid2env(envid, &e, 1) < 0)
+		return -E_BAD_ENV;
+	if (prio != ENV_PRIO_AUTO && (prio < 0 || prio >= ENV_NPRIO))
+		return -E_INVAL;
+	sched_set_priority(e, prio);
+	return 0;
+}
+
+// Set envid's share of the CPU under stride scheduling: environments
+// get CPU time in proportion to their tickets.  Has no effect when the
+// kernel is built with another scheduling policy.
+//
+// Returns 0 on success, < 0 on error.  Errors are:
+//	-E_BAD_ENV if environment envid doesn't currently exist,
+//		or the caller doesn't have permission to change envid.
+//	-E_INVAL if tickets is not in [1, ENV_TICKETS_MAX].
+static int
+sys_env_set_tickets(envid_t envid, uint32_t tickets)
+{
+	struct Env *e;
+
+	if (envid2env(envid, &e, 1) < 0)
+		return -E_BAD_ENV;
+	if (tickets < 1 || tickets > ENV_TICKETS_MAX)
+		return -E_INVAL;
+	e->env_tickets = tickets;
+	return 0;
+}
+
+// Restrict envid to the CPUs whose bits are set in mask.
+// ENV_AFFINITY_ALL lets it run anywhere again.
+//
+// Returns 0 on success, < 0 on error.  Errors are:
+//	-E_BAD_ENV if environment envid doesn't currently exist,
+//		or the caller doesn't have permission to change envid.
+//	-E_INVAL if mask allows none of the CPUs in the system.
+static int
+sys_env_set_affinity(envid_t envid, uint32_t mask)
+{
+	struct Env *e;
+
+	if (envid2env(envid, &e, 1) < 0)
+		return -E_BAD_ENV;
+	if ((mask & ((1 << ncpu) - 1)) == 0)
+		return -E_INVAL;
+	sched_set_affinity(e, mask);
+	return 0;
+}
+
 // Deschedule current environment and pick a different one to run.
 static void
 sys_yield(void)
@@ -86,8 +249,13 @@ sys_exofork(void)
 	if (ret<0){
 		return ret;
 	}
-	e->env_status = ENV_NOT_RUNNABLE;
+	env_set_status(e, ENV_NOT_RUNNABLE);
 	e->env_tf = curenv->env_tf; // 复制寄存器的值
+	// A forked child pages in the same program image as its parent.
+	e->env_pager = curenv->env_pager;
+	e->env_pager_lo = curenv->env_pager_lo;
+	e->env_pager_hi = curenv->env_pager_hi;
+	e->env_pager_key = curenv->env_pager_key;
 	e->env_tf.tf_regs.reg_eax = 0; // 子进程返回0. 而父进程返回e->env_id
 	// 具体为什么，可以参考https://www.jianshu.com/p/10f822b3deda?utm_campaign=maleskine&utm_content=note&utm_medium=seo_notes&utm_source=recommendation
 	return e->env_id;
@@ -107,15 +275,24 @@ sys_env_set_status(envid_t envid, int status)
 	// LAB 4: Your code here.
 	// panic("sys_env_set_status not implemented");
 	struct Env *e;
-    if (envid2env(envid, &e, 1)){
+    if (envid2env(envid, &e, 0)){
 		return -E_BAD_ENV;
 	}
     
     if (status != ENV_NOT_RUNNABLE && status != ENV_RUNNABLE){
 		return -E_INVAL;
 	}
+
+    // e's pager, done with its fault, may set it runnable.
+    if (status == ENV_RUNNABLE && e->env_pager_fault
+	&& e->env_pager == curenv->env_id
+	&& e->env_status == ENV_NOT_RUNNABLE)
+		return pager_resume(e);
+    if (envid2env(envid, &e, 1)){
+		return -E_BAD_ENV;
+	}
     
-    e->env_status = status;
+    env_set_status(e, status);
     return 0;
 }
 
@@ -136,6 +313,8 @@ sys_env_set_trapframe(envid_t envid, struct Trapframe *tf)
 	if (envid2env(envid, &e, 1)) {
 			return -E_BAD_ENV;
 	}
+	user_page_in(tf, sizeof(*tf));
+	user_mem_assert(curenv, tf, sizeof(*tf), 0);
 
 	e->env_tf = *tf;
 	e->env_tf.tf_cs |= 3;
@@ -185,7 +364,7 @@ sys_page_alloc(envid_t envid, void *va, int perm)
 	// LAB 4: Your code here.
 	// panic("sys_page_alloc not implemented");
 	struct Env *e;
-    if (envid2env(envid, &e, 1) < 0){
+    if (envid2env_pager(envid, &e, va) < 0){
 		return -E_BAD_ENV;
 	}
 
@@ -199,7 +378,9 @@ sys_page_alloc(envid_t envid, void *va, int perm)
 		return -E_NO_MEM;
 	}
 
+    env_lock(e);
     int ret = page_insert(e->env_pgdir, p, va, perm);//映射
+    env_unlock(e);
     if (ret) { //映射失败需要释放物理页
         page_free(p);
     }
@@ -230,7 +411,8 @@ sys_page_map(envid_t srcenvid, void *srcva,
 	// LAB 4: Your code here.
 	// panic("sys_page_map not implemented");
 	struct Env *srcenv, *dstenv;
-    if (envid2env(srcenvid, &srcenv, 1) || envid2env(dstenvid, &dstenv, 1)) {
+    if (envid2env(srcenvid, &srcenv, 1)
+	|| envid2env_pager(dstenvid, &dstenv, dstva)) {
         return -E_BAD_ENV;
     }
 
@@ -239,22 +421,26 @@ sys_page_map(envid_t srcenvid, void *srcva,
         return -E_INVAL;
     }
 
-    pte_t *pte;
-    struct PageInfo *p = page_lookup(srcenv->env_pgdir, srcva, &pte);
-    if (!p){
-		return -E_INVAL;
-	} 
-
     int valid_perm = (PTE_U|PTE_P);
     if ((perm&valid_perm) != valid_perm){
 		return -E_INVAL;
 	} 
+    if (srcenv == curenv)
+		user_page_in(srcva, PGSIZE);
 
-    if ((perm & PTE_W) && !(*pte & PTE_W)){
-		return -E_INVAL;
-	}
-
-    int ret = page_insert(dstenv->env_pgdir, p, dstva, perm);
+    // Hold both so the page cannot be unmapped from srcenv, and freed,
+    // before dstenv has its own reference.
+    env_lock2(srcenv, dstenv);
+    pte_t *pte;
+    struct PageInfo *p = page_lookup(srcenv->env_pgdir, srcva, &pte);
+    int ret;
+    if (!p)
+		ret = -E_INVAL;
+    else if ((perm & PTE_W) && !(*pte & PTE_W))
+		ret = -E_INVAL;
+    else
+		ret = page_insert(dstenv->env_pgdir, p, dstva, perm);
+    env_unlock2(srcenv, dstenv);
     return ret;
 }
 
@@ -280,10 +466,221 @@ sys_page_unmap(envid_t envid, void *va)
 		return -E_INVAL;
 	}
 
+    env_lock(e);
     page_remove(e->env_pgdir, va);
+    env_unlock(e);
+    return 0;
+}
+
+// Make 'pagerid' the pager of envid for [lo, hi): from now on, the
+// kernel stops envid on a not-present page fault in that range and
+// hands the fault to the pager as if envid had sent it an IPC message
+// with the page-aligned fault address as value and no page.  The pager
+// may map pages into envid's [lo, hi) with sys_page_alloc and
+// sys_page_map, and once it is done with the fault, set envid runnable
+// again.  If the faulting page is still missing then, the pager could
+// not page it in and envid is destroyed.  The pager has no other rights
+// over envid.  Forked children inherit the pager.  A pagerid of 0
+// removes it.
+//
+// Returns 0 on success, < 0 on error.  Errors are:
+//	-E_BAD_ENV if environment envid or pagerid doesn't currently exist,
+//		or the caller doesn't have permission to change envid.
+//	-E_INVAL if lo or hi is not page-aligned, or hi is above UTOP.
+static int
+sys_env_set_pager(envid_t envid, envid_t pagerid, uintptr_t lo, uintptr_t hi)
+{
+	struct Env *e, *pager;
+	int r;
+
+	if ((r = envid2env(envid, &e, 1)) < 0)
+		return r;
+	if (pagerid == 0) {
+		e->env_pager = 0;
+		return 0;
+	}
+	if ((r = envid2env(pagerid, &pager, 0)) < 0)
+		return r;
+	if (PGOFF(lo) || PGOFF(hi) || lo > hi || hi > UTOP)
+		return -E_INVAL;
+
+	e->env_pager = pager->env_id;
+	e->env_pager_lo = lo;
+	e->env_pager_hi = hi;
+	e->env_pager_key = e->env_id;
+	return 0;
+}
+
+// Hand the words of the message just delivered to e, which is blocked
+// in sys_ipc_call_short, back in the registers they were sent in.
+static void
+ipc_load_regs(struct Env *e)
+{
+	struct PushRegs *regs = &e->env_tf.tf_regs;
+
+	static_assert(IPC_NWORDS == 4);
+	regs->reg_ecx = e->env_ipc_words[0];
+	regs->reg_ebx = e->env_ipc_words[1];
+	regs->reg_edi = e->env_ipc_words[2];
+	regs->reg_esi = e->env_ipc_words[3];
+	e->env_ipc_inregs = 0;
+}
+
+// Deliver e's pending fault to its pager, which is receiving, and
+// wake or signal the pager as ipc_deliver does for a message.
+static void
+pager_deliver(struct Env *pager, struct Env *e)
+{
+	pager->env_ipc_recving = 0;
+	pager->env_ipc_from = e->env_id;
+	pager->env_ipc_value = e->env_pager_fault;
+	pager->env_ipc_perm = 0;
+	pager->env_ipc_nwords = 0;
+	if (pager->env_ipc_blocked) {
+		env_set_status(pager, ENV_RUNNABLE);
+		pager->env_tf.tf_regs.reg_eax = 0;
+	} else if (pager != curenv)
+		env_notify(pager, NOTIFY_IPC);
+}
+
+// Stop e, which faulted at va, and pass the fault on to its pager.
+// If the pager is not receiving right now, the fault waits for its
+// next sys_ipc_recv.
+void
+pager_fault(struct Env *e, uintptr_t va)
+{
+	struct Env *pager;
+
+	if (envid2env(e->env_pager, &pager, 0) < 0) {
+		cprintf("[%08x] pager %08x is gone\n", e->env_id, e->env_pager);
+		env_destroy(e);
+		return;
+	}
+	sched_block(e);
+	env_set_status(e, ENV_NOT_RUNNABLE);
+	e->env_pager_fault = ROUNDDOWN(va, PGSIZE);
+	if (pager->env_ipc_recving) {
+		pager_deliver(pager, e);
+		return;
+	}
+	e->env_pager_link = NULL;
+	if (pager->env_pager_qtail)
+		pager->env_pager_qtail->env_pager_link = e;
+	else
+		pager->env_pager_qhead = e;
+	pager->env_pager_qtail = e;
+}
+
+// e's fault is over, as e goes away or runs again: forget it, taking e
+// off its pager's queue if the fault is still waiting there.
+void
+pager_cancel(struct Env *e)
+{
+	struct Env *pager, **pe, *prev = NULL;
+
+	if (!e->env_pager_fault)
+		return;
+	e->env_pager_fault = 0;
+	if (envid2env(e->env_pager, &pager, 0) < 0)
+		return;
+	pe = &pager->env_pager_qhead;
+	while (*pe && *pe != e) {
+		prev = *pe;
+		pe = &prev->env_pager_link;
+	}
+	if (*pe) {
+		*pe = e->env_pager_link;
+		if (pager->env_pager_qtail == e)
+			pager->env_pager_qtail = prev;
+	}
+}
+
+// If a fault is waiting for curenv as pager, deliver the oldest.
+// Returns 1 if one was delivered, 0 if none was waiting.
+static int
+pager_take_fault(void)
+{
+	struct Env *e = curenv->env_pager_qhead;
+
+	if (!e)
+		return 0;
+	if (!(curenv->env_pager_qhead = e->env_pager_link))
+		curenv->env_pager_qtail = NULL;
+	pager_deliver(curenv, e);
+	return 1;
+}
+
+// Check that the caller can send the page at srcva with perm, and
+// return it in *pp_store, or NULL if srcva >= UTOP sends no page.
+// Returns 0 on success, -E_INVAL if the page cannot be sent.
+static int
+ipc_page_lookup(void *srcva, unsigned perm, struct PageInfo **pp_store)
+{
+	struct PageInfo *p;
+	pte_t *pte;
+
+	*pp_store = NULL;
+    if (srcva < (void *) UTOP) { //检查 能否共享物理页
+        if(PGOFF(srcva)){ // 没有页对齐
+			return -E_INVAL;
+		}
+
+        p = page_lookup(curenv->env_pgdir, srcva, &pte);
+        if (!p){
+			return -E_INVAL;
+		}
+
+		int valid_perm = (PTE_U|PTE_P); //检查perm是否是合理的
+		if ((perm & valid_perm) != valid_perm) {
+			return -E_INVAL;
+		}
+		// 这个地方可能会 有点问题
+        // if ((*pte & perm) != perm){
+		// 	cprintf("Bug3: *pte: %d\n", *pte);
+		// 	// return -E_INVAL;
+		// }
+
+        if ((perm & PTE_W) && !(*pte & PTE_W)){//如果perm中有PTE_W的权限，但srcva只有 只读的权限。
+			return -E_INVAL;
+		}
+        *pp_store = p;
+    }
     return 0;
 }
 
+// Hand e a message from 'from': value, or the short message words if
+// not NULL, with a page already mapped at e's dstva if perm is
+// nonzero.  e stops receiving, and if it is blocked waiting for the
+// message, in sys_ipc_recv or sys_ipc_call, it is woken with a 0
+// return.  Otherwise e armed its receive with sys_ipc_recv_nb, and may
+// be running or blocked on something else, which the message must not
+// cut short: it is signalled NOTIFY_IPC instead.
+static void
+ipc_deliver(struct Env *e, envid_t from, uint32_t value, int perm,
+	    const uint32_t *words)
+{
+	int i;
+
+	e->env_ipc_recving = 0;
+	e->env_ipc_waitfor = 0;
+	e->env_ipc_from = from;
+	e->env_ipc_value = value;
+	e->env_ipc_perm = perm;
+	e->env_ipc_nwords = words ? IPC_NWORDS : 0;
+	for (i = 0; i < IPC_NWORDS; i++)
+		e->env_ipc_words[i] = words ? words[i] : (i == 0 ? value : 0);
+	if (e->env_ipc_inregs)
+		ipc_load_regs(e);
+	if (e->env_ipc_blocked) {
+		env_set_status(e, ENV_RUNNABLE);
+		e->env_tf.tf_regs.reg_eax = 0;
+		curenv->env_ipc_handoff = e->env_id;
+	} else if (e != curenv)
+		// A receiver armed with sys_ipc_recv_nb sees
+		// env_ipc_recving drop to 0, and can wait for this.
+		env_notify(e, NOTIFY_IPC);
+}
+
 // 尝试把一个值'value'发送给 目标进程'envid'
 // 如果 srcva<UTOP，那么 srcva 映射到的物理页 也需要发送过去，
 // 这样 接受者 就会共享这个 物理页。
@@ -312,61 +709,227 @@ sys_page_unmap(envid_t envid, void *va)
 //   -E_NO_MEM if there's not enough memory to map srcva in envid's
 //		address space.(说错了??? srcva上面不是映射过物理页了吗???)
 // 
+// words, if not NULL, makes this a short message: the IPC_NWORDS words
+// land in env_ipc_words, and value must be words[0].
 static int
-sys_ipc_try_send(envid_t envid, uint32_t value, void *srcva, unsigned perm)
+ipc_try_send(envid_t envid, uint32_t value, void *srcva, unsigned perm,
+	     const uint32_t *words)
 {
 	// LAB 4: Your code here.
 	// panic("sys_ipc_try_send not implemented");
 
 	struct Env *e; 
+	struct PageInfo *p;
+	int r;
+	if (srcva < (void *) UTOP)
+		user_page_in(srcva, PGSIZE);
     if (envid2env(envid, &e, 0)){ //checkperm设置0，不需要 检查权限
 		return -E_BAD_ENV;
 	}
 
-    if (!e->env_ipc_recving){ //检查目标进程是否在阻塞接受中
+    if (!e->env_ipc_recving && e->env_ipc_waitfor != curenv->env_id){ //检查目标进程是否在阻塞接受中
 		return -E_IPC_NOT_RECV;
 	}
 
-    if (srcva < (void *) UTOP) { //检查 能否共享物理页
-        if(PGOFF(srcva)){ // 没有页对齐
-			return -E_INVAL;
+    if ((r = ipc_page_lookup(srcva, perm, &p)) < 0)
+		return r;
+    if (p && e->env_ipc_dstva < (void *)UTOP) {//共享物理页
+        // e may be running, with a receive armed by sys_ipc_recv_nb.
+        env_lock2(curenv, e);
+        r = page_insert(e->env_pgdir, p, e->env_ipc_dstva, perm);
+        env_unlock2(curenv, e);
+        if (r){
+			return r;
 		}
+    }//否则 也不需要报错   
 
-        pte_t *pte;
-        struct PageInfo *p = page_lookup(curenv->env_pgdir, srcva, &pte);
-        if (!p){
-			return -E_INVAL;
-		}
+    ipc_deliver(e, curenv->env_id, value,
+		p && e->env_ipc_dstva < (void *)UTOP ? perm : 0, words);
+    return 0;
+}
 
-		int valid_perm = (PTE_U|PTE_P); //检查perm是否是合理的
-		if ((perm & valid_perm) != valid_perm) {
-			return -E_INVAL;
-		}
-		// 这个地方可能会 有点问题
-        // if ((*pte & perm) != perm){
-		// 	cprintf("Bug3: *pte: %d\n", *pte);
-		// 	// return -E_INVAL;
-		// }
+static int
+sys_ipc_try_send(envid_t envid, uint32_t value, void *srcva, unsigned perm)
+{
+	return ipc_try_send(envid, value, srcva, perm, NULL);
+}
 
-        if ((perm & PTE_W) && !(*pte & PTE_W)){//如果perm中有PTE_W的权限，但srcva只有 只读的权限。
-			return -E_INVAL;
+// Like sys_ipc_try_send, but send the short message w0..w3, with w0
+// as its value, and no page.
+static int
+sys_ipc_try_send_short(envid_t envid, uint32_t w0, uint32_t w1, uint32_t w2,
+		       uint32_t w3)
+{
+	uint32_t words[IPC_NWORDS] = { w0, w1, w2, w3 };
+
+	return ipc_try_send(envid, w0, (void *) UTOP, 0, words);
+}
+
+// A message waiting in its receiver's queue.
+struct IpcMsg {
+	struct IpcMsg *m_next;
+	envid_t m_from;
+	uint32_t m_value;
+	struct PageInfo *m_page;	// Page sent, referenced, or NULL
+	int m_perm;
+	bool m_short;			// m_words holds a short message
+	uint32_t m_words[IPC_NWORDS];
+};
+
+struct kmem_cache ipcmsg_cache = KMEM_CACHE("ipcmsg", struct IpcMsg);
+struct ipcq_stat ipcq_stat;
+
+// Send a message as ipc_try_send does if envid is receiving, and
+// otherwise put it at the end of envid's queue, holding a reference to
+// the page, for a later receive to take.  Either way the caller does
+// not wait.
+//
+// Returns 0 on success, < 0 on error.  Errors are those of
+// ipc_try_send except -E_IPC_NOT_RECV, and:
+//	-E_IPC_QUEUE_FULL if IPC_QUEUE_MAX messages already wait for
+//		envid.  Senders can sleep until its env_ipc_qlen drops.
+//	-E_NO_MEM if there is no memory for the message.
+static int
+ipc_queue_send(envid_t envid, uint32_t value, void *srcva, unsigned perm,
+	       const uint32_t *words)
+{
+	struct IpcMsg *m;
+	struct PageInfo *p;
+	struct Env *e;
+	int r;
+
+	if (srcva < (void *) UTOP)
+		user_page_in(srcva, PGSIZE);
+	ipcq_stat.sent++;
+	r = ipc_try_send(envid, value, srcva, perm, words);
+	if (r != -E_IPC_NOT_RECV)
+		return r;
+	if ((r = envid2env(envid, &e, 0)) < 0
+	    || (r = ipc_page_lookup(srcva, perm, &p)) < 0)
+		return r;
+	if (e->env_ipc_qlen >= IPC_QUEUE_MAX) {
+		ipcq_stat.full++;
+		return -E_IPC_QUEUE_FULL;
+	}
+	if (!(m = kmem_alloc(&ipcmsg_cache)))
+		return -E_NO_MEM;
+
+	m->m_next = NULL;
+	m->m_from = curenv->env_id;
+	m->m_value = value;
+	m->m_page = p;
+	m->m_perm = perm;
+	m->m_short = (words != NULL);
+	if (words)
+		memcpy(m->m_words, words, sizeof(m->m_words));
+	if (p)
+		page_incref(p);
+
+	if (e->env_ipc_qtail)
+		e->env_ipc_qtail->m_next = m;
+	else
+		e->env_ipc_qhead = m;
+	e->env_ipc_qtail = m;
+	if (++e->env_ipc_qlen > e->env_ipc_qmax)
+		e->env_ipc_qmax = e->env_ipc_qlen;
+	ipcq_stat.queued++;
+	if (++ipcq_stat.depth > ipcq_stat.maxdepth)
+		ipcq_stat.maxdepth = ipcq_stat.depth;
+	return 0;
+}
+
+// Take the oldest message off e's queue and free it.  If the queue
+// was full, wake the senders waiting for room.
+static void
+ipc_queue_pop(struct Env *e)
+{
+	struct IpcMsg *m = e->env_ipc_qhead;
+
+	if (!(e->env_ipc_qhead = m->m_next))
+		e->env_ipc_qtail = NULL;
+	if (e->env_ipc_qlen-- == IPC_QUEUE_MAX)
+		wq_wakeup_kva(&e->env_ipc_qlen);
+	ipcq_stat.depth--;
+	if (m->m_page)
+		page_decref(m->m_page);
+	kmem_free(&ipcmsg_cache, m);
+}
+
+// If a message waits in curenv's queue, receive the oldest as if it
+// had just been sent, mapping its page at dstva.
+// Returns 1 if a message was received, 0 if none was waiting, < 0 if
+// the page could not be mapped, in which case the message stays queued.
+static int
+ipc_queue_recv(void *dstva)
+{
+	struct IpcMsg *m = curenv->env_ipc_qhead;
+	int perm = 0, r;
+
+	if (!m)
+		return 0;
+	if (m->m_page && dstva < (void *) UTOP) {
+		env_lock(curenv);
+		r = page_insert(curenv->env_pgdir, m->m_page, dstva, m->m_perm);
+		env_unlock(curenv);
+		if (r < 0)
+			return r;
+		perm = m->m_perm;
+	}
+	curenv->env_ipc_dstva = dstva;
+	ipc_deliver(curenv, m->m_from, m->m_value, perm,
+		    m->m_short ? m->m_words : NULL);
+	ipc_queue_pop(curenv);
+	return 1;
+}
+
+// Drop every message still queued for e, which is going away.
+void
+ipc_queue_free(struct Env *e)
+{
+	while (e->env_ipc_qhead)
+		ipc_queue_pop(e);
+}
+
+// e is going away: fail the calls still waiting for its reply with
+// -E_BAD_ENV rather than leave them blocked for good.
+void
+ipc_call_abort(struct Env *e)
+{
+	struct Env *c;
+
+	for (c = envs; c < envs + NENV; c++)
+		if (c->env_ipc_waitfor == e->env_id && c->env_ipc_blocked) {
+			c->env_ipc_waitfor = 0;
+			c->env_ipc_inregs = 0;
+			c->env_tf.tf_regs.reg_eax = -E_BAD_ENV;
+			env_set_status(c, ENV_RUNNABLE);
 		}
+}
 
-        if (e->env_ipc_dstva < (void *)UTOP) {//共享物理页
-            int ret = page_insert(e->env_pgdir, p, e->env_ipc_dstva, perm);
-            if (ret){
-				return ret;
-			}
-            e->env_ipc_perm = perm;
-        }//否则 也不需要报错   
-    }   
-
-    e->env_ipc_recving = 0;
-    e->env_ipc_from = curenv->env_id;
-    e->env_ipc_value = value;
-    e->env_status = ENV_RUNNABLE;
-    e->env_tf.tf_regs.reg_eax = 0;
-    return 0;
+// Send a message to envid without waiting for it to receive: it is
+// delivered at once if envid is receiving, as by sys_ipc_try_send, or
+// else queued for envid's next sys_ipc_recv.  A page sent stays
+// referenced by the queue until then.
+//
+// Returns 0 on success, < 0 on error.  Errors are those of
+// sys_ipc_try_send except -E_IPC_NOT_RECV, and:
+//	-E_IPC_QUEUE_FULL if IPC_QUEUE_MAX messages already wait for
+//		envid; the caller can sleep until envid's env_ipc_qlen
+//		drops.
+//	-E_NO_MEM if there is no memory for the message.
+static int
+sys_ipc_send(envid_t envid, uint32_t value, void *srcva, unsigned perm)
+{
+	return ipc_queue_send(envid, value, srcva, perm, NULL);
+}
+
+// The caller's receive has waited as long as it asked to: give up.
+static void
+ipc_recv_expire(struct Env *e)
+{
+	e->env_ipc_recving = 0;
+	env_set_status(e, ENV_RUNNABLE);
+	e->env_tf.tf_regs.reg_eax = -E_TIMEOUT;
 }
 
 // 阻塞，直到一个值被 接受到。
@@ -378,9 +941,19 @@ sys_ipc_try_send(envid_t envid, uint32_t value, void *srcva, unsigned perm)
 // 
 // 如果成功，返回0；失败返回<0。错误有：
 //   -E_INVAL: 如果dstva<UTOP且dstva不是页对齐的。
+//
+// A message waiting in the caller's queue is received at once, without
+// blocking.  Then the only other error is:
+//	-E_NO_MEM if its page cannot be mapped at dstva; it stays queued.
+//
+// If us is not 0, give up after waiting us microseconds, rounded up to
+// the next timer tick, and return:
+//	-E_TIMEOUT if no message arrived in time.
 static int
-sys_ipc_recv(void *dstva)
+sys_ipc_recv_timeout(void *dstva, uint32_t us)
 {
+	int r;
+
 	// LAB 4: Your code here.
 	// panic("sys_ipc_recv not implemented");
 
@@ -391,13 +964,283 @@ sys_ipc_recv(void *dstva)
 		return -E_INVAL;
 	}        
 
+    if ((r = ipc_queue_recv(dstva)) != 0)
+		return r < 0 ? r : 0;
     curenv->env_ipc_recving = 1;
-    curenv->env_status = ENV_NOT_RUNNABLE;
     curenv->env_ipc_dstva = dstva;
+    wq_wakeup_kva(&curenv->env_ipc_recving);
+    if (pager_take_fault())
+		return 0;
+    if (us)
+		timer_set(curenv, us, ipc_recv_expire);
+    curenv->env_ipc_blocked = 1;
+    sched_block(curenv);
+    env_set_status(curenv, ENV_NOT_RUNNABLE);
     sys_yield();
     return 0;
 }
 
+// sys_ipc_recv_timeout, waiting as long as it takes.
+static int
+sys_ipc_recv(void *dstva)
+{
+	return sys_ipc_recv_timeout(dstva, 0);
+}
+
+// Like sys_ipc_recv, but return immediately instead of blocking.
+// The receive stays armed: a later sys_ipc_try_send delivers into
+// dstva and clears env_ipc_recving, which the caller polls through
+// thisenv to find out that a message has arrived, or signals NOTIFY_IPC
+// for the caller to wait for.  A queued message
+// arrives before this returns.
+//
+// Returns 0 on success, < 0 on error.  Errors are:
+//	-E_INVAL if dstva < UTOP but dstva is not page-aligned.
+//	-E_NO_MEM as for sys_ipc_recv.
+static int
+sys_ipc_recv_nb(void *dstva)
+{
+	int r;
+
+	if ((dstva < (void *)UTOP) && PGOFF(dstva))
+		return -E_INVAL;
+	if ((r = ipc_queue_recv(dstva)) != 0)
+		return r < 0 ? r : 0;
+
+	curenv->env_ipc_recving = 1;
+	curenv->env_ipc_dstva = dstva;
+	wq_wakeup_kva(&curenv->env_ipc_recving);
+	pager_take_fault();
+	return 0;
+}
+
+// Send a message to envid as sys_ipc_send does, then block until
+// envid replies, as if in sys_ipc_recv(dstva) but taking a message
+// from envid alone.  Only envid's reply can wake the caller, and if
+// envid was blocked receiving, it runs next on this CPU.  Messages
+// from others stay queued for the next receive, and a receive armed
+// with sys_ipc_recv_nb is disarmed, so that no other sender gets in.
+//
+// Returns 0 when the reply has arrived, < 0 on error.  Errors are:
+//	-E_INVAL if envid is the caller, or dstva < UTOP but dstva is not
+//		page-aligned.
+//	Any error from sys_ipc_send, in which case nothing was sent;
+//		-E_IPC_QUEUE_FULL if envid's queue is full.
+//	-E_BAD_ENV if envid goes away before it replies.
+static int
+sys_ipc_call(envid_t envid, uint32_t value, void *srcva, unsigned perm,
+	     void *dstva)
+{
+	int r;
+
+	if (envid == 0 || envid == curenv->env_id
+	    || ((dstva < (void *)UTOP) && PGOFF(dstva)))
+		return -E_INVAL;
+	if ((r = sys_ipc_send(envid, value, srcva, perm)) < 0)
+		return r;
+	curenv->env_ipc_recving = 0;
+	curenv->env_ipc_waitfor = envid;
+	curenv->env_ipc_dstva = dstva;
+	curenv->env_ipc_blocked = 1;
+	sched_block(curenv);
+	env_set_status(curenv, ENV_NOT_RUNNABLE);
+	sched_yield();
+}
+
+// Reply to envid as sys_ipc_try_send does, unless envid is 0, then
+// receive the next message as sys_ipc_recv(dstva) does.  If envid was
+// waiting for the reply, it runs next on this CPU.
+//
+// Returns 0 when the next message has arrived, < 0 on error.
+// Errors are:
+//	-E_INVAL if dstva < UTOP but dstva is not page-aligned.
+//	Any error from sys_ipc_try_send, in which case no reply was sent
+//		and nothing received.
+static int
+sys_ipc_reply_recv(envid_t envid, uint32_t value, void *srcva,
+		   unsigned perm, void *dstva)
+{
+	int r;
+
+	if ((dstva < (void *)UTOP) && PGOFF(dstva))
+		return -E_INVAL;
+	if (envid && (r = sys_ipc_try_send(envid, value, srcva, perm)) < 0)
+		return r;
+	return sys_ipc_recv(dstva);
+}
+
+// Like sys_ipc_call, but send the short message w0..w3, with w0 as
+// its value, and no page.  The reply's words, or for a reply that is
+// not short its value and three zeros, come back in the registers
+// w0..w3 were passed in, ecx, ebx, edi and esi.
+//
+// Returns 0 when the reply has arrived, < 0 on error as sys_ipc_call.
+static int
+sys_ipc_call_short(envid_t envid, uint32_t w0, uint32_t w1, uint32_t w2,
+		   uint32_t w3)
+{
+	uint32_t words[IPC_NWORDS] = { w0, w1, w2, w3 };
+	int r;
+
+	if (envid == 0 || envid == curenv->env_id)
+		return -E_INVAL;
+	if ((r = ipc_queue_send(envid, w0, (void *) UTOP, 0, words)) < 0)
+		return r;
+	curenv->env_ipc_recving = 0;
+	curenv->env_ipc_waitfor = envid;
+	curenv->env_ipc_dstva = (void *) UTOP;
+	curenv->env_ipc_inregs = 1;
+	curenv->env_ipc_blocked = 1;
+	sched_block(curenv);
+	env_set_status(curenv, ENV_NOT_RUNNABLE);
+	sched_yield();
+}
+
+// Reply to envid with the short message w0..w3, as
+// sys_ipc_try_send_short does, unless envid is 0, then receive the next
+// message as sys_ipc_recv does, at the dstva of the caller's last
+// receive.  If envid was waiting for the reply, it runs next.
+//
+// Returns 0 when the next message has arrived, < 0 on error.
+// Errors are any from sys_ipc_try_send_short, in which case no reply
+// was sent and nothing received.
+static int
+sys_ipc_reply_recv_short(envid_t envid, uint32_t w0, uint32_t w1,
+			 uint32_t w2, uint32_t w3)
+{
+	int r;
+
+	if (envid && (r = sys_ipc_try_send_short(envid, w0, w1, w2, w3)) < 0)
+		return r;
+	return sys_ipc_recv(curenv->env_ipc_dstva);
+}
+
+// Signal notification bits to envid, which may be any environment,
+// without blocking.  See env_notify.
+//
+// Returns 0 on success, < 0 on error.  Errors are:
+//	-E_BAD_ENV if environment envid doesn't currently exist.
+static int
+sys_notify(envid_t envid, uint32_t bits)
+{
+	struct Env *e;
+	int r;
+
+	if ((r = envid2env(envid, &e, 0)) < 0)
+		return r;
+	env_notify(e, bits);
+	return 0;
+}
+
+// Wait until any of the notification bits in mask has been signalled
+// to the caller, then clear those of them that have been and return
+// them.  Returns at once if some already have, and with 0 if something
+// else makes the caller runnable first.
+//
+// Returns the bits taken, < 0 on error.  Errors are:
+//	-E_INVAL if mask has no bits within NOTIFY_ALL, or has bit 31.
+static int
+sys_notify_wait(uint32_t mask)
+{
+	uint32_t got;
+
+	if (!mask || (mask & ~NOTIFY_ALL))
+		return -E_INVAL;
+	if ((got = curenv->env_notify_pending & mask)) {
+		curenv->env_notify_pending &= ~got;
+		return got;
+	}
+	curenv->env_notify_mask = mask;
+	curenv->env_tf.tf_regs.reg_eax = 0;
+	sched_block(curenv);
+	env_set_status(curenv, ENV_NOT_RUNNABLE);
+	sched_yield();
+}
+
+// Bind hardware interrupt irq to the caller's notification bit bit,
+// or unbind it if bit is negative.  See irq_bind.
+static int
+sys_irq_bind(int irq, int bit)
+{
+	return irq_bind(curenv, irq, bit);
+}
+
+// Sleep until the word at va is woken, provided it still holds val.
+// User words are woken by sys_wakeup; the kernel wakes env_status and
+// env_ipc_recving in UENVS when an environment dies or starts to
+// receive.  If ref is nonzero, also only sleep while va's page has ref
+// references, and wake when it loses one.  Wakeups can be spurious,
+// so callers recheck whatever they are waiting for.
+//
+// Returns 0 when woken, < 0 on error.  Errors are:
+//	-E_INVAL if va is not a word-aligned address the caller can read.
+//	-E_AGAIN if the word no longer holds val, or the page no longer
+//		has ref references.
+static int
+sys_sleep(uint32_t *va, uint32_t val, uint32_t ref)
+{
+	int r;
+
+	user_page_in(va, sizeof(*va));
+	if ((r = wq_sleep(curenv, va, val, ref)) < 0)
+		return r;
+	sys_yield();
+	return 0;
+}
+
+// Wake up to n environments sleeping on the word at va, oldest first,
+// or all of them if n <= 0.
+//
+// Returns the number woken, < 0 on error.  Errors are:
+//	-E_INVAL if va is not a word-aligned address the caller can read.
+static int
+sys_wakeup(uint32_t *va, int n)
+{
+	struct PageInfo *pp;
+
+	user_page_in(va, sizeof(*va));
+	if ((uintptr_t) va & 3
+	    || user_mem_check(curenv, va, sizeof(*va), PTE_U) < 0
+	    || !(pp = page_lookup(curenv->env_pgdir, va, NULL)))
+		return -E_INVAL;
+	return wq_wakeup(page2pa(pp) | PGOFF(va), n);
+}
+
+// Whether envid names the calling environment.
+static bool
+is_self(envid_t envid)
+{
+	return envid == 0 || envid == curenv->env_id;
+}
+
+// Whether a system call can run without the big kernel lock.  These
+// only touch the caller's own address space, under its env_lock and
+// page_lock, or the console, under console_lock.  Anything involving
+// another environment, the scheduler or IPC takes the big lock as
+// before.  sys_cputs and sys_page_map only qualify with memory that
+// is mapped already, so that the locked path is the one that pages it
+// in, or fails or destroys the caller over a bad address.  Changes to the caller's page
+// tables reach no other CPU's TLB, as no other CPU runs on them;
+// changes to other environments' go through tlb_shootdown.
+bool
+syscall_unlocked(uint32_t syscallno, uint32_t a1, uint32_t a2, uint32_t a3)
+{
+	switch (syscallno) {
+	case SYS_getenvid:
+		return 1;
+	case SYS_cputs:
+		return user_mem_check(curenv, (void *) a1, a2, PTE_U) == 0;
+	case SYS_page_alloc:
+	case SYS_page_unmap:
+		return is_self(a1);
+	case SYS_page_map:
+		return is_self(a1) && is_self(a3)
+		    && user_mem_check(curenv, (void *) a2, 1, PTE_U) == 0;
+	default:
+		return 0;
+	}
+}
+
 // Dispatches to the correct kernel function, passing the arguments.
 int32_t
 syscall(uint32_t syscallno, uint32_t a1, uint32_t a2, uint32_t a3, uint32_t a4, uint32_t a5)
@@ -437,6 +1280,45 @@ syscall(uint32_t syscallno, uint32_t a1, uint32_t a2, uint32_t a3, uint32_t a4,
         	return sys_ipc_try_send(a1, a2, (void *)a3, a4);
     	case (SYS_ipc_recv):
         	return sys_ipc_recv((void *)a1);
+		case (SYS_ipc_recv_nb):
+			return sys_ipc_recv_nb((void *)a1);
+		case (SYS_ipc_recv_timeout):
+			return sys_ipc_recv_timeout((void *)a1, a2);
+		case (SYS_env_set_pager):
+			return sys_env_set_pager(a1, a2, a3, a4);
+		case (SYS_env_set_priority):
+			return sys_env_set_priority(a1, a2);
+		case (SYS_env_set_tickets):
+			return sys_env_set_tickets(a1, a2);
+		case (SYS_env_set_affinity):
+			return sys_env_set_affinity(a1, a2);
+		case (SYS_sleep):
+			return sys_sleep((uint32_t *)a1, a2, a3);
+		case (SYS_wakeup):
+			return sys_wakeup((uint32_t *)a1, a2);
+		case (SYS_env_exit):
+			sys_env_exit(a1);
+			return 0;
+		case (SYS_env_wait):
+			return sys_env_wait(a1);
+		case (SYS_ipc_call):
+			return sys_ipc_call(a1, a2, (void *)a3, a4, (void *)a5);
+		case (SYS_ipc_reply_recv):
+			return sys_ipc_reply_recv(a1, a2, (void *)a3, a4, (void *)a5);
+		case (SYS_ipc_send):
+			return sys_ipc_send(a1, a2, (void *)a3, a4);
+		case (SYS_ipc_try_send_short):
+			return sys_ipc_try_send_short(a1, a2, a3, a4, a5);
+		case (SYS_ipc_call_short):
+			return sys_ipc_call_short(a1, a2, a3, a4, a5);
+		case (SYS_ipc_reply_recv_short):
+			return sys_ipc_reply_recv_short(a1, a2, a3, a4, a5);
+		case (SYS_notify):
+			return sys_notify(a1, a2);
+		case (SYS_notify_wait):
+			return sys_notify_wait(a1);
+		case (SYS_irq_bind):
+			return sys_irq_bind(a1, a2);
 	    case (SYS_env_set_trapframe):
             return sys_env_set_trapframe(a1, (struct Trapframe *)a2);
         default:
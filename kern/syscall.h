@@ -5,7 +5,27 @@
 #endif
 
 #include <inc/syscall.h>
+#include <inc/env.h>
+
+struct kmem_cache;
 
 int32_t syscall(uint32_t num, uint32_t a1, uint32_t a2, uint32_t a3, uint32_t a4, uint32_t a5);
+bool syscall_unlocked(uint32_t num, uint32_t a1, uint32_t a2, uint32_t a3);
+void pager_fault(struct Env *e, uintptr_t va);
+void pager_cancel(struct Env *e);
+void ipc_queue_free(struct Env *e);
+void ipc_call_abort(struct Env *e);
+
+// IPC message queue counters.
+struct ipcq_stat {
+	uint64_t sent;		// Messages sent by sys_ipc_send and calls
+	uint64_t queued;	// ... that had to be queued
+	uint64_t full;		// ... refused because the queue was full
+	uint32_t depth;		// Messages queued now, for all envs
+	uint32_t maxdepth;	// ... at most, so far
+};
+
+extern struct ipcq_stat ipcq_stat;
+extern struct kmem_cache ipcmsg_cache;
 
 #endif /* !JOS_KERN_SYSCALL_H */
@@ -0,0 +1,140 @@
+/*
+ * Kernel timers.
+ *
+ * An environment can have one timer set, which calls a function on it
+ * once a given number of microseconds have passed; a receive with a
+ * timeout uses it to give up.  Timers are kept on a wheel of NWHEEL
+ * slots, one per tick of QUANTUM_US: a timer sits in the slot of the
+ * tick it expires on, modulo NWHEEL, so setting or cancelling one only
+ * touches one short list, and each tick only looks at one slot.
+ *
+ * The boot CPU turns the wheel from its LAPIC timer interrupt.  When
+ * it idles with timers set, its timer goes off once, at the next
+ * deadline, rather than on every tick in between.  Ticks
+ * are counted off the TSC rather than the interrupts, so IPIs on the
+ * timer vector and late interrupts do not skew them.  A timer fires
+ * on the first interrupt at or after its deadline.
+ *
+ * Everything here runs under the big kernel lock.
+ */
+
+#include <inc/assert.h>
+#include <inc/x86.h>
+
+#include <kern/timer.h>
+#include <kern/env.h>
+#include <kern/cpu.h>
+
+#define NWHEEL		64	// Number of slots
+
+static struct Env *wheel[NWHEEL];
+static uint64_t wheel_tick;	// Last tick the wheel turned to
+static int timer_nset;		// Timers set on all slots
+
+// TSC counts per tick.
+static uint64_t
+tick_tsc(void)
+{
+	uint64_t n = tsc_hz * QUANTUM_US / 1000000;
+
+	return n ? n : 1;
+}
+
+// Call fn(e) once us microseconds have passed, unless the timer is
+// cancelled first.  Replaces any timer e already had.
+void
+timer_set(struct Env *e, uint32_t us, void (*fn)(struct Env *))
+{
+	uint64_t per = tick_tsc();
+	struct Env **slot;
+
+	timer_cancel(e);
+	e->env_timer_expire = (read_tsc() + tsc_hz * us / 1000000 + per - 1) / per;
+	if (e->env_timer_expire <= wheel_tick)
+		e->env_timer_expire = wheel_tick + 1;
+	e->env_timer_fn = fn;
+	slot = &wheel[e->env_timer_expire % NWHEEL];
+	e->env_timer_next = *slot;
+	*slot = e;
+	timer_nset++;
+
+	// An idle boot CPU has armed its timer for the deadlines it knew
+	// of, if any; wake it to arm it again.
+	if (bootcpu->cpu_status == CPU_HALTED && bootcpu->cpu_tickless)
+		lapic_ipi_cpu(bootcpu->cpu_id, IRQ_OFFSET + IRQ_TIMER);
+}
+
+// Cancel e's timer, if it has one.  env_set_status calls this for
+// everything but ENV_NOT_RUNNABLE, so a timer only outlives the wait
+// it bounds if that wait ends without waking e.
+void
+timer_cancel(struct Env *e)
+{
+	struct Env **pe;
+
+	if (!e->env_timer_expire)
+		return;
+	for (pe = &wheel[e->env_timer_expire % NWHEEL]; *pe != e;
+	     pe = &(*pe)->env_timer_next)
+		assert(*pe);
+	*pe = e->env_timer_next;
+	e->env_timer_next = NULL;
+	e->env_timer_expire = 0;
+	timer_nset--;
+}
+
+// Turn the wheel up to the current tick, firing the timers that have
+// expired.  Called by the boot CPU on every timer interrupt.
+void
+timer_tick(void)
+{
+	uint64_t now = read_tsc() / tick_tsc();
+	struct Env **pe, *e;
+	uint64_t i, n;
+
+	n = MIN(now - wheel_tick, NWHEEL);
+	for (i = 1; i <= n && timer_nset > 0; i++) {
+		pe = &wheel[(wheel_tick + i) % NWHEEL];
+		while ((e = *pe)) {
+			if (e->env_timer_expire > now) {
+				pe = &e->env_timer_next;
+				continue;
+			}
+			*pe = e->env_timer_next;
+			e->env_timer_next = NULL;
+			e->env_timer_expire = 0;
+			timer_nset--;
+			e->env_timer_fn(e);
+		}
+	}
+	wheel_tick = now;
+}
+
+// Whether any timer is set.
+bool
+timer_pending(void)
+{
+	return timer_nset > 0;
+}
+
+// Microseconds until the earliest timer is due, at least 1, or 0 if no
+// timer is set.
+uint32_t
+timer_next(void)
+{
+	uint64_t per = tick_tsc(), first = 0, now, due;
+	struct Env *e;
+	int i;
+
+	if (timer_nset == 0)
+		return 0;
+	for (i = 0; i < NWHEEL; i++)
+		for (e = wheel[i]; e; e = e->env_timer_next)
+			if (!first || e->env_timer_expire < first)
+				first = e->env_timer_expire;
+	now = read_tsc();
+	due = first * per;
+	if (due <= now)
+		return 1;
+	return MIN((due - now) * 1000000 / tsc_hz + 1, (uint64_t) ~0U);
+}
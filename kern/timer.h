@@ -0,0 +1,19 @@
+/* See COPYRIGHT for copyright information. */
+
+#ifndef JOS_KERN_TIMER_H
+#define JOS_KERN_TIMER_H
+#ifndef JOS_KERNEL
+# error "This is a JOS kernel header; user programs should not #include it"
+#endif
+
+#include <inc/types.h>
+
+struct Env;
+
+void timer_set(struct Env *e, uint32_t us, void (*fn)(struct Env *));
+void timer_cancel(struct Env *e);
+void timer_tick(void);
+bool timer_pending(void);
+uint32_t timer_next(void);
+
+#endif	// !JOS_KERN_TIMER_H
@@ -1,6 +1,7 @@
 #include <inc/mmu.h>
 #include <inc/x86.h>
 #include <inc/assert.h>
+#include <inc/error.h>
 
 #include <kern/pmap.h>
 #include <kern/trap.h>
@@ -13,6 +14,8 @@
 #include <kern/picirq.h>
 #include <kern/cpu.h>
 #include <kern/spinlock.h>
+#include <kern/wait.h>
+#include <kern/timer.h>
 
 static struct Taskstate ts; // 这个ts在lab4中 应该是没用的了
 // 在跳转到中断处理程序执行之前
@@ -58,6 +61,7 @@ void irq_serial();
 void irq_spurious();
 void irq_ide();
 void irq_error();
+void irq_shootdown();
 
 static const char *trapname(int trapno)
 {
@@ -128,6 +132,7 @@ trap_init(void)
 	SETGATE(idt[IRQ_OFFSET+IRQ_SPURIOUS], 0, GD_KT, irq_spurious, 0);
 	SETGATE(idt[IRQ_OFFSET+IRQ_IDE], 0, GD_KT, irq_ide, 0);
 	SETGATE(idt[IRQ_OFFSET+IRQ_ERROR], 0, GD_KT, irq_error, 0);
+	SETGATE(idt[IRQ_OFFSET+IRQ_SHOOTDOWN], 0, GD_KT, irq_shootdown, 0);
 
 	// Per-CPU setup 
 	trap_init_percpu();
@@ -225,6 +230,144 @@ print_regs(struct PushRegs *regs)
 	cprintf("  eax  0x%08x\n", regs->reg_eax);
 }
 
+// Hardware interrupts handed to user-level drivers: an interrupt on irq
+// signals notification bits ib_bits to environment ib_env.  Only IRQs
+// with an entry point in trapentry.S that the kernel does not handle
+// itself can be bound.
+#define IRQ_BINDABLE	(1 << IRQ_IDE)
+
+static struct {
+	envid_t ib_env;
+	uint32_t ib_bits;
+} irq_bindings[MAX_IRQS];
+
+// Have interrupts on irq signal notification bit bit to e, which must
+// have I/O privileges, or stop if bit is negative.  The IRQ is unmasked
+// while it is bound.  An IRQ has one driver at a time; the binding
+// lapses when that driver exits.
+//
+// Returns 0 on success, < 0 on error.  Errors are:
+//	-E_INVAL if irq cannot be bound or bit is above 30.
+//	-E_BAD_ENV if e has no I/O privileges, or irq is bound to
+//		another environment that still exists.
+int
+irq_bind(struct Env *e, int irq, int bit)
+{
+	struct Env *owner;
+	envid_t cur;
+
+	if (irq < 0 || irq >= MAX_IRQS || !(IRQ_BINDABLE & (1 << irq))
+	    || bit > 30)
+		return -E_INVAL;
+	if ((e->env_tf.tf_eflags & FL_IOPL_MASK) != FL_IOPL_3)
+		return -E_BAD_ENV;
+	cur = irq_bindings[irq].ib_env;
+	if (cur && cur != e->env_id && envid2env(cur, &owner, 0) == 0)
+		return -E_BAD_ENV;
+
+	if (bit < 0) {
+		irq_bindings[irq].ib_env = 0;
+		irq_setmask_8259A(irq_mask_8259A | (1 << irq));
+	} else {
+		irq_bindings[irq].ib_env = e->env_id;
+		irq_bindings[irq].ib_bits = 1 << bit;
+		if (irq_mask_8259A & (1 << irq))
+			irq_setmask_8259A(irq_mask_8259A & ~(1 << irq));
+	}
+	return 0;
+}
+
+// Pass an interrupt on irq to the driver bound to it, if any, and
+// give the driver the CPU if that woke it.  Returns 0 if irq is not
+// bound.
+static bool
+irq_notify(int irq)
+{
+	struct Env *e;
+
+	if (irq < 0 || irq >= MAX_IRQS || !irq_bindings[irq].ib_env)
+		return 0;
+	irq_eoi_8259A(irq);
+	if (envid2env(irq_bindings[irq].ib_env, &e, 0) < 0) {
+		// The driver has gone; mask the IRQ again.
+		irq_bindings[irq].ib_env = 0;
+		irq_setmask_8259A(irq_mask_8259A | (1 << irq));
+		return 1;
+	}
+	env_notify(e, irq_bindings[irq].ib_bits);
+	if (curenv && curenv != e && e->env_status == ENV_RUNNABLE
+	    && e->env_rq_cpu == cpunum())
+		sched_yield();
+	return 1;
+}
+
+// Whether a fault at fault_va, which trapped with tf, goes to curenv's
+// pager: a not-present fault in its demand-paged range.
+static bool
+pgfault_for_pager(struct Trapframe *tf, uint32_t fault_va)
+{
+	return curenv->env_pager && !(tf->tf_err & FEC_PR)
+	    && fault_va >= curenv->env_pager_lo
+	    && fault_va < curenv->env_pager_hi;
+}
+
+// Where the UTrapframe for a fault that trapped with tf goes.
+static struct UTrapframe *
+pgfault_utf(struct Trapframe *tf)
+{
+	if (tf->tf_esp >= UXSTACKTOP-PGSIZE && tf->tf_esp <= UXSTACKTOP-1)
+		// 已经在User Exception Stack中了：嵌套递归的page fault
+		// 递归的话，需要保留4个字节(一个word的大小)
+		return (struct UTrapframe *)(tf->tf_esp - sizeof(struct UTrapframe) - 4);
+	return (struct UTrapframe *)(UXSTACKTOP - sizeof(struct UTrapframe));
+}
+
+// Push the UTrapframe for the fault at fault_va at utf, which the
+// caller has checked, and send curenv to its page fault upcall.
+// tf is curenv->env_tf.
+static void
+pgfault_push(struct Trapframe *tf, uint32_t fault_va, struct UTrapframe *utf)
+{
+	utf->utf_fault_va = fault_va;
+	utf->utf_err = tf->tf_err;
+	utf->utf_regs = tf->tf_regs;
+	utf->utf_eip = tf->tf_eip;
+	utf->utf_eflags = tf->tf_eflags;
+	utf->utf_esp = tf->tf_esp;
+
+	tf->tf_eip = (uintptr_t)curenv->env_pgfault_upcall;
+	//把eip指向pgfault_upcall的地方
+	tf->tf_esp = (uintptr_t)utf; //把栈切换到 User Exception Stack上
+	//一个struct的内容在栈中的位置：先出现的属性放在低地址的地方，后出现的属性放在低地址的地方。
+	//所以utf现在指向栈的top的位置
+}
+
+// Send a page fault from user mode, which trapped with tf, to curenv's
+// upcall without the big kernel lock, as page_fault_handler would.
+// This is the trap that starts every copy-on-write fault, and it only
+// touches curenv's own exception stack, under env_lock so that no
+// other CPU can unmap it meanwhile.  Returns 0, having done nothing,
+// if the fault needs the locked path: it goes to the pager, there is
+// no upcall, or the exception stack is bad and curenv must die.
+static bool
+page_fault_unlocked(struct Trapframe *tf)
+{
+	uint32_t fault_va = rcr2();
+	struct UTrapframe *utf;
+	bool ok;
+
+	if (!curenv->env_pgfault_upcall || pgfault_for_pager(tf, fault_va))
+		return 0;
+	utf = pgfault_utf(tf);
+	env_lock(curenv);
+	if ((ok = user_mem_check(curenv, utf, 1, PTE_W) == 0)) {
+		curenv->env_tf = *tf;
+		pgfault_push(&curenv->env_tf, fault_va, utf);
+	}
+	env_unlock(curenv);
+	return ok;
+}
+
 static void
 trap_dispatch(struct Trapframe *tf)
 {
@@ -253,6 +396,12 @@ trap_dispatch(struct Trapframe *tf)
 	// Handle spurious interrupts
 	// The hardware sometimes raises these because of noise on the
 	// IRQ line or other reasons. We don't care.
+	// A TLB shootdown that reached a halted CPU: the flush is done.
+	if (tf->tf_trapno == IRQ_OFFSET + IRQ_SHOOTDOWN) {
+		lapic_eoi();
+		return;
+	}
+
 	if (tf->tf_trapno == IRQ_OFFSET + IRQ_SPURIOUS) {
 		cprintf("Spurious interrupt on irq 7\n");
 		print_trapframe(tf);
@@ -264,6 +413,9 @@ trap_dispatch(struct Trapframe *tf)
 	// LAB 4: Your code here.
 	if (tf->tf_trapno == IRQ_OFFSET + IRQ_TIMER) {
        lapic_eoi();
+       if (thiscpu == bootcpu)
+               timer_tick();
+       sched_tick();
        sched_yield();
        return;
 	}
@@ -280,6 +432,11 @@ trap_dispatch(struct Trapframe *tf)
 		return;
 	}	
 
+	// Interrupts bound to user-level drivers.
+	if (tf->tf_trapno >= IRQ_OFFSET && tf->tf_trapno < IRQ_OFFSET + MAX_IRQS
+	    && irq_notify(tf->tf_trapno - IRQ_OFFSET))
+		return;
+
 	// Unexpected trap: The user process or the kernel has a bug.
 	print_trapframe(tf);
 	if (tf->tf_cs == GD_KT)
@@ -297,6 +454,10 @@ trap(struct Trapframe *tf)
 	// of GCC rely on DF being clear
 	asm volatile("cld" ::: "cc");//cld表示 清除方向标志
 
+	// Out of user mode: catch up on page table changes other CPUs
+	// made meanwhile.
+	tlb_enter_kernel();
+
 	// Halt the CPU if some other CPU has called panic()
 	extern char *panicstr;
 	if (panicstr)
@@ -313,6 +474,37 @@ trap(struct Trapframe *tf)
 
 	if ((tf->tf_cs & 3) == 3) { // cs的最后3位
 		// Trapped from user mode.
+		// A TLB shootdown needs nothing but the flush above.
+		if (tf->tf_trapno == IRQ_OFFSET + IRQ_SHOOTDOWN) {
+			lapic_eoi();
+			env_pop_tf(tf);
+		}
+		// A few system calls need nothing the big kernel lock
+		// protects, so run them and go straight back.  A zombie
+		// gets collected on its next trap that takes the lock.
+		if (tf->tf_trapno == T_SYSCALL
+		    && syscall_unlocked(tf->tf_regs.reg_eax,
+					tf->tf_regs.reg_edx,
+					tf->tf_regs.reg_ecx,
+					tf->tf_regs.reg_ebx)) {
+			curenv->env_tf = *tf;
+			thiscpu->cpu_unlocked = 1;
+			trap_dispatch(&curenv->env_tf);
+			thiscpu->cpu_unlocked = 0;
+			// An unmap may have dropped a page others sleep
+			// on, and waking them takes the lock after all.
+			if (thiscpu->cpu_wake_page) {
+				lock_kernel();
+				wq_wakeup_page(thiscpu->cpu_wake_page);
+				thiscpu->cpu_wake_page = NULL;
+				unlock_kernel();
+			}
+			env_pop_tf(&curenv->env_tf);
+		}
+		// So do most page faults that go to the upcall.
+		if (tf->tf_trapno == T_PGFLT && page_fault_unlocked(tf))
+			env_pop_tf(&curenv->env_tf);
+
 		// Acquire the big kernel lock before doing any
 		// serious kernel work.
 		// LAB 4: Your code here.
@@ -350,7 +542,6 @@ trap(struct Trapframe *tf)
 		sched_yield();
 }
 
-
 void
 page_fault_handler(struct Trapframe *tf)
 {
@@ -406,30 +597,19 @@ page_fault_handler(struct Trapframe *tf)
 	//   要改变 用户进程运行的内容，修改'curenv->env_tf'
 	//   tf变量指向curenv->env_tf
 
+	// Not-present faults in a demand-paged range go to the env's
+	// pager, which maps the page in and lets the env retry.
+	if (pgfault_for_pager(tf, fault_va)) {
+		pager_fault(curenv, fault_va);
+		sched_yield();
+	}
+
 	// LAB 4: Your code here.
 	if (curenv->env_pgfault_upcall) {
-        struct UTrapframe *utf;
-        if (tf->tf_esp >= UXSTACKTOP-PGSIZE && tf->tf_esp <= UXSTACKTOP-1) {
-			// 已经在User Exception Stack中了：嵌套递归的page fault
-            utf = (struct UTrapframe *)(tf->tf_esp - sizeof(struct UTrapframe) - 4);
-			// 递归的话，需要保留4个字节(一个word的大小)
-        } else {
-            utf = (struct UTrapframe *)(UXSTACKTOP - sizeof(struct UTrapframe));
-        }   
+        struct UTrapframe *utf = pgfault_utf(tf);
 
         user_mem_assert(curenv, (void*)utf, 1, PTE_W);//检查User Exception Stack是否溢出了
-        utf->utf_fault_va = fault_va;
-        utf->utf_err = tf->tf_err;
-        utf->utf_regs = tf->tf_regs;
-        utf->utf_eip = tf->tf_eip;
-        utf->utf_eflags = tf->tf_eflags;
-        utf->utf_esp = tf->tf_esp;
-
-        curenv->env_tf.tf_eip = (uintptr_t)curenv->env_pgfault_upcall;
-		//把eip指向pgfault_upcall的地方
-        curenv->env_tf.tf_esp = (uintptr_t)utf; //把栈切换到 User Exception Stack上
-		//一个struct的内容在栈中的位置：先出现的属性放在低地址的地方，后出现的属性放在低地址的地方。
-		//所以utf现在指向栈的top的位置
+        pgfault_push(tf, fault_va, utf);
         env_run(curenv);
     } 
 
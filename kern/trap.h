@@ -9,6 +9,8 @@
 #include <inc/trap.h>
 #include <inc/mmu.h>
 
+struct Env;
+
 /* The kernel's interrupt descriptor table */
 extern struct Gatedesc idt[];
 extern struct Pseudodesc idt_pd;
@@ -19,5 +21,6 @@ void print_regs(struct PushRegs *regs);
 void print_trapframe(struct Trapframe *tf);
 void page_fault_handler(struct Trapframe *);
 void backtrace(struct Trapframe *);
+int irq_bind(struct Env *e, int irq, int bit);
 
 #endif /* JOS_KERN_TRAP_H */
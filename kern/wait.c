@@ -0,0 +1,192 @@
+/*
+ * Kernel wait queues.
+ *
+ * An environment waits on a 32-bit word in memory: it sleeps,
+ * ENV_NOT_RUNNABLE, on the word's physical address until whoever
+ * changes the word wakes that address.  User words are woken with
+ * sys_wakeup after the change.  The kernel wakes the words of envs[]
+ * that user space watches through UENVS itself: env_status when an
+ * environment dies, env_ipc_recving when it starts receiving.
+ *
+ * wq_sleep checks the word under the same locks as the wakeups, so a
+ * change made after the caller last looked is never lost: the sleep
+ * fails with -E_AGAIN instead.  A sleeper can also ask to be woken
+ * when the word's page loses a reference, which is how a pipe notices
+ * that the other end has gone.  Waits inside the kernel, such as
+ * sys_env_wait, sleep on a kernel word with wq_sleep_kva instead.
+ *
+ * Sleepers are hashed by address into a small table of queues, each
+ * in sleep order.  Everything here runs under the big kernel lock,
+ * except that pp_sleepers, which page_decref looks at, is kept under
+ * page_lock.
+ */
+
+#include <inc/assert.h>
+#include <inc/error.h>
+
+#include <kern/wait.h>
+#include <kern/env.h>
+#include <kern/pmap.h>
+#include <kern/cpu.h>
+#include <kern/sched.h>
+#include <kern/spinlock.h>
+
+#define NWQ		64	// Number of queues; a power of two
+#define WQ_HASH(key)	((((key) >> 2) ^ ((key) >> 12)) & (NWQ - 1))
+
+static struct Env *wq_heads[NWQ];
+static int wq_nsleep;		// Sleepers on all queues
+
+// Queue e, whose page's pp_sleepers already counts it, on key.
+static void
+wq_enqueue(struct Env *e, physaddr_t key)
+{
+	struct Env **pe;
+
+	for (pe = &wq_heads[WQ_HASH(key)]; *pe; pe = &(*pe)->env_wq_next)
+		/* find the tail */;
+	*pe = e;
+	e->env_wq_next = NULL;
+	e->env_wq_key = key;
+	wq_nsleep++;
+
+	sched_block(e);
+	env_set_status(e, ENV_NOT_RUNNABLE);
+}
+
+// Put e, which must be curenv, to sleep on the word at va, provided
+// the word still holds val and, if ref is nonzero, its page still has
+// ref references.  The caller then gives up the CPU; e's system call
+// returns 0 when it is woken.
+//
+// Returns 0 if e now sleeps, < 0 on error.  Errors are:
+//	-E_INVAL if va is not a word-aligned address e can read.
+//	-E_AGAIN if the word or the page's reference count has changed.
+int
+wq_sleep(struct Env *e, uint32_t *va, uint32_t val, uint32_t ref)
+{
+	struct PageInfo *pp;
+	physaddr_t key;
+	uint32_t word;
+
+	if ((uintptr_t) va & 3
+	    || user_mem_check(e, va, sizeof(*va), PTE_U) < 0
+	    || !(pp = page_lookup(e->env_pgdir, va, NULL)))
+		return -E_INVAL;
+	key = page2pa(pp) | PGOFF(va);
+
+	spin_lock(&page_lock);
+	word = *(volatile uint32_t *) ((char *) page2kva(pp) + PGOFF(va));
+	if (word != val || (ref && pp->pp_ref != ref)) {
+		spin_unlock(&page_lock);
+		return -E_AGAIN;
+	}
+	pp->pp_sleepers++;
+	spin_unlock(&page_lock);
+
+	wq_enqueue(e, key);
+	return 0;
+}
+
+// Put e, which must be curenv, to sleep on the kernel word at kva.
+// The caller has checked, under the big kernel lock, that whatever e
+// waits for has not happened yet, and then gives up the CPU.
+void
+wq_sleep_kva(struct Env *e, void *kva)
+{
+	physaddr_t key = PADDR(kva);
+
+	spin_lock(&page_lock);
+	pa2page(key)->pp_sleepers++;
+	spin_unlock(&page_lock);
+	wq_enqueue(e, key);
+}
+
+// Take e off the queue it sleeps on, if any, and have its sleep return
+// 0.  e's status is left to the caller; env_set_status calls this for
+// everything but ENV_NOT_RUNNABLE.
+void
+wq_remove(struct Env *e)
+{
+	struct Env **pe;
+
+	if (!e->env_wq_key)
+		return;
+	for (pe = &wq_heads[WQ_HASH(e->env_wq_key)]; *pe != e;
+	     pe = &(*pe)->env_wq_next)
+		assert(*pe);
+	*pe = e->env_wq_next;
+
+	spin_lock(&page_lock);
+	pa2page(e->env_wq_key)->pp_sleepers--;
+	spin_unlock(&page_lock);
+
+	e->env_wq_next = NULL;
+	e->env_wq_key = 0;
+	e->env_tf.tf_regs.reg_eax = 0;
+	wq_nsleep--;
+}
+
+// Wake up to n environments sleeping on physical address key, oldest
+// first, or all of them if n <= 0.  Returns the number woken.
+int
+wq_wakeup(physaddr_t key, int n)
+{
+	return wq_wakeup_ret(key, n, 0);
+}
+
+// Like wq_wakeup, but have the sleeps return ret.
+int
+wq_wakeup_ret(physaddr_t key, int n, int32_t ret)
+{
+	struct Env *e, *next;
+	int woken = 0;
+
+	if (wq_nsleep == 0)
+		return 0;
+	for (e = wq_heads[WQ_HASH(key)]; e; e = next) {
+		next = e->env_wq_next;
+		if (e->env_wq_key != key)
+			continue;
+		env_set_status(e, ENV_RUNNABLE);
+		e->env_tf.tf_regs.reg_eax = ret;
+		if (++woken == n)
+			break;
+	}
+	return woken;
+}
+
+// Wake everything sleeping on the kernel word at kva.
+void
+wq_wakeup_kva(void *kva)
+{
+	wq_wakeup(PADDR(kva), 0);
+}
+
+// Wake everything sleeping on any word of page pp.
+void
+wq_wakeup_page(struct PageInfo *pp)
+{
+	struct Env *e, *next;
+	physaddr_t pa = page2pa(pp);
+	int i;
+
+	for (i = 0; i < NWQ && wq_nsleep > 0; i++)
+		for (e = wq_heads[i]; e; e = next) {
+			next = e->env_wq_next;
+			if (PTE_ADDR(e->env_wq_key) == pa)
+				env_set_status(e, ENV_RUNNABLE);
+		}
+}
+
+// pp has lost a reference while environments sleep on it.  Wake them,
+// or, on the system call path that runs without the big kernel lock,
+// leave that to trap() once the call is done.
+void
+wq_page_released(struct PageInfo *pp)
+{
+	if (thiscpu->cpu_unlocked)
+		thiscpu->cpu_wake_page = pp;
+	else
+		wq_wakeup_page(pp);
+}
@@ -0,0 +1,23 @@
+/* See COPYRIGHT for copyright information. */
+
+#ifndef JOS_KERN_WAIT_H
+#define JOS_KERN_WAIT_H
+#ifndef JOS_KERNEL
+# error "This is a JOS kernel header; user programs should not #include it"
+#endif
+
+#include <inc/types.h>
+
+struct Env;
+struct PageInfo;
+
+int wq_sleep(struct Env *e, uint32_t *va, uint32_t val, uint32_t ref);
+void wq_sleep_kva(struct Env *e, void *kva);
+int wq_wakeup(physaddr_t key, int n);
+int wq_wakeup_ret(physaddr_t key, int n, int32_t ret);
+void wq_wakeup_kva(void *kva);
+void wq_wakeup_page(struct PageInfo *pp);
+void wq_page_released(struct PageInfo *pp);
+void wq_remove(struct Env *e);
+
+#endif	// !JOS_KERN_WAIT_H
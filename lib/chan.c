@@ -0,0 +1,142 @@
+// Single-producer, single-consumer channels of 32-bit messages in
+// shared memory.
+//
+// A channel is a pair of PTE_SHARE pages, so fork and spawn share it
+// with children: a control page holding the ring indices and a page of
+// message slots.  The producer only writes c_head and the consumer only
+// c_tail, each on a cache line of its own, so a message costs no lock
+// and no system call.  The kernel is only needed when one side has to
+// wait, the consumer for a message or the producer for room.  The
+// waiter raises its flag, looks at the ring again and waits for the
+// channel's notification bit; the other side signals the bit after it
+// next moves its index, if the flag is up.  A bit signalled before the
+// wait starts stays pending, so no wakeup is lost, and one left over
+// from an earlier wait only costs another look at the ring.
+
+#include <inc/lib.h>
+#include <inc/x86.h>
+
+#define CHAN_NSLOT	(PGSIZE / sizeof(uint32_t))
+
+struct Chan {
+	uint32_t c_bit;			// Notification bit, fixed at creation
+
+	// Producer's cache line
+	volatile uint32_t c_head __attribute__((aligned(64)));	// Messages sent
+	volatile envid_t c_producer;	// Set while it waits for room
+	volatile uint32_t c_pwait;	// ... and flagged here
+	uint32_t c_pwaits;		// Times it had to wait
+
+	// Consumer's cache line
+	volatile uint32_t c_tail __attribute__((aligned(64)));	// Messages taken
+	volatile envid_t c_consumer;	// Set while it waits for a message
+	volatile uint32_t c_cwait;	// ... and flagged here
+	uint32_t c_cwaits;		// Times it had to wait
+
+	uint32_t c_ring[CHAN_NSLOT] __attribute__((aligned(PGSIZE)));
+};
+
+// Keep the compiler from moving memory accesses across this point.
+// x86 itself keeps stores in order, and loads with respect to loads.
+#define compiler_barrier()	asm volatile("" : : : "memory")
+
+static bool
+chan_empty(struct Chan *ch)
+{
+	return ch->c_tail == ch->c_head;
+}
+
+static bool
+chan_full(struct Chan *ch)
+{
+	return ch->c_head - ch->c_tail == CHAN_NSLOT;
+}
+
+// Set up a channel in the CHAN_SIZE bytes at ch, which must be
+// page-aligned and unmapped, signalling notification bit bit (0..29)
+// to a side that waits.  Create the channel before forking or spawning
+// the environment at the other end.
+// Returns 0 on success, < 0 on error.
+int
+chan_create(struct Chan *ch, int bit)
+{
+	int i, r;
+
+	static_assert(sizeof(struct Chan) == CHAN_SIZE);
+	if ((uintptr_t) ch % PGSIZE || bit < 0 || bit >= 30)
+		return -E_INVAL;
+	for (i = 0; i < CHAN_SIZE; i += PGSIZE)
+		if ((r = sys_page_alloc(0, (char *) ch + i,
+					PTE_P|PTE_U|PTE_W|PTE_SHARE)) < 0)
+			return r;
+	ch->c_bit = bit;
+	return 0;
+}
+
+// Wait, with *flag raised and our envid in *self, until blocked(ch)
+// no longer holds.
+static void
+chan_wait(struct Chan *ch, volatile envid_t *self, volatile uint32_t *flag,
+	  bool (*blocked)(struct Chan *))
+{
+	*self = thisenv->env_id;
+	do {
+		// xchg is a full barrier: the flag is up before we look.
+		xchg(flag, 1);
+		if (!blocked(ch))
+			break;
+		sys_notify_wait(1 << ch->c_bit);
+	} while (blocked(ch));
+	*flag = 0;
+}
+
+// Having moved our index, signal the other side if it waits.
+static void
+chan_signal(struct Chan *ch, volatile envid_t *peer, volatile uint32_t *flag)
+{
+	// Pairs with the xchg in chan_wait: either the waiter sees our
+	// index move or we see its flag.
+	__sync_synchronize();
+	if (*flag && xchg(flag, 0))
+		sys_notify(*peer, 1 << ch->c_bit);
+}
+
+// Send v, waiting while the ring is full.
+void
+chan_send(struct Chan *ch, uint32_t v)
+{
+	if (chan_full(ch)) {
+		ch->c_pwaits++;
+		chan_wait(ch, &ch->c_producer, &ch->c_pwait, chan_full);
+	}
+	ch->c_ring[ch->c_head % CHAN_NSLOT] = v;
+	compiler_barrier();
+	ch->c_head++;
+	chan_signal(ch, &ch->c_consumer, &ch->c_cwait);
+}
+
+// Receive the next message, waiting while the ring is empty.
+uint32_t
+chan_recv(struct Chan *ch)
+{
+	uint32_t v;
+
+	if (chan_empty(ch)) {
+		ch->c_cwaits++;
+		chan_wait(ch, &ch->c_consumer, &ch->c_cwait, chan_empty);
+	}
+	compiler_barrier();
+	v = ch->c_ring[ch->c_tail % CHAN_NSLOT];
+	compiler_barrier();
+	ch->c_tail++;
+	chan_signal(ch, &ch->c_producer, &ch->c_pwait);
+	return v;
+}
+
+// Number of times the producer and the consumer of ch have had to wait.
+void
+chan_stat(struct Chan *ch, uint32_t *pwaits, uint32_t *cwaits)
+{
+	*pwaits = ch->c_pwaits;
+	*cwaits = ch->c_cwaits;
+}
@@ -4,7 +4,13 @@
 void
 exit(void)
 {
-	close_all();
-	sys_env_destroy(0);
+	exit_status(0);
 }
 
+// Exit, leaving status for whoever waits for us (see wait()).
+void
+exit_status(int status)
+{
+	close_all();
+	sys_env_exit(status);
+}
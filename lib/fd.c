@@ -260,9 +260,13 @@ int
 seek(int fdnum, off_t offset)
 {
 	int r;
+	struct Dev *dev;
 	struct Fd *fd;
 
-	if ((r = fd_lookup(fdnum, &fd)) < 0)
+	if ((r = fd_lookup(fdnum, &fd)) < 0
+	    || (r = dev_lookup(fd->fd_dev_id, &dev)) < 0)
+		return r;
+	if (dev->dev_seek && (r = (*dev->dev_seek)(fd, offset)) < 0)
 		return r;
 	fd->fd_offset = offset;
 	return 0;
@@ -318,3 +322,48 @@ stat(const char *path, struct Stat *stat)
 	return r;
 }
 
+
+// Copy at most 'count' bytes of fd 'in_fdnum', starting at 'offset', to
+// the current position of fd 'out_fdnum'.  The position of in_fdnum is
+// left alone.  Devices that can move the data without it passing
+// through this environment do so; anything else is read and written
+// through a buffer here.
+// Returns the number of bytes copied, < 0 on error.
+ssize_t
+sendfile(int out_fdnum, int in_fdnum, off_t offset, size_t count)
+{
+	char buf[512];
+	struct Dev *dev;
+	struct Fd *in, *out;
+	off_t pos;
+	int r, m, tot;
+
+	if ((r = fd_lookup(in_fdnum, &in)) < 0
+	    || (r = fd_lookup(out_fdnum, &out)) < 0
+	    || (r = dev_lookup(out->fd_dev_id, &dev)) < 0)
+		return r;
+	if ((in->fd_omode & O_ACCMODE) == O_WRONLY
+	    || (out->fd_omode & O_ACCMODE) == O_RDONLY)
+		return -E_INVAL;
+	if (dev->dev_sendfile
+	    && (r = (*dev->dev_sendfile)(out, in, offset, count)) != -E_NOT_SUPP)
+		return r;
+
+	pos = in->fd_offset;
+	if ((r = seek(in_fdnum, offset)) < 0)
+		return r;
+	for (tot = 0; tot < count; tot += r) {
+		if ((m = read(in_fdnum, buf, MIN(sizeof(buf), count - tot))) <= 0) {
+			r = m;
+			break;
+		}
+		if ((r = write(out_fdnum, buf, m)) < 0)
+			break;
+		if (r < m) {
+			tot += r;
+			break;
+		}
+	}
+	seek(in_fdnum, pos);
+	return tot > 0 ? tot : r;
+}
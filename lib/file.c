@@ -6,26 +6,179 @@
 
 union Fsipc fsipcbuf __attribute__((aligned(PGSIZE)));
 
-// Send an inter-environment request to the file server, and wait for
-// a reply.  The request body should be in fsipcbuf, and parts of the
-// response may be written back to fsipcbuf.
+// Bulk transfer buffer shared with the file server, just below the file
+// descriptor table.  Reads and writes larger than one page go through it
+// with FSREQ_READV/FSREQ_WRITEV.  The pages are PTE_SHARE so that fork
+// does not turn them copy-on-write under the server; a child that
+// inherits them registers fresh pages of its own before using them.
+#define FSBUF		((char *) (0xD0000000 - FSBUFSIZE))
+
+// Where file_mapblock maps block cache pages, below the async I/O area.
+#define FSMAP		((char *) (FSBUF - (FSAIO_NPAGES + 1) * PGSIZE))
+
+// The env that registered the pages currently mapped at FSBUF.  Like
+// the async I/O state below, it is kept per thread on the UTHREAD page:
+// a thread maps and registers buffers of its own.
+#define fsbuf_owner	(((struct Uthread *) UTHREAD)->ut_fsbuf_owner)
+
+// Serializes this environment's threads over fsipcbuf and the
+// client-side file buffers.  Held across each request from filling in
+// fsipcbuf to reading the reply out of it.
+static struct Mutex fs_lock;
+
+// Number of requests this environment has sent to the file server.
+uint32_t fsipc_nreq;
+
+// Client-side buffer for an open file, kept in the file descriptor's
+// data page (see fd2data).  It holds either read-ahead data or pending
+// writes starting at file offset fb_off, never both.  open() allocates
+// the page PTE_SHARE, so envs that share the Fd page through dup, fork
+// or spawn also share the buffer, and fd_offset stays the one logical
+// position they all see.
+struct FileBuf {
+	off_t fb_off;		// file offset of fb_data[0]
+	int fb_len;		// bytes valid in fb_data
+	bool fb_dirty;		// fb_data holds writes not yet sent
+	char fb_data[PGSIZE - 12];
+};
+
+// The file server's envid.
+static envid_t
+fsipc_env(void)
+{
+	static envid_t fsenv;
+	if (fsenv == 0)
+		fsenv = ipc_find_env(ENV_TYPE_FS);
+	return fsenv;
+}
+
+// Send request page 'pg' to the file server, and wait for a reply.
 // type: request code, passed as the simple integer IPC value.
 // dstva: virtual address at which to receive reply page, 0 if none.
 // Returns result from the file server.
 static int
-fsipc(unsigned type, void *dstva)
+fsipc_page(unsigned type, void *pg, void *dstva)
 {
-	static envid_t fsenv;
-	if (fsenv == 0)
-		fsenv = ipc_find_env(ENV_TYPE_FS);
+	if (debug)
+		cprintf("[%08x] fsipc %d %08x\n", thisenv->env_id, type, *(uint32_t *)pg);
 
-	static_assert(sizeof(fsipcbuf) == PGSIZE);
+	fsipc_nreq++;
+	return ipc_call(fsipc_env(), type, pg, PTE_P | PTE_W | PTE_U, dstva, NULL);
+}
 
+// Send a short request to the file server, and wait for a reply.  No
+// page changes hands, so neither side touches its page tables.
+// words[0] is the request code and the rest its arguments (see
+// inc/fs.h); the reply replaces them.
+// Returns result from the file server, words[0].
+static int
+fsipc_short(uint32_t *words)
+{
 	if (debug)
-		cprintf("[%08x] fsipc %d %08x\n", thisenv->env_id, type, *(uint32_t *)&fsipcbuf);
+		cprintf("[%08x] fsipc %d %08x (short)\n", thisenv->env_id, words[0], words[1]);
 
-	ipc_send(fsenv, type, &fsipcbuf, PTE_P | PTE_W | PTE_U);
-	return ipc_recv(NULL, dstva, NULL);
+	fsipc_nreq++;
+	return ipc_call_short(fsipc_env(), words);
+}
+
+// Send an inter-environment request to the file server, and wait for
+// a reply.  The request body should be in fsipcbuf, and parts of the
+// response may be written back to fsipcbuf.
+static int
+fsipc(unsigned type, void *dstva)
+{
+	static_assert(sizeof(fsipcbuf) == PGSIZE);
+
+	return fsipc_page(type, &fsipcbuf, dstva);
+}
+
+// Make sure this env has a bulk buffer registered with the file server.
+// Returns 0 on success, < 0 on error.
+static int
+fsbuf_setup(void)
+{
+	struct Fsreq_setbuf *req;
+	int i, r;
+
+	if (fsbuf_owner == thisenv->env_id)
+		return 0;
+
+	fsbuf_owner = 0;
+	for (i = 0; i < FSBUFPAGES; i++) {
+		req = (struct Fsreq_setbuf *) (FSBUF + i * PGSIZE);
+		if ((r = sys_page_alloc(0, req, PTE_P|PTE_W|PTE_U|PTE_SHARE)) < 0)
+			return r;
+		req->req_page = i;
+		if ((r = fsipc_page(FSREQ_SETBUF, req, NULL)) < 0)
+			return r;
+	}
+	fsbuf_owner = thisenv->env_id;
+	return 0;
+}
+
+// Return the buffer for fd, or NULL if fd is unbuffered.  Only real
+// file descriptor table entries opened without O_DIRECT have one.
+static struct FileBuf *
+filebuf_lookup(struct Fd *fd)
+{
+	struct Fd *fd2;
+	char *va;
+
+	if (fd_lookup(fd2num(fd), &fd2) < 0 || fd2 != fd)
+		return NULL;
+	va = fd2data(fd);
+	if (!(uvpd[PDX(va)] & PTE_P) || !(uvpt[PGNUM(va)] & PTE_P))
+		return NULL;
+	return (struct FileBuf *) va;
+}
+
+// Send any pending writes in fb to the file server.
+// Returns 0 on success, < 0 on error (the pending writes are lost).
+static int
+filebuf_flush(struct Fd *fd, struct FileBuf *fb)
+{
+	off_t pos;
+	int r;
+
+	static_assert(sizeof(struct FileBuf) == PGSIZE);
+	static_assert(sizeof(fb->fb_data) <= sizeof(fsipcbuf.write.req_buf));
+
+	if (!fb->fb_dirty)
+		return 0;
+
+	// The server writes at, and advances, the shared fd_offset.
+	pos = fd->fd_offset;
+	fd->fd_offset = fb->fb_off;
+	fsipcbuf.write.req_fileid = fd->fd_file.id;
+	fsipcbuf.write.req_n = fb->fb_len;
+	memmove(fsipcbuf.write.req_buf, fb->fb_data, fb->fb_len);
+	r = fsipc(FSREQ_WRITE, NULL);
+	fd->fd_offset = pos;
+
+	fb->fb_len = 0;
+	fb->fb_dirty = 0;
+	return r < 0 ? r : 0;
+}
+
+// Read ahead from the current position of fd into fb.
+// Returns the number of bytes buffered, < 0 on error.
+static int
+filebuf_fill(struct Fd *fd, struct FileBuf *fb)
+{
+	int r;
+
+	fb->fb_off = fd->fd_offset;
+	fb->fb_len = 0;
+	fsipcbuf.read.req_fileid = fd->fd_file.id;
+	fsipcbuf.read.req_n = sizeof(fb->fb_data);
+	r = fsipc(FSREQ_READ, NULL);
+	fd->fd_offset = fb->fb_off;
+	if (r < 0)
+		return r;
+	assert(r <= sizeof(fb->fb_data));
+	memmove(fb->fb_data, fsipcbuf.readRet.ret_buf, r);
+	fb->fb_len = r;
+	return r;
 }
 
 static int devfile_flush(struct Fd *fd);
@@ -33,6 +186,8 @@ static ssize_t devfile_read(struct Fd *fd, void *buf, size_t n);
 static ssize_t devfile_write(struct Fd *fd, const void *buf, size_t n);
 static int devfile_stat(struct Fd *fd, struct Stat *stat);
 static int devfile_trunc(struct Fd *fd, off_t newsize);
+static int devfile_seek(struct Fd *fd, off_t offset);
+static ssize_t devfile_sendfile(struct Fd *out, struct Fd *in, off_t offset, size_t n);
 
 struct Dev devfile =
 {
@@ -42,7 +197,9 @@ struct Dev devfile =
 	.dev_close =	devfile_flush,
 	.dev_stat =	devfile_stat,
 	.dev_write =	devfile_write,
-	.dev_trunc =	devfile_trunc
+	.dev_trunc =	devfile_trunc,
+	.dev_seek =	devfile_seek,
+	.dev_sendfile =	devfile_sendfile
 };
 
 // Open a file (or directory).
@@ -77,14 +234,22 @@ open(const char *path, int mode)
 	if ((r = fd_alloc(&fd)) < 0)
 		return r;
 
+	mutex_lock(&fs_lock);
 	strcpy(fsipcbuf.open.req_path, path);
 	fsipcbuf.open.req_omode = mode;
-
-	if ((r = fsipc(FSREQ_OPEN, fd)) < 0) {
+	r = fsipc(FSREQ_OPEN, fd);
+	mutex_unlock(&fs_lock);
+	if (r < 0) {
 		fd_close(fd, 0);
 		return r;
 	}
 
+	// Set up the client-side buffer in the fd's data page.  Without
+	// one the file simply stays unbuffered.
+	if (!(mode & O_DIRECT)
+	    && sys_page_alloc(0, fd2data(fd), PTE_P|PTE_W|PTE_U|PTE_SHARE) < 0)
+		sys_page_unmap(0, fd2data(fd));
+
 	return fd2num(fd);
 }
 
@@ -95,12 +260,25 @@ open(const char *path, int mode)
 // the reference counts on the FD pages to detect which files are
 // open, unmapping it is enough to free up server-side resources.
 // Other than that, we just have to make sure our changes are flushed
-// to disk.
+// to disk, starting with any still sitting in the client-side buffer.
 static int
 devfile_flush(struct Fd *fd)
 {
-	fsipcbuf.flush.req_fileid = fd->fd_file.id;
-	return fsipc(FSREQ_FLUSH, NULL);
+	uint32_t words[IPC_NWORDS];
+	struct FileBuf *fb;
+	int r, r2;
+
+	r = 0;
+	mutex_lock(&fs_lock);
+	if ((fb = filebuf_lookup(fd)) != NULL) {
+		r = filebuf_flush(fd, fb);
+		(void) sys_page_unmap(0, fb);
+	}
+	mutex_unlock(&fs_lock);
+	words[0] = FSREQ_FLUSH;
+	words[1] = fd->fd_file.id;
+	r2 = fsipc_short(words);
+	return r < 0 ? r : r2;
 }
 
 // Read at most 'n' bytes from 'fd' at the current position into 'buf'.
@@ -109,14 +287,46 @@ devfile_flush(struct Fd *fd)
 // 	The number of bytes successfully read.
 // 	< 0 on error.
 static ssize_t
-devfile_read(struct Fd *fd, void *buf, size_t n)
+devfile_read_locked(struct Fd *fd, void *buf, size_t n)
 {
 	// Make an FSREQ_READ request to the file system server after
 	// filling fsipcbuf.read with the request arguments.  The
 	// bytes read will be written back to fsipcbuf by the file
 	// system server.
+	struct FileBuf *fb;
 	int r;
 
+	// Small reads are served from the read-ahead buffer, refilling it
+	// when the position falls outside it.
+	if ((fb = filebuf_lookup(fd)) != NULL) {
+		if ((r = filebuf_flush(fd, fb)) < 0)
+			return r;
+		if ((fd->fd_offset < fb->fb_off
+		     || fd->fd_offset >= fb->fb_off + fb->fb_len)
+		    && n < sizeof(fb->fb_data)
+		    && (r = filebuf_fill(fd, fb)) <= 0)
+			return r;
+		if (fd->fd_offset >= fb->fb_off
+		    && fd->fd_offset < fb->fb_off + fb->fb_len) {
+			r = MIN(n, fb->fb_off + fb->fb_len - fd->fd_offset);
+			memmove(buf, fb->fb_data + (fd->fd_offset - fb->fb_off), r);
+			fd->fd_offset += r;
+			return r;
+		}
+	}
+
+	// Large reads come back through the bulk buffer in one round trip.
+	if (n > PGSIZE && fsbuf_setup() >= 0) {
+		fsipcbuf.readv.req_fileid = fd->fd_file.id;
+		fsipcbuf.readv.req_n = MIN(n, FSBUFSIZE);
+		if ((r = fsipc(FSREQ_READV, NULL)) < 0)
+			return r;
+		assert(r <= n);
+		assert(r <= FSBUFSIZE);
+		memmove(buf, FSBUF, r);
+		return r;
+	}
+
 	fsipcbuf.read.req_fileid = fd->fd_file.id;
 	fsipcbuf.read.req_n = n;
 	if ((r = fsipc(FSREQ_READ, NULL)) < 0)
@@ -127,6 +337,17 @@ devfile_read(struct Fd *fd, void *buf, size_t n)
 	return r;
 }
 
+static ssize_t
+devfile_read(struct Fd *fd, void *buf, size_t n)
+{
+	ssize_t r;
+
+	mutex_lock(&fs_lock);
+	r = devfile_read_locked(fd, buf, n);
+	mutex_unlock(&fs_lock);
+	return r;
+}
+
 
 // Write at most 'n' bytes from 'buf' to 'fd' at the current seek position.
 //
@@ -140,7 +361,7 @@ devfile_read(struct Fd *fd, void *buf, size_t n)
 // 	 成功写入的字节数
 //   出错，返回<0
 static ssize_t
-devfile_write(struct Fd *fd, const void *buf, size_t n)
+devfile_write_locked(struct Fd *fd, const void *buf, size_t n)
 {
 	// 向文件系统服务器 发送一个FSREQ_WRITE的请求。
 	// 注意：fsipcbuf.write.req_buf的大小 最大只有PGSIZE左右的大小
@@ -148,25 +369,73 @@ devfile_write(struct Fd *fd, const void *buf, size_t n)
 	// 
 	// LAB 5: Your code here
 	// panic("devfile_write not implemented");
+	struct FileBuf *fb;
+	int r;
+
+	// Small writes are collected in the buffer and sent when it fills
+	// up or the next write does not continue where they left off.
+	if ((fb = filebuf_lookup(fd)) != NULL) {
+		if (!fb->fb_dirty)
+			fb->fb_len = 0;		// read-ahead may go stale
+		else if (fd->fd_offset != fb->fb_off + fb->fb_len
+			 || fb->fb_len + n > sizeof(fb->fb_data))
+			if ((r = filebuf_flush(fd, fb)) < 0)
+				return r;
+		if (n < sizeof(fb->fb_data)) {
+			if (!fb->fb_dirty) {
+				fb->fb_off = fd->fd_offset;
+				fb->fb_dirty = 1;
+			}
+			memmove(fb->fb_data + fb->fb_len, buf, n);
+			fb->fb_len += n;
+			fd->fd_offset += n;
+			return n;
+		}
+	}
+
+	// Writes that do not fit in the request page go through the bulk
+	// buffer, FSBUFSIZE bytes per round trip.
+	if (n > sizeof(fsipcbuf.write.req_buf) && fsbuf_setup() >= 0) {
+		fsipcbuf.writev.req_fileid = fd->fd_file.id;
+		fsipcbuf.writev.req_n = MIN(n, FSBUFSIZE);
+		memmove(FSBUF, buf, fsipcbuf.writev.req_n);
+		return fsipc(FSREQ_WRITEV, NULL);
+	}
 
 	fsipcbuf.write.req_fileid = fd->fd_file.id;
-	fsipcbuf.write.req_n = MIN(n, PGSIZE);
+	fsipcbuf.write.req_n = MIN(n, sizeof(fsipcbuf.write.req_buf));
 	memmove(fsipcbuf.write.req_buf, buf, fsipcbuf.write.req_n);
-	int r = fsipc(FSREQ_WRITE, NULL);
+	return fsipc(FSREQ_WRITE, NULL);
+}
+
+static ssize_t
+devfile_write(struct Fd *fd, const void *buf, size_t n)
+{
+	ssize_t r;
+
+	mutex_lock(&fs_lock);
+	r = devfile_write_locked(fd, buf, n);
+	mutex_unlock(&fs_lock);
 	return r;
 }
 
 static int
 devfile_stat(struct Fd *fd, struct Stat *st)
 {
+	uint32_t words[IPC_NWORDS];
 	int r;
 
-	fsipcbuf.stat.req_fileid = fd->fd_file.id;
-	if ((r = fsipc(FSREQ_STAT, NULL)) < 0)
+	// The size must include writes still in the buffer.
+	if ((r = file_flushbuf(fd)) < 0)
+		return r;
+
+	words[0] = FSREQ_STAT;
+	words[1] = fd->fd_file.id;
+	if ((r = fsipc_short(words)) < 0)
 		return r;
-	strcpy(st->st_name, fsipcbuf.statRet.ret_name);
-	st->st_size = fsipcbuf.statRet.ret_size;
-	st->st_isdir = fsipcbuf.statRet.ret_isdir;
+	strcpy(st->st_name, fd->fd_file.name);
+	st->st_size = words[1];
+	st->st_isdir = words[2];
 	return 0;
 }
 
@@ -174,9 +443,314 @@ devfile_stat(struct Fd *fd, struct Stat *st)
 static int
 devfile_trunc(struct Fd *fd, off_t newsize)
 {
-	fsipcbuf.set_size.req_fileid = fd->fd_file.id;
-	fsipcbuf.set_size.req_size = newsize;
-	return fsipc(FSREQ_SET_SIZE, NULL);
+	uint32_t words[IPC_NWORDS];
+	struct FileBuf *fb;
+	int r;
+
+	mutex_lock(&fs_lock);
+	r = 0;
+	if ((fb = filebuf_lookup(fd)) != NULL) {
+		r = filebuf_flush(fd, fb);
+		fb->fb_len = 0;
+	}
+	mutex_unlock(&fs_lock);
+	if (r < 0)
+		return r;
+
+	words[0] = FSREQ_SET_SIZE;
+	words[1] = fd->fd_file.id;
+	words[2] = newsize;
+	return fsipc_short(words);
+}
+
+// Send pending writes before the position moves.  Read-ahead data is
+// kept, since it is tagged with its own file offset.
+static int
+devfile_seek(struct Fd *fd, off_t offset)
+{
+	return file_flushbuf(fd);
+}
+
+// Copy at most 'n' bytes of file 'in', starting at 'offset', to the
+// current position of file 'out'.  The file server copies between its
+// own block cache pages; nothing comes through this environment.
+// Returns the number of bytes copied, < 0 on error.
+static ssize_t
+devfile_sendfile(struct Fd *out, struct Fd *in, off_t offset, size_t n)
+{
+	struct FileBuf *fb;
+	int r;
+
+	if (in->fd_dev_id != devfile.dev_id)
+		return -E_NOT_SUPP;
+	mutex_lock(&fs_lock);
+	r = 0;
+	if ((fb = filebuf_lookup(in)) != NULL)
+		r = filebuf_flush(in, fb);
+	if (r >= 0 && (fb = filebuf_lookup(out)) != NULL) {
+		r = filebuf_flush(out, fb);
+		fb->fb_len = 0;
+	}
+	if (r >= 0) {
+		fsipcbuf.copy.req_fileid = out->fd_file.id;
+		fsipcbuf.copy.req_srcid = in->fd_file.id;
+		fsipcbuf.copy.req_offset = offset;
+		fsipcbuf.copy.req_n = n;
+		r = fsipc(FSREQ_COPY, NULL);
+	}
+	mutex_unlock(&fs_lock);
+	return r;
+}
+
+// Send any writes still buffered for file 'fd' to the file server, so
+// that requests which bypass the buffer see them.
+// Returns 0 on success, < 0 on error.
+int
+file_flushbuf(struct Fd *fd)
+{
+	struct FileBuf *fb;
+	int r = 0;
+
+	mutex_lock(&fs_lock);
+	if ((fb = filebuf_lookup(fd)) != NULL)
+		r = filebuf_flush(fd, fb);
+	mutex_unlock(&fs_lock);
+	return r;
+}
+
+// Map the file server's block cache page holding byte 'offset' of the
+// open file with id 'fileid', read-only, and point *pg_store at that
+// byte.  Unmap it with file_unmapblock when done.
+// Returns the number of file bytes available at *pg_store, 0 at end of
+// file, < 0 on error.
+int
+file_mapblock(int fileid, off_t offset, char **pg_store)
+{
+	int r;
+
+	mutex_lock(&fs_lock);
+	fsipcbuf.map.req_fileid = fileid;
+	fsipcbuf.map.req_offset = offset;
+	r = fsipc(FSREQ_MAP, FSMAP);
+	mutex_unlock(&fs_lock);
+	if (r > 0)
+		*pg_store = FSMAP + offset % BLKSIZE;
+	return r;
+}
+
+void
+file_unmapblock(void)
+{
+	(void) sys_page_unmap(0, FSMAP);
+}
+
+// Ask the file server to page the 'nseg' segments in 'seg' of the
+// program open as fdnum into 'child' as it touches them.  The server
+// must still be made child's pager with sys_env_set_pager.
+// Returns 0 on success, < 0 on error.
+int
+file_pager(int fdnum, envid_t child, const struct Fspager_seg *seg, int nseg)
+{
+	struct Fd *fd;
+	int r;
+
+	if ((r = fd_lookup(fdnum, &fd)) < 0)
+		return r;
+	if (fd->fd_dev_id != devfile.dev_id || nseg > FSPAGER_NSEG)
+		return -E_INVAL;
+	mutex_lock(&fs_lock);
+	fsipcbuf.pager.req_fileid = fd->fd_file.id;
+	fsipcbuf.pager.req_env = child;
+	fsipcbuf.pager.req_nseg = nseg;
+	memmove(fsipcbuf.pager.req_seg, seg, nseg * sizeof(seg[0]));
+	r = fsipc(FSREQ_PAGER, NULL);
+	mutex_unlock(&fs_lock);
+	return r;
+}
+
+
+// --------------------------------------------------------------
+// Asynchronous I/O
+// --------------------------------------------------------------
+
+// The async I/O area shared with the file server, just below FSBUF:
+// the submission/completion ring, then one data page per ring entry.
+// Like FSBUF it is PTE_SHARE and registered again by forked children.
+#define FSAIO		((struct Fsaio_ring *) (FSBUF - FSAIO_NPAGES * PGSIZE))
+#define FSAIO_DATA(i)	((char *) FSAIO + (1 + (i)) * PGSIZE)
+
+// Per-thread state, on the UTHREAD page (see struct Uthread).
+#define fsaio_owner	(((struct Uthread *) UTHREAD)->ut_fsaio_owner)
+#define fsaio_submitted	(((struct Uthread *) UTHREAD)->ut_fsaio_submitted)
+#define fsaio_slot	(((struct Uthread *) UTHREAD)->ut_fsaio_slot)
+
+// Make sure this env has an async I/O area registered with the file
+// server.  Returns 0 on success, < 0 on error.
+static int
+fsaio_setup(void)
+{
+	struct Fsreq_setbuf *req;
+	int i, r;
+
+	if (fsaio_owner == thisenv->env_id)
+		return 0;
+
+	fsaio_owner = 0;
+	for (i = 0; i < FSAIO_NPAGES; i++) {
+		req = (struct Fsreq_setbuf *) ((char *) FSAIO + i * PGSIZE);
+		if ((r = sys_page_alloc(0, req, PTE_P|PTE_W|PTE_U|PTE_SHARE)) < 0)
+			return r;
+		req->req_page = i;
+		if ((r = fsipc_page(FSREQ_AIO_SETUP, req, NULL)) < 0)
+			return r;
+	}
+	memset(FSAIO, 0, PGSIZE);
+	memset(fsaio_slot, 0, sizeof(fsaio_slot));
+	fsaio_submitted = 0;
+	fsaio_owner = thisenv->env_id;
+	return 0;
+}
+
+// Queue a transfer of n bytes between fdnum at 'offset' and buf.
+static int
+fsaio_queue(int op, int fdnum, void *buf, size_t n, off_t offset, uint32_t tag)
+{
+	struct Fsaio_sqe *sqe;
+	struct FileBuf *fb;
+	struct Fd *fd;
+	int i, r;
+
+	if ((r = fd_lookup(fdnum, &fd)) < 0)
+		return r;
+	if (fd->fd_dev_id != devfile.dev_id || n > PGSIZE || offset < 0)
+		return -E_INVAL;
+	if ((r = fsaio_setup()) < 0)
+		return r;
+
+	for (i = 0; i < FSAIO_NENTRY && fsaio_slot[i].busy; i++)
+		;
+	if (i == FSAIO_NENTRY)
+		return -E_NO_MEM;
+
+	// Keep the client-side buffer out of the way: pending writes go
+	// first, and read-ahead may be overwritten.
+	mutex_lock(&fs_lock);
+	r = 0;
+	if ((fb = filebuf_lookup(fd)) != NULL) {
+		r = filebuf_flush(fd, fb);
+		if (op == FSAIO_WRITE)
+			fb->fb_len = 0;
+	}
+	mutex_unlock(&fs_lock);
+	if (r < 0)
+		return r;
+
+	fsaio_slot[i].busy = 1;
+	fsaio_slot[i].buf = NULL;
+	if (op == FSAIO_READ)
+		fsaio_slot[i].buf = buf;
+	else
+		memmove(FSAIO_DATA(i), buf, n);
+
+	sqe = &FSAIO->sq[FSAIO->sq_tail % FSAIO_NENTRY];
+	sqe->sqe_tag = tag;
+	sqe->sqe_op = op;
+	sqe->sqe_fileid = fd->fd_file.id;
+	sqe->sqe_offset = offset;
+	sqe->sqe_n = n;
+	sqe->sqe_slot = i;
+	FSAIO->sq_tail++;
+	return 0;
+}
+
+// Queue a read of up to n (<= PGSIZE) bytes at 'offset' in fdnum into
+// buf, to be reported with 'tag'.  The file position is not used or
+// changed.  Nothing is sent to the server until aio_submit().
+// Returns 0 on success, -E_NO_MEM if FSAIO_NENTRY transfers are already
+// in flight, < 0 on other errors.
+int
+aio_read(int fdnum, void *buf, size_t n, off_t offset, uint32_t tag)
+{
+	return fsaio_queue(FSAIO_READ, fdnum, buf, n, offset, tag);
+}
+
+// Queue a write of n (<= PGSIZE) bytes from buf at 'offset' in fdnum.
+// buf may be reused as soon as this returns.  Otherwise like aio_read.
+int
+aio_write(int fdnum, const void *buf, size_t n, off_t offset, uint32_t tag)
+{
+	return fsaio_queue(FSAIO_WRITE, fdnum, (void *) buf, n, offset, tag);
+}
+
+// Hand everything queued since the last call to the file server.
+// Returns as soon as the server has seen the request, not when the
+// transfers are done.
+int
+aio_submit(void)
+{
+	uint32_t words[IPC_NWORDS] = { FSREQ_AIO_SUBMIT };
+	int r;
+
+	if (fsaio_owner != thisenv->env_id || fsaio_submitted == FSAIO->sq_tail)
+		return 0;
+	if ((r = fsipc_short(words)) < 0)
+		return r;
+	fsaio_submitted = FSAIO->sq_tail;
+	return 0;
+}
+
+// Reap one completion, if there is one.  Stores the transfer's tag in
+// *tag_store and its result (bytes transferred or < 0) in *res_store.
+// Returns 1 if a completion was reaped, 0 if none is ready.
+int
+aio_poll(uint32_t *tag_store, int *res_store)
+{
+	struct Fsaio_cqe *cqe;
+	int slot;
+
+	if (fsaio_owner != thisenv->env_id || FSAIO->cq_head == FSAIO->cq_tail)
+		return 0;
+
+	// The server stops taking submissions while the completion ring
+	// is full; have the next aio_submit start it again.
+	if (FSAIO->cq_tail - FSAIO->cq_head >= FSAIO_NENTRY)
+		fsaio_submitted = FSAIO->sq_head;
+
+	cqe = &FSAIO->cq[FSAIO->cq_head % FSAIO_NENTRY];
+	slot = cqe->cqe_slot;
+	assert(slot >= 0 && slot < FSAIO_NENTRY && fsaio_slot[slot].busy);
+	if (fsaio_slot[slot].buf && cqe->cqe_res > 0)
+		memmove(fsaio_slot[slot].buf, FSAIO_DATA(slot), cqe->cqe_res);
+	fsaio_slot[slot].busy = 0;
+	if (tag_store)
+		*tag_store = cqe->cqe_tag;
+	if (res_store)
+		*res_store = cqe->cqe_res;
+	FSAIO->cq_head++;
+	return 1;
+}
+
+// Wait for a completion and reap it, submitting anything still queued.
+// Returns 0 on success, -E_INVAL if no transfer is in flight.
+int
+aio_wait(uint32_t *tag_store, int *res_store)
+{
+	uint32_t tail;
+	int i, r;
+
+	for (i = 0; i < FSAIO_NENTRY && !fsaio_slot[i].busy; i++)
+		;
+	if (fsaio_owner != thisenv->env_id || i == FSAIO_NENTRY)
+		return -E_INVAL;
+	if ((r = aio_submit()) < 0)
+		return r;
+	// The server wakes cq_tail after posting a completion.
+	for (;;) {
+		tail = FSAIO->cq_tail;
+		if (aio_poll(tag_store, res_store))
+			return 0;
+		sys_sleep(&FSAIO->cq_tail, tail, 0);
+	}
 }
 
 
@@ -187,6 +761,8 @@ sync(void)
 	// Ask the file server to update the disk
 	// by writing any dirty blocks in the buffer cache.
 
-	return fsipc(FSREQ_SYNC, NULL);
+	uint32_t words[IPC_NWORDS] = { FSREQ_SYNC };
+
+	return fsipc_short(words);
 }
 
@@ -6,6 +6,8 @@
 // PTE_COW marks copy-on-write page table entries.
 // It is one of the bits explicitly allocated to user processes (PTE_AVAIL).
 #define PTE_COW		0x800
+// PTE_THREAD marks writable pages that sfork shares with our threads.
+#define PTE_THREAD	0x200
 
 // 
 // 常规的page fault handler
@@ -72,6 +74,15 @@ duppage(envid_t envid, unsigned pn)
 		// cprintf("dup share page :%d\n", pn);
 		if ((r = sys_page_map(0, addr, envid, addr, PTE_SYSCALL)) < 0)
 			panic("duppage sys_page_map:%e", r);
+	} else if ((uvpt[pn] & (PTE_W|PTE_THREAD)) == (PTE_W|PTE_THREAD)) {
+		// Our threads write this page, so it must stay writable
+		// here: the child gets its copy now rather than on write.
+		if ((r = sys_page_alloc(0, PFTEMP, PTE_P|PTE_U|PTE_W)) < 0)
+			panic("sys_page_alloc:%e", r);
+		memmove(PFTEMP, addr, PGSIZE);
+		if ((r = sys_page_map(0, PFTEMP, envid, addr, PTE_P|PTE_U|PTE_W)) < 0)
+			panic("sys_page_map:%e", r);
+		sys_page_unmap(0, PFTEMP);
 	} else if (uvpt[pn] & (PTE_W|PTE_COW)) {
 		if ((r = sys_page_map(0, addr, envid, addr, PTE_COW|PTE_U|PTE_P)) < 0)
 			panic("sys_page_map COW:%e", r);
@@ -145,10 +156,84 @@ fork(void)
     return e_id;
 }
 
-// Challenge!
-int
+// Map our page pn into envid at the same address so that both of us
+// see each other's writes.  A copy-on-write page first becomes a
+// private page of ours.
+static int
+sharepage(envid_t envid, unsigned pn)
+{
+	void *addr = (void *) (pn * PGSIZE);
+	int r, perm = uvpt[pn] & PTE_SYSCALL;
+
+	if (perm & PTE_COW) {
+		if ((r = sys_page_alloc(0, PFTEMP, PTE_P|PTE_U|PTE_W)) < 0)
+			return r;
+		memmove(PFTEMP, addr, PGSIZE);
+		r = sys_page_map(0, PFTEMP, 0, addr, PTE_P|PTE_U|PTE_W);
+		sys_page_unmap(0, PFTEMP);
+		if (r < 0)
+			return r;
+		perm = (perm & ~PTE_COW) | PTE_W;
+	}
+	if ((perm & (PTE_W|PTE_SHARE|PTE_THREAD)) == PTE_W) {
+		// Tell a later fork to copy this page, not make it
+		// copy-on-write, which would stop us sharing it.
+		perm |= PTE_THREAD;
+		if ((r = sys_page_map(0, addr, 0, addr, perm)) < 0)
+			return r;
+	}
+	return sys_page_map(0, addr, envid, addr, perm);
+}
+
+// Fork a thread: a child that shares our memory, except for the stack
+// and the thisenv page, which it gets copy-on-write, and the exception
+// stack, which it gets fresh.  Only pages mapped at the time of the
+// sfork are shared; either side's later sys_page_alloc or sys_page_map
+// stays its own, and so does a file it opens later.
+//
+// Returns the child's envid to the parent, 0 to the child, < 0 on error.
+envid_t
 sfork(void)
 {
-	panic("sfork not implemented");
-	return -E_INVAL;
+	extern unsigned char end[];
+	extern void _pgfault_upcall();
+	uintptr_t addr;
+	envid_t e_id;
+	int r;
+
+	set_pgfault_handler(pgfault);
+
+	// Page in whatever of the program is still left to the pager, as
+	// only pages mapped now are shared.
+	for (addr = UTEXT; addr < (uintptr_t) end; addr += PGSIZE)
+		if (!(uvpd[PDX(addr)] & PTE_P) || !(uvpt[PGNUM(addr)] & PTE_P))
+			(void) *(volatile uint8_t *) addr;
+
+	if ((e_id = sys_exofork()) < 0)
+		return e_id;
+	if (e_id == 0) {
+		thisenv = &envs[ENVX(sys_getenvid())];
+		return 0;
+	}
+
+	for (addr = UTEXT; addr < USTACKTOP; addr += PGSIZE) {
+		if (!(uvpd[PDX(addr)] & PTE_P) || !(uvpt[PGNUM(addr)] & PTE_P))
+			continue;
+		if (addr >= UTHREAD)
+			r = duppage(e_id, PGNUM(addr));
+		else
+			r = sharepage(e_id, PGNUM(addr));
+		if (r < 0)
+			goto fail;
+	}
+	if ((r = sys_page_alloc(e_id, (void *) (UXSTACKTOP - PGSIZE),
+				PTE_P|PTE_U|PTE_W)) < 0
+	    || (r = sys_env_set_pgfault_upcall(e_id, _pgfault_upcall)) < 0
+	    || (r = sys_env_set_status(e_id, ENV_RUNNABLE)) < 0)
+		goto fail;
+	return e_id;
+
+fail:
+	sys_env_destroy(e_id);
+	return r;
 }
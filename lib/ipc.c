@@ -14,8 +14,10 @@
 //   用'thisenv'来 发现 发送值，以及 发送方
 // 	 如果'pg'是空的，那么 给 sys_ipc_recv 传递一个值(UTOP)，使得 调用者 知道 是“no page”
 //   (0不是一个 正确的值的选项，因为 它是一个合法的 能够映射 物理页的 虚拟地址的位置。)
+//
+// If us is not 0, give up after us microseconds and return -E_TIMEOUT.
 int32_t
-ipc_recv(envid_t *from_env_store, void *pg, int *perm_store)
+ipc_recv_timeout(envid_t *from_env_store, void *pg, int *perm_store, uint32_t us)
 {
 	// LAB 4: Your code here.
 	// panic("ipc_recv not implemented");
@@ -23,7 +25,7 @@ ipc_recv(envid_t *from_env_store, void *pg, int *perm_store)
 		pg = (void *)UTOP;//
 	}
 
-    int r = sys_ipc_recv(pg);
+    int r = us ? sys_ipc_recv_timeout(pg, us) : sys_ipc_recv(pg);
     int from_env = 0, perm = 0;
     if (r == 0) {
         from_env = thisenv->env_ipc_from;
@@ -44,14 +46,31 @@ ipc_recv(envid_t *from_env_store, void *pg, int *perm_store)
     return r;
 }
 
+int32_t
+ipc_recv(envid_t *from_env_store, void *pg, int *perm_store)
+{
+	return ipc_recv_timeout(from_env_store, pg, perm_store, 0);
+}
+
+// Sleep until to_env's message queue has room.  The kernel wakes the
+// word when to_env takes a message off a full queue, or dies.
+static void
+ipc_wait_room(envid_t to_env)
+{
+	sys_sleep(&envs[ENVX(to_env)].env_ipc_qlen, IPC_QUEUE_MAX, 0);
+}
+
 // 把值val发送给to_env对应的进程(以及pg(srcva)对应的物理页，权限为perm)
 // 这个函数 会一直尝试，直到 成功发送
-// 除了-E_IP_NOT_RECV的错误 都要抛出异常panic()
+// 除了-E_IPC_QUEUE_FULL的错误 都要抛出异常panic()
 // 
 // 提示：
 // 	 使用sys_yield()来 变得CPU-friendly
-//   如果pg是空的，那么 把pg设为某个值(UTOP) 使得 sys_ipc_try_send知道 意味着no page
+//   如果pg是空的，那么 把pg设为某个值(UTOP) 使得 sys_ipc_send知道 意味着no page
 //   (0 不是那个正确的值)
+//
+// The message is queued if to_env is not receiving, so this only
+// waits while to_env's queue is full.
 void
 ipc_send(envid_t to_env, uint32_t val, void *pg, int perm)
 {
@@ -61,14 +80,88 @@ ipc_send(envid_t to_env, uint32_t val, void *pg, int perm)
 	if (pg == NULL) pg = (void *)UTOP;
 
     int ret;
-    while ((ret = sys_ipc_try_send(to_env, val, pg, perm))) {// 一直尝试发送 直到成功
-        if (ret != -E_IPC_NOT_RECV){
+    while ((ret = sys_ipc_send(to_env, val, pg, perm))) {// 一直尝试发送 直到成功
+        if (ret != -E_IPC_QUEUE_FULL){
 			panic("ipc_send error %e", ret);
 		}
-        sys_yield();
+		ipc_wait_room(to_env);
     }
 }
 
+// Fill in what ipc_recv returns from the outcome r of a receive.
+static int32_t
+ipc_result(int r, envid_t *from_env_store, int *perm_store)
+{
+	if (from_env_store)
+		*from_env_store = r < 0 ? 0 : thisenv->env_ipc_from;
+	if (perm_store)
+		*perm_store = r < 0 ? 0 : thisenv->env_ipc_perm;
+	return r < 0 ? r : thisenv->env_ipc_value;
+}
+
+// Send val (and pg, with perm) to to_env as ipc_send does, then wait
+// for its reply, which nothing else can get in ahead of.  The reply is
+// returned as ipc_recv returns a message, with any page mapped at
+// dstpg.
+int32_t
+ipc_call(envid_t to_env, uint32_t val, void *pg, int perm,
+	 void *dstpg, int *perm_store)
+{
+	int r;
+
+	if (pg == NULL)
+		pg = (void *) UTOP;
+	if (dstpg == NULL)
+		dstpg = (void *) UTOP;
+	while ((r = sys_ipc_call(to_env, val, pg, perm, dstpg)) == -E_IPC_QUEUE_FULL)
+		ipc_wait_room(to_env);
+	if (r < 0)
+		panic("ipc_call error %e", r);
+	return ipc_result(r, NULL, perm_store);
+}
+
+// Reply val (and pg, with perm) to to_env, which must be waiting for
+// it in ipc_call, then receive the next message as ipc_recv does.
+// With to_env 0, just receive.  If the reply fails, nothing is
+// received: the error is returned and *from_env_store set to 0.
+int32_t
+ipc_reply_recv(envid_t to_env, uint32_t val, void *pg, int perm,
+	       envid_t *from_env_store, void *dstpg, int *perm_store)
+{
+	if (pg == NULL)
+		pg = (void *) UTOP;
+	if (dstpg == NULL)
+		dstpg = (void *) UTOP;
+	return ipc_result(sys_ipc_reply_recv(to_env, val, pg, perm, dstpg),
+			  from_env_store, perm_store);
+}
+
+// Send the IPC_NWORDS words to to_env as a short message, which goes in
+// registers rather than on a page, and wait for its reply, as ipc_call
+// does.  The reply's words replace words, and its value, words[0], is
+// returned.  The receiver finds the words in thisenv->env_ipc_words.
+int32_t
+ipc_call_short(envid_t to_env, uint32_t *words)
+{
+	int r;
+
+	while ((r = sys_ipc_call_short(to_env, words)) == -E_IPC_QUEUE_FULL)
+		ipc_wait_room(to_env);
+	if (r < 0)
+		panic("ipc_call_short error %e", r);
+	return words[0];
+}
+
+// Like ipc_reply_recv, but reply with the short message in words.  The
+// next message is received at the same page address as the last one.
+int32_t
+ipc_reply_recv_short(envid_t to_env, const uint32_t *words,
+		     envid_t *from_env_store, int *perm_store)
+{
+	return ipc_result(sys_ipc_reply_recv_short(to_env, words),
+			  from_env_store, perm_store);
+}
+
 // Find the first environment of the given type.  We'll use this to
 // find special environments.
 // Returns 0 if no such environment exists.
@@ -5,7 +5,6 @@
 
 extern void umain(int argc, char **argv);
 
-const volatile struct Env *thisenv;
 const char *binaryname = "<unknown>";
 
 void
@@ -13,6 +12,10 @@ libmain(int argc, char **argv)
 {
 	// set thisenv to point at our Env structure in envs[].
 	// LAB 3: Your code here.
+	int r;
+
+	if ((r = sys_page_alloc(0, (void *) UTHREAD, PTE_P|PTE_U|PTE_W)) < 0)
+		panic("libmain: cannot allocate the thisenv page: %e", r);
 	thisenv = &envs[ENVX(sys_getenvid())];
 	// envid的低10位就是在envs数组中的index值
 
@@ -1,4 +1,5 @@
 #include <inc/lib.h>
+#include <inc/x86.h>
 
 #define debug 0
 
@@ -23,6 +24,14 @@ struct Pipe {
 	off_t p_rpos;		// read position
 	off_t p_wpos;		// write position
 	uint8_t p_buf[PIPEBUFSIZ];	// data buffer
+
+	// A reader or writer with nothing to do sleeps on p_seq, which
+	// every change to the fields above bumps.  Sleepers set
+	// p_sleeping first, so the change is followed by a sys_wakeup.
+	// The other end closing wakes them too, as the kernel wakes
+	// sleepers on a page when it loses a reference.
+	volatile uint32_t p_seq;
+	volatile uint32_t p_sleeping;
 };
 
 int
@@ -72,17 +81,22 @@ pipe(int pfd[2])
 	return r;
 }
 
+// Whether the other end of the pipe is gone.  If ref is not NULL, the
+// reference count of p the answer was based on is stored there.
 static int
-_pipeisclosed(struct Fd *fd, struct Pipe *p)
+_pipeisclosed(struct Fd *fd, struct Pipe *p, int *ref)
 {
-	int n, nn, ret;
+	int n, nn, ret, pref;
 
 	while (1) {
 		n = thisenv->env_runs;
-		ret = pageref(fd) == pageref(p);
+		ret = pageref(fd) == (pref = pageref(p));
 		nn = thisenv->env_runs;
-		if (n == nn)
+		if (n == nn) {
+			if (ref)
+				*ref = pref;
 			return ret;
+		}
 		if (n != nn && ret == 1)
 			cprintf("pipe race avoided\n", n, thisenv->env_runs, ret);
 	}
@@ -98,7 +112,36 @@ pipeisclosed(int fdnum)
 	if ((r = fd_lookup(fdnum, &fd)) < 0)
 		return r;
 	p = (struct Pipe*) fd2data(fd);
-	return _pipeisclosed(fd, p);
+	return _pipeisclosed(fd, p, NULL);
+}
+
+// The pipe's sequence number, read before the state it vouches for.
+static uint32_t
+pipe_seq(struct Pipe *p)
+{
+	uint32_t seq = p->p_seq;
+
+	asm volatile("" : : : "memory");
+	return seq;
+}
+
+// Note a change to the pipe, waking whoever sleeps in pipe_sleep.
+static void
+pipe_changed(struct Pipe *p)
+{
+	p->p_seq++;
+	// xchg also keeps the bump from passing the check of p_sleeping.
+	if (xchg(&p->p_sleeping, 0))
+		sys_wakeup(&p->p_seq, 0);
+}
+
+// Sleep until the pipe changes from how it was at sequence number seq,
+// or p loses one of the ref references it had then.
+static void
+pipe_sleep(struct Pipe *p, uint32_t seq, int ref)
+{
+	p->p_sleeping = 1;
+	sys_sleep(&p->p_seq, seq, ref);
 }
 
 static ssize_t
@@ -106,6 +149,9 @@ devpipe_read(struct Fd *fd, void *vbuf, size_t n)
 {
 	uint8_t *buf;
 	size_t i;
+	ssize_t r;
+	uint32_t seq;
+	int ref;
 	struct Pipe *p;
 
 	p = (struct Pipe*)fd2data(fd);
@@ -115,24 +161,27 @@ devpipe_read(struct Fd *fd, void *vbuf, size_t n)
 
 	buf = vbuf;
 	for (i = 0; i < n; i++) {
-		while (p->p_rpos == p->p_wpos) {
+		while (seq = pipe_seq(p), p->p_rpos == p->p_wpos) {
 			// pipe is empty
 			// if we got any data, return it
 			if (i > 0)
-				return i;
+				goto out;
 			// if all the writers are gone, note eof
-			if (_pipeisclosed(fd, p))
+			if (_pipeisclosed(fd, p, &ref))
 				return 0;
-			// yield and see what happens
+			// sleep until something happens
 			if (debug)
-				cprintf("devpipe_read yield\n");
-			sys_yield();
+				cprintf("devpipe_read sleep\n");
+			pipe_sleep(p, seq, ref);
 		}
 		// there's a byte.  take it.
 		// wait to increment rpos until the byte is taken!
 		buf[i] = p->p_buf[p->p_rpos % PIPEBUFSIZ];
 		p->p_rpos++;
 	}
+out:
+	// make room for a waiting writer
+	pipe_changed(p);
 	return i;
 }
 
@@ -140,7 +189,9 @@ static ssize_t
 devpipe_write(struct Fd *fd, const void *vbuf, size_t n)
 {
 	const uint8_t *buf;
-	size_t i;
+	size_t i, told;
+	uint32_t seq;
+	int ref;
 	struct Pipe *p;
 
 	p = (struct Pipe*) fd2data(fd);
@@ -149,18 +200,24 @@ devpipe_write(struct Fd *fd, const void *vbuf, size_t n)
 			thisenv->env_id, uvpt[PGNUM(p)], n, p->p_rpos, p->p_wpos);
 
 	buf = vbuf;
-	for (i = 0; i < n; i++) {
-		while (p->p_wpos >= p->p_rpos + sizeof(p->p_buf)) {
+	for (i = told = 0; i < n; i++) {
+		while (seq = pipe_seq(p), p->p_wpos >= p->p_rpos + sizeof(p->p_buf)) {
 			// pipe is full
 			// if all the readers are gone
 			// (it's only writers like us now),
 			// note eof
-			if (_pipeisclosed(fd, p))
+			if (_pipeisclosed(fd, p, &ref))
 				return 0;
-			// yield and see what happens
+			// let the reader at what we have written
+			if (told < i) {
+				told = i;
+				pipe_changed(p);
+				continue;
+			}
+			// sleep until something happens
 			if (debug)
-				cprintf("devpipe_write yield\n");
-			sys_yield();
+				cprintf("devpipe_write sleep\n");
+			pipe_sleep(p, seq, ref);
 		}
 		// there's room for a byte.  store it.
 		// wait to increment wpos until the byte is stored!
@@ -168,6 +225,8 @@ devpipe_write(struct Fd *fd, const void *vbuf, size_t n)
 		p->p_wpos++;
 	}
 
+	if (told < i)
+		pipe_changed(p);
 	return i;
 }
 
@@ -28,6 +28,9 @@ static const char * const error_string[MAXERROR] =
 	[E_FAULT]	= "segmentation fault",
 	[E_IPC_NOT_RECV]= "env is not recving",
 	[E_EOF]		= "unexpected end of file",
+	[E_AGAIN]	= "try again",
+	[E_IPC_QUEUE_FULL] = "env's message queue is full",
+	[E_TIMEOUT]	= "timed out",
 	[E_NO_DISK]	= "no free space on disk",
 	[E_MAX_OPEN]	= "too many files are open",
 	[E_NOT_FOUND]	= "file or block not found",
@@ -8,16 +8,52 @@
 // Helper functions for spawn.
 static int init_stack(envid_t child, const char **argv, uintptr_t *init_esp);
 static int map_segment(envid_t child, uintptr_t va, size_t memsz,
-		       int fd, size_t filesz, off_t fileoffset, int perm);
+		       int fd, size_t filesz, off_t fileoffset, int perm,
+		       bool share);
 static int copy_shared_pages(envid_t child);
+static int demand_segments(envid_t child, int fd, struct Elf *elf);
+static envid_t spawn_image(const char *prog, const char **argv, int load);
+
+// How spawn_image loads the program
+enum {
+	LOAD_LAZY,	// paged in on demand
+	LOAD_SHARED,	// up front, sharing text with the block cache
+	LOAD_COPY,	// up front, copying every page
+};
 
 // Spawn a child process from a program image loaded from the file system.
 // prog: the pathname of the program to run.
 // argv: pointer to null-terminated array of pointers to strings,
 // 	 which will be passed to the child as its command-line arguments.
 // Returns child envid on success, < 0 on failure.
-int
+//
+// The program is paged in on demand: the file server maps each page
+// in when the child first touches it, so pages that are never used
+// are never read.
+envid_t
 spawn(const char *prog, const char **argv)
+{
+	return spawn_image(prog, argv, LOAD_LAZY);
+}
+
+// Like spawn, but load the whole program before the child runs.
+envid_t
+spawn_eager(const char *prog, const char **argv)
+{
+	return spawn_image(prog, argv, LOAD_SHARED);
+}
+
+// Like spawn_eager, but give the child a copy of every page, text
+// included, as spawn did before it shared text with the block cache.
+// Kept for comparison.
+envid_t
+spawn_copy(const char *prog, const char **argv)
+{
+	return spawn_image(prog, argv, LOAD_COPY);
+}
+
+static envid_t
+spawn_image(const char *prog, const char **argv, int load)
 {
 	unsigned char elf_buf[512];
 	struct Trapframe child_tf;
@@ -110,17 +146,26 @@ spawn(const char *prog, const char **argv)
 	if ((r = init_stack(child, argv, &child_tf.tf_esp)) < 0)
 		return r;
 
-	// Set up program segments as defined in ELF header.
-	ph = (struct Proghdr*) (elf_buf + elf->e_phoff);
-	for (i = 0; i < elf->e_phnum; i++, ph++) {
-		if (ph->p_type != ELF_PROG_LOAD)
-			continue;
-		perm = PTE_P | PTE_U;
-		if (ph->p_flags & ELF_PROG_FLAG_WRITE)
-			perm |= PTE_W;
-		if ((r = map_segment(child, ph->p_va, ph->p_memsz,
-				     fd, ph->p_filesz, ph->p_offset, perm)) < 0)
-			goto error;
+	// The child inherited our pager, if we have one, along with
+	// the rest of our env; it must not page in our program.
+	if ((r = sys_env_set_pager(child, 0, 0, 0)) < 0)
+		goto error;
+
+	// Have the file server page the program in as the child touches
+	// it, or else set up program segments as defined in ELF header.
+	if (load != LOAD_LAZY || demand_segments(child, fd, elf) < 0) {
+		ph = (struct Proghdr*) (elf_buf + elf->e_phoff);
+		for (i = 0; i < elf->e_phnum; i++, ph++) {
+			if (ph->p_type != ELF_PROG_LOAD)
+				continue;
+			perm = PTE_P | PTE_U;
+			if (ph->p_flags & ELF_PROG_FLAG_WRITE)
+				perm |= PTE_W;
+			if ((r = map_segment(child, ph->p_va, ph->p_memsz,
+					     fd, ph->p_filesz, ph->p_offset, perm,
+					     load != LOAD_COPY)) < 0)
+				goto error;
+		}
 	}
 	close(fd);
 	fd = -1;
@@ -260,9 +305,65 @@ error:
 	return r;
 }
 
+// Register the program's loadable segments with the file server and
+// make it the child's pager for the range they cover.
+// Returns 0 on success, < 0 if the program must be loaded up front.
+static int
+demand_segments(envid_t child, int fd, struct Elf *elf)
+{
+	struct Fspager_seg seg[FSPAGER_NSEG];
+	struct Proghdr *ph;
+	uintptr_t lo, hi;
+	int i, n, r;
+
+	lo = UTOP;
+	hi = 0;
+	ph = (struct Proghdr*) ((uint8_t*) elf + elf->e_phoff);
+	for (i = n = 0; i < elf->e_phnum; i++, ph++) {
+		if (ph->p_type != ELF_PROG_LOAD)
+			continue;
+		if (n == FSPAGER_NSEG)
+			return -E_INVAL;
+		seg[n].ps_va = ph->p_va;
+		seg[n].ps_memsz = ph->p_memsz;
+		seg[n].ps_filesz = ph->p_filesz;
+		seg[n].ps_offset = ph->p_offset;
+		seg[n].ps_perm = PTE_P | PTE_U;
+		if (ph->p_flags & ELF_PROG_FLAG_WRITE)
+			seg[n].ps_perm |= PTE_W;
+		lo = MIN(lo, ROUNDDOWN(ph->p_va, PGSIZE));
+		hi = MAX(hi, ROUNDUP(ph->p_va + ph->p_memsz, PGSIZE));
+		n++;
+	}
+	if ((r = file_pager(fd, child, seg, n)) < 0)
+		return r;
+	return sys_env_set_pager(child, ipc_find_env(ENV_TYPE_FS), lo, hi);
+}
+
+// Map the block cache page holding file offset 'fileoffset' of fd
+// read-only into the child at va.  Returns 0 on success, < 0 if the
+// page cannot be shared and has to be copied instead.
+static int
+share_page(envid_t child, uintptr_t va, int fdnum, off_t fileoffset)
+{
+	struct Fd *fd;
+	char *blk;
+	int r;
+
+	if ((r = fd_lookup(fdnum, &fd)) < 0)
+		return r;
+	if (fd->fd_dev_id != devfile.dev_id || fileoffset % BLKSIZE != 0)
+		return -E_INVAL;
+	if ((r = file_mapblock(fd->fd_file.id, fileoffset, &blk)) <= 0)
+		return r < 0 ? r : -E_INVAL;
+	r = sys_page_map(0, ROUNDDOWN(blk, PGSIZE), child, (void*) va, PTE_P|PTE_U);
+	file_unmapblock();
+	return r;
+}
+
 static int
 map_segment(envid_t child, uintptr_t va, size_t memsz,
-	int fd, size_t filesz, off_t fileoffset, int perm)
+	int fd, size_t filesz, off_t fileoffset, int perm, bool share)
 {
 	int i, r;
 	void *blk;
@@ -281,6 +382,14 @@ map_segment(envid_t child, uintptr_t va, size_t memsz,
 			// allocate a blank page
 			if ((r = sys_page_alloc(child, (void*) (va + i), perm)) < 0)
 				return r;
+		} else if (share && !(perm & PTE_W) && i + PGSIZE <= filesz
+			   && share_page(child, va + i, fd, fileoffset + i) == 0) {
+			// Read-only pages that the file fills completely are
+			// shared with the file server's block cache, and so
+			// with every other process running the same program.
+			// The server copies a cache page before writing to it
+			// while we have it mapped.  A final partial page is
+			// copied below, so what follows filesz reads as zero.
 		} else {
 			// from file
 			if ((r = sys_page_alloc(0, UTEMP, PTE_P|PTE_U|PTE_W)) < 0)
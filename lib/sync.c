@@ -0,0 +1,130 @@
+// Mutexes, condition variables and semaphores for environments that
+// share memory.
+//
+// All three are futexes: the uncontended cases are a single atomic
+// instruction, and only a waiter that has to block enters the kernel,
+// to sleep on the object's word with sys_sleep.  Wait queues are keyed
+// by physical address, so the sleeper and the environment that wakes
+// it with sys_wakeup need not map the word at the same address.
+// sys_sleep refuses to sleep if the word has changed since the caller
+// looked, so a wakeup that races with going to sleep is never lost.
+
+#include <inc/lib.h>
+#include <inc/x86.h>
+
+void
+mutex_init(struct Mutex *m)
+{
+	m->m_state = 0;
+}
+
+// Take m as a waiter: leave it marked contended, as there may be
+// other sleepers for unlock to wake.
+static void
+mutex_lock_contended(struct Mutex *m)
+{
+	while (xchg(&m->m_state, 2) != 0)
+		sys_sleep(&m->m_state, 2, 0);
+}
+
+void
+mutex_lock(struct Mutex *m)
+{
+	if (cmpxchg(&m->m_state, 0, 1) != 0)
+		mutex_lock_contended(m);
+}
+
+// Take m if it is free.  Returns whether we got it.
+bool
+mutex_trylock(struct Mutex *m)
+{
+	return cmpxchg(&m->m_state, 0, 1) == 0;
+}
+
+void
+mutex_unlock(struct Mutex *m)
+{
+	if (xchg(&m->m_state, 0) == 2)
+		sys_wakeup(&m->m_state, 1);
+}
+
+void
+cond_init(struct Cond *c)
+{
+	c->c_seq = 0;
+	c->c_nwait = 0;
+}
+
+// Release m, wait for c to be signalled, and take m again.  Wakeups
+// can be spurious, so callers recheck their condition in a loop.
+void
+cond_wait(struct Cond *c, struct Mutex *m)
+{
+	uint32_t seq;
+
+	xadd(&c->c_nwait, 1);
+	seq = c->c_seq;
+	mutex_unlock(m);
+	sys_sleep(&c->c_seq, seq, 0);
+	xadd(&c->c_nwait, -1);
+	mutex_lock_contended(m);
+}
+
+// Wake one environment waiting on c.
+void
+cond_signal(struct Cond *c)
+{
+	xadd(&c->c_seq, 1);
+	if (c->c_nwait)
+		sys_wakeup(&c->c_seq, 1);
+}
+
+// Wake every environment waiting on c.
+void
+cond_broadcast(struct Cond *c)
+{
+	xadd(&c->c_seq, 1);
+	if (c->c_nwait)
+		sys_wakeup(&c->c_seq, 0);
+}
+
+void
+sem_init(struct Sem *s, uint32_t count)
+{
+	s->s_count = count;
+	s->s_nwait = 0;
+}
+
+// Take one from s if it is not zero.  Returns whether we did.
+bool
+sem_trywait(struct Sem *s)
+{
+	uint32_t c;
+
+	while ((c = s->s_count) > 0)
+		if (cmpxchg(&s->s_count, c, c - 1) == c)
+			return 1;
+	return 0;
+}
+
+// Take one from s, waiting while it is zero.
+void
+sem_wait(struct Sem *s)
+{
+	while (!sem_trywait(s)) {
+		// Count ourselves before the kernel looks at s_count, so
+		// that sem_post either sees us or we see its increment.
+		xadd(&s->s_nwait, 1);
+		sys_sleep(&s->s_count, 0, 0);
+		xadd(&s->s_nwait, -1);
+	}
+}
+
+// Add one to s, waking a waiter if there is one.
+void
+sem_post(struct Sem *s)
+{
+	xadd(&s->s_count, 1);
+	if (s->s_nwait)
+		sys_wakeup(&s->s_count, 1);
+}
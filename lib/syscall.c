@@ -113,3 +113,136 @@ sys_ipc_recv(void *dstva)
 	return syscall(SYS_ipc_recv, 1, (uint32_t)dstva, 0, 0, 0, 0);
 }
 
+
+int
+sys_ipc_recv_timeout(void *dstva, uint32_t us)
+{
+	return syscall(SYS_ipc_recv_timeout, 1, (uint32_t)dstva, us, 0, 0, 0);
+}
+
+int
+sys_ipc_recv_nb(void *dstva)
+{
+	return syscall(SYS_ipc_recv_nb, 1, (uint32_t)dstva, 0, 0, 0, 0);
+}
+
+int
+sys_env_set_pager(envid_t envid, envid_t pagerid, uintptr_t lo, uintptr_t hi)
+{
+	return syscall(SYS_env_set_pager, 1, envid, pagerid, lo, hi, 0);
+}
+
+int
+sys_env_set_priority(envid_t envid, int prio)
+{
+	return syscall(SYS_env_set_priority, 1, envid, prio, 0, 0, 0);
+}
+
+int
+sys_env_set_tickets(envid_t envid, uint32_t tickets)
+{
+	return syscall(SYS_env_set_tickets, 1, envid, tickets, 0, 0, 0);
+}
+
+int
+sys_env_set_affinity(envid_t envid, uint32_t mask)
+{
+	return syscall(SYS_env_set_affinity, 1, envid, mask, 0, 0, 0);
+}
+
+int
+sys_sleep(const volatile void *va, uint32_t val, int ref)
+{
+	return syscall(SYS_sleep, 0, (uint32_t) va, val, ref, 0, 0);
+}
+
+int
+sys_wakeup(const volatile void *va, int n)
+{
+	return syscall(SYS_wakeup, 0, (uint32_t) va, n, 0, 0, 0);
+}
+
+void
+sys_env_exit(int status)
+{
+	syscall(SYS_env_exit, 0, status, 0, 0, 0, 0);
+}
+
+int
+sys_env_wait(envid_t envid)
+{
+	return syscall(SYS_env_wait, 0, envid, 0, 0, 0, 0);
+}
+
+int
+sys_ipc_call(envid_t envid, uint32_t value, void *srcva, int perm, void *dstva)
+{
+	return syscall(SYS_ipc_call, 0, envid, value, (uint32_t) srcva, perm,
+		       (uint32_t) dstva);
+}
+
+int
+sys_ipc_reply_recv(envid_t envid, uint32_t value, void *srcva, int perm,
+		   void *dstva)
+{
+	return syscall(SYS_ipc_reply_recv, 0, envid, value, (uint32_t) srcva,
+		       perm, (uint32_t) dstva);
+}
+
+int
+sys_ipc_send(envid_t envid, uint32_t value, void *srcva, int perm)
+{
+	return syscall(SYS_ipc_send, 0, envid, value, (uint32_t) srcva, perm, 0);
+}
+
+int
+sys_ipc_try_send_short(envid_t envid, const uint32_t *words)
+{
+	return syscall(SYS_ipc_try_send_short, 0, envid,
+		       words[0], words[1], words[2], words[3]);
+}
+
+// The reply comes back in the registers the request went out in, so
+// unlike the other calls this one lets them change.
+int
+sys_ipc_call_short(envid_t envid, uint32_t *words)
+{
+	int32_t ret;
+
+	asm volatile("int %5\n"
+		     : "=a" (ret),
+		       "+c" (words[0]),
+		       "+b" (words[1]),
+		       "+D" (words[2]),
+		       "+S" (words[3])
+		     : "i" (T_SYSCALL),
+		       "0" (SYS_ipc_call_short),
+		       "d" (envid)
+		     : "cc", "memory");
+	return ret;
+}
+
+int
+sys_ipc_reply_recv_short(envid_t envid, const uint32_t *words)
+{
+	return syscall(SYS_ipc_reply_recv_short, 0, envid,
+		       words[0], words[1], words[2], words[3]);
+}
+
+int
+sys_notify(envid_t envid, uint32_t bits)
+{
+	return syscall(SYS_notify, 0, envid, bits, 0, 0, 0);
+}
+
+int
+sys_notify_wait(uint32_t mask)
+{
+	return syscall(SYS_notify_wait, 0, mask, 0, 0, 0, 0);
+}
+
+int
+sys_irq_bind(int irq, int bit)
+{
+	return syscall(SYS_irq_bind, 0, irq, bit, 0, 0, 0);
+}
@@ -0,0 +1,36 @@
+// Threads: environments made with sfork, which share the program's
+// memory and the file descriptors open at the time, but each run on a
+// stack of their own.  A file opened later is mapped only in the
+// thread that opened it.
+// A thread is named by its envid.  Synchronize threads with the
+// mutexes, condition variables and semaphores of sync.c.
+
+#include <inc/lib.h>
+
+// Start a thread running fn(arg); fn's return value is the thread's
+// exit status.  Returns the thread's envid, < 0 on error.
+envid_t
+uthread_create(int (*fn)(void *), void *arg)
+{
+	envid_t t;
+
+	if ((t = sfork()) != 0)
+		return t;
+	uthread_exit(fn(arg));
+}
+
+// Wait for thread t to exit.  Returns its exit status, as for wait().
+int
+uthread_join(envid_t t)
+{
+	return wait(t);
+}
+
+// Exit the calling thread with status.  Unlike exit(), this leaves the
+// file descriptors open, as other threads may share them.
+void
+uthread_exit(int status)
+{
+	sys_env_exit(status);
+	panic("uthread_exit: still running");
+}
@@ -1,13 +1,12 @@
 #include <inc/lib.h>
 
 // Waits until 'envid' exits.
-void
+// Returns its exit status, as given to exit_status() (0 for exit()) or
+// ENV_EXIT_KILLED if it was destroyed; < 0 if there is no such
+// environment any more.
+int
 wait(envid_t envid)
 {
-	const volatile struct Env *e;
-
 	assert(envid != 0);
-	e = &envs[ENVX(envid)];
-	while (e->env_id == envid && e->env_status != ENV_FREE)
-		sys_yield();
+	return sys_env_wait(envid);
 }
@@ -0,0 +1,65 @@
+// Compare one-way message throughput between two environments: a
+// shared-memory channel, which only enters the kernel when a side has
+// to wait, against ipc_send and ipc_recv, which enter it for every
+// message.  Times are in cycles per message as the receiver sees them,
+// from the first message to the last.
+
+#include <inc/lib.h>
+#include <inc/x86.h>
+
+#define NCHAN		100000
+#define NIPC		10000
+#define CHANVA		((struct Chan *) 0x90000000)
+#define CHANBIT		3
+
+void
+umain(int argc, char **argv)
+{
+	uint32_t i, v, pwaits, cwaits, chancycles, ipccycles;
+	uint64_t t = 0;
+	envid_t child, from;
+	int r;
+
+	// Channel
+	if ((r = chan_create(CHANVA, CHANBIT)) < 0)
+		panic("chan_create: %e", r);
+	if ((child = fork()) < 0)
+		panic("fork: %e", child);
+	if (child == 0) {
+		for (i = 0; i < NCHAN; i++)
+			chan_send(CHANVA, i);
+		exit();
+	}
+	for (i = 0; i < NCHAN; i++) {
+		if ((v = chan_recv(CHANVA)) != i)
+			panic("channel message %u is %u", i, v);
+		if (i == 0)
+			t = read_tsc();
+	}
+	chancycles = (read_tsc() - t) / (NCHAN - 1);
+	chan_stat(CHANVA, &pwaits, &cwaits);
+	wait(child);
+
+	// IPC
+	if ((child = fork()) < 0)
+		panic("fork: %e", child);
+	if (child == 0) {
+		for (i = 0; i < NIPC; i++)
+			ipc_send(thisenv->env_parent_id, i, NULL, 0);
+		exit();
+	}
+	for (i = 0; i < NIPC; i++) {
+		if ((v = ipc_recv(&from, NULL, NULL)) != i || from != child)
+			panic("ipc message %u is %u from %08x", i, v, from);
+		if (i == 0)
+			t = read_tsc();
+	}
+	ipccycles = (read_tsc() - t) / (NIPC - 1);
+	wait(child);
+
+	cprintf("chanbench: channel: %u messages, %u cycles each, waits: %u producer, %u consumer\n",
+		NCHAN, chancycles, pwaits, cwaits);
+	cprintf("chanbench: ipc: %u messages, %u cycles each\n",
+		NIPC, ipccycles);
+	cprintf("chanbench is good\n");
+}
@@ -73,8 +73,10 @@ dumbfork(void) // 这是用户程序定义的fork(),它会产生一个 和父进
 	for (addr = (uint8_t*) UTEXT; addr < end; addr += PGSIZE)
 		duppage(envid, addr);
 
-	// Also copy the stack we are currently running on.
+	// Also copy the stack we are currently running on, and the page
+	// that holds thisenv.
 	duppage(envid, ROUNDDOWN(&addr, PGSIZE));
+	duppage(envid, (void *) UTHREAD);
 
 	// Start the child environment running
 	if ((r = sys_env_set_status(envid, ENV_RUNNABLE)) < 0)
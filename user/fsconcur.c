@@ -0,0 +1,103 @@
+// Benchmark the file server with several clients at once: one client
+// streams files the block cache has not seen yet while the others
+// hammer a small cached file.  With requests served concurrently the
+// cached clients should not wait behind the disk.
+
+#include <inc/lib.h>
+#include <inc/x86.h>
+
+#define NFAST	4
+#define NITER	200
+
+const char *slowfiles[] = {
+	"/sh", "/cat", "/ls", "/lsfd", "/num", "/forktree", "/primes",
+	"/primespipe", "/testshell", "/testpteshare", "/testfdsharing",
+};
+
+char buf[PGSIZE];
+
+static void
+fill(char *p, int seed)
+{
+	int i;
+
+	for (i = 0; i < PGSIZE; i++)
+		p[i] = seed + i * 7;
+}
+
+static void
+fast_client(int id)
+{
+	uint64_t t, dt, total = 0, max = 0;
+	char want[PGSIZE];
+	struct Stat st;
+	int f, i, r;
+
+	fill(want, 0);
+	if ((f = open("/concur", O_RDONLY|O_DIRECT)) < 0)
+		panic("open /concur: %e", f);
+	for (i = 0; i < NITER; i++) {
+		t = read_tsc();
+		if ((r = fstat(f, &st)) < 0)
+			panic("fstat: %e", r);
+		if ((r = seek(f, 0)) < 0 || (r = readn(f, buf, PGSIZE)) != PGSIZE)
+			panic("read /concur: %d", r);
+		dt = read_tsc() - t;
+		total += dt;
+		if (dt > max)
+			max = dt;
+		if (st.st_size != PGSIZE || memcmp(buf, want, PGSIZE) != 0)
+			panic("fast client %d: bad data", id);
+	}
+	close(f);
+	cprintf("fast client %d: %d requests, avg %u max %u cycles\n",
+		id, NITER * 2, (uint32_t) (total / (NITER * 2)), (uint32_t) max);
+}
+
+static void
+slow_client(void)
+{
+	uint64_t t;
+	int f, i, n, r;
+
+	t = read_tsc();
+	for (i = n = 0; i < ARRAY_SIZE(slowfiles); i++) {
+		if ((f = open(slowfiles[i], O_RDONLY|O_DIRECT)) < 0)
+			continue;
+		while ((r = read(f, buf, PGSIZE)) > 0)
+			n += r;
+		close(f);
+	}
+	cprintf("slow client: %d bytes from disk in %u cycles\n",
+		n, (uint32_t) (read_tsc() - t));
+}
+
+void
+umain(int argc, char **argv)
+{
+	envid_t kids[NFAST + 1];
+	int f, i, r;
+
+	fill(buf, 0);
+	if ((f = open("/concur", O_RDWR|O_CREAT|O_TRUNC)) < 0)
+		panic("open /concur: %e", f);
+	if ((r = write(f, buf, PGSIZE)) != PGSIZE)
+		panic("write /concur: %d", r);
+	close(f);
+
+	for (i = 0; i <= NFAST; i++) {
+		if ((r = fork()) < 0)
+			panic("fork: %e", r);
+		if (r == 0) {
+			if (i == NFAST)
+				slow_client();
+			else
+				fast_client(i);
+			exit();
+		}
+		kids[i] = r;
+	}
+	for (i = 0; i <= NFAST; i++)
+		wait(kids[i]);
+	cprintf("fsconcur is good\n");
+}
@@ -0,0 +1,68 @@
+// Measure IPC round trips: between this environment and a forked echo
+// child, with page-less messages and with short calls, whose words go
+// in registers, and stat requests to the file server, which are short
+// calls too.  All are a send followed straight away by a receive,
+// which is where the kernel hands the CPU directly to the receiver.
+
+#include <inc/lib.h>
+#include <inc/x86.h>
+
+#define NTRIP	1000
+#define NSTAT	500
+
+void
+umain(int argc, char **argv)
+{
+	uint64_t t, tripcycles, shortcycles, statcycles;
+	uint32_t v, w[IPC_NWORDS];
+	struct Stat st;
+	envid_t kid, who;
+	int i, r;
+
+	if ((kid = fork()) < 0)
+		panic("fork: %e", kid);
+	if (kid == 0) {
+		v = ipc_recv(&who, 0, 0);
+		while (v != ~0U) {
+			if (!thisenv->env_ipc_nwords) {
+				ipc_send(who, v + 1, 0, 0);
+				v = ipc_recv(&who, 0, 0);
+				continue;
+			}
+			for (i = 0; i < IPC_NWORDS; i++)
+				w[i] = thisenv->env_ipc_words[i] + 1;
+			v = ipc_reply_recv_short(who, w, &who, NULL);
+		}
+		return;
+	}
+
+	t = read_tsc();
+	for (i = 0; i < NTRIP; i++) {
+		ipc_send(kid, i, 0, 0);
+		if ((v = ipc_recv(&who, 0, 0)) != i + 1 || who != kid)
+			panic("round trip %d: got %u from %08x", i, v, who);
+	}
+	tripcycles = (read_tsc() - t) / NTRIP;
+
+	t = read_tsc();
+	for (i = 0; i < NTRIP; i++) {
+		w[0] = w[1] = w[2] = w[3] = i;
+		if ((v = ipc_call_short(kid, w)) != i + 1 || w[3] != i + 1)
+			panic("short call %d: got %u, %u", i, v, w[3]);
+	}
+	shortcycles = (read_tsc() - t) / NTRIP;
+	ipc_send(kid, ~0U, 0, 0);
+	wait(kid);
+
+	t = read_tsc();
+	for (i = 0; i < NSTAT; i++)
+		if ((r = stat("/newmotd", &st)) < 0)
+			panic("stat /newmotd: %e", r);
+	statcycles = (read_tsc() - t) / NSTAT;
+
+	cprintf("ipcbench: %d round trips, %u cycles each; %d stats, %u cycles each\n",
+		NTRIP, (uint32_t) tripcycles, NSTAT, (uint32_t) statcycles);
+	cprintf("ipcbench: %d short calls, %u cycles each\n",
+		NTRIP, (uint32_t) shortcycles);
+	cprintf("ipcbench is good\n");
+}
@@ -0,0 +1,51 @@
+// System call scaling benchmark: each child runs its own loop of
+// sys_page_alloc and sys_page_unmap on a private address.  Those
+// calls, on the caller itself, are among the few that no longer take
+// the big kernel lock, so with more CPUs (make run-pagebench CPUS=n)
+// the children should run side by side and the total rate should grow
+// with n.  This says nothing of other system calls or IPC, which
+// still take the big kernel lock.
+
+#include <inc/lib.h>
+#include <inc/x86.h>
+
+#define NKID	4
+#define NITER	5000
+#define VA	((void *) 0x10000000)
+
+void
+umain(int argc, char **argv)
+{
+	envid_t parent = sys_getenvid(), who;
+	uint64_t t;
+	uint32_t rate, total = 0;
+	int i, r;
+
+	for (i = 0; i < NKID; i++) {
+		if ((r = fork()) < 0)
+			panic("fork: %e", r);
+		if (r == 0) {
+			t = read_tsc();
+			for (i = 0; i < NITER; i++) {
+				if ((r = sys_page_alloc(0, VA, PTE_P|PTE_U|PTE_W)) < 0)
+					panic("sys_page_alloc: %e", r);
+				if ((r = sys_page_unmap(0, VA)) < 0)
+					panic("sys_page_unmap: %e", r);
+			}
+			t = read_tsc() - t;
+			// Pairs per million cycles of this child's wall time.
+			ipc_send(parent, (uint64_t) NITER * 1000000 / t, 0, 0);
+			exit();
+		}
+	}
+
+	// With the children running at once, their rates add up.
+	for (i = 0; i < NKID; i++) {
+		rate = ipc_recv(&who, 0, 0);
+		cprintf("pagebench: [%08x] %u pairs per Mcycle\n", who, rate);
+		total += rate;
+	}
+	cprintf("pagebench: %d children, %u alloc+unmap pairs per Mcycle\n",
+		NKID, total);
+	cprintf("pagebench is good\n");
+}
@@ -0,0 +1,66 @@
+// Count how often long-running environments change CPUs.  Run with
+// CPUS=4.  Four children alternate a slice of work with sys_yield,
+// first free to run anywhere and then each pinned to its own CPU with
+// sys_env_set_affinity.  Free children should rarely move, since the
+// scheduler sends them back to the CPU they last ran on; pinned ones
+// must never move, and must always be on their own CPU.
+
+#include <inc/lib.h>
+
+#define NKID	4
+#define NROUND	300
+#define NWORK	20000
+
+volatile int sink;
+
+static void
+child(int pin)
+{
+	int i, k, r;
+
+	if (pin >= 0 && (r = sys_env_set_affinity(0, 1 << pin)) < 0)
+		panic("sys_env_set_affinity: %e", r);
+	for (i = 0; i < NROUND; i++) {
+		for (k = 0; k < NWORK; k++)
+			sink++;
+		sys_yield();
+		if (pin >= 0 && thisenv->env_cpunum != pin)
+			panic("pinned to CPU %d but ran on CPU %d",
+			      pin, thisenv->env_cpunum);
+	}
+}
+
+// Run NKID children and return how many times they changed CPUs.
+static uint32_t
+run(bool pinned)
+{
+	envid_t parent = sys_getenvid(), r;
+	uint32_t migrations = 0;
+	int i;
+
+	for (i = 0; i < NKID; i++) {
+		if ((r = fork()) < 0)
+			panic("fork: %e", r);
+		if (r == 0) {
+			child(pinned ? i : -1);
+			ipc_send(parent, thisenv->env_migrations, 0, 0);
+			exit();
+		}
+	}
+	for (i = 0; i < NKID; i++)
+		migrations += ipc_recv(0, 0, 0);
+	return migrations;
+}
+
+void
+umain(int argc, char **argv)
+{
+	uint32_t free, pinned;
+
+	free = run(0);
+	pinned = run(1);
+	cprintf("schedaffinity: %d children x %d rounds: "
+		"%u migrations free, %u pinned\n",
+		NKID, NROUND, free, pinned);
+	cprintf("schedaffinity is good\n");
+}
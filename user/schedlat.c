@@ -0,0 +1,65 @@
+// Measure IPC round-trip latency between two environments, first on
+// an idle system and then while spin.c-style children hog the CPU.
+// Run with CPUS=1.  Under plain round robin every round trip waits for
+// each hog's full time slice; with feedback priorities the hogs sink
+// below the ping-pong pair and the latency should barely move.
+
+#include <inc/lib.h>
+#include <inc/x86.h>
+
+#define NHOG	3
+#define NTRIP	200
+
+static uint64_t
+pingpong(envid_t echo)
+{
+	envid_t who;
+	uint64_t t;
+	int i;
+
+	t = read_tsc();
+	for (i = 0; i < NTRIP; i++) {
+		ipc_send(echo, i, 0, 0);
+		if (ipc_recv(&who, 0, 0) != i || who != echo)
+			panic("schedlat: bad reply");
+	}
+	return (read_tsc() - t) / NTRIP;
+}
+
+void
+umain(int argc, char **argv)
+{
+	envid_t echo, who, hogs[NHOG];
+	uint64_t quiet, loaded;
+	int i, v;
+
+	if ((echo = fork()) < 0)
+		panic("fork: %e", echo);
+	if (echo == 0) {
+		while (1) {
+			v = ipc_recv(&who, 0, 0);
+			ipc_send(who, v, 0, 0);
+		}
+	}
+	quiet = pingpong(echo);
+
+	for (i = 0; i < NHOG; i++) {
+		if ((hogs[i] = fork()) < 0)
+			panic("fork: %e", hogs[i]);
+		if (hogs[i] == 0)
+			while (1)
+				/* do nothing */;
+	}
+	// Let the hogs use up a few time slices first.
+	for (i = 0; i < 10 * NHOG; i++)
+		sys_yield();
+	loaded = pingpong(echo);
+
+	for (i = 0; i < NHOG; i++)
+		sys_env_destroy(hogs[i]);
+	sys_env_destroy(echo);
+
+	cprintf("schedlat: round trip %u cycles idle, %u cycles with %d hogs\n",
+		(uint32_t) quiet, (uint32_t) loaded, NHOG);
+	cprintf("schedlat is good\n");
+}
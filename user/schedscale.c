@@ -0,0 +1,46 @@
+// Scheduler scaling benchmark, after stresssched: fork a fixed set of
+// CPU-bound children that each alternate a slice of work with
+// sys_yield, and time how long the whole set takes.  Run it with
+// different CPU counts (make run-schedscale CPUS=n, n = 1..8); the
+// total should fall roughly in proportion while the per-yield cost
+// stays flat.
+
+#include <inc/lib.h>
+#include <inc/x86.h>
+
+#define NCHILD	16
+#define NROUND	200
+#define NWORK	20000
+
+volatile int sink;
+
+void
+umain(int argc, char **argv)
+{
+	envid_t kids[NCHILD];
+	uint64_t t;
+	int i, j, k;
+
+	t = read_tsc();
+	for (i = 0; i < NCHILD; i++) {
+		if ((kids[i] = fork()) < 0)
+			panic("fork: %e", kids[i]);
+		if (kids[i] == 0) {
+			for (j = 0; j < NROUND; j++) {
+				for (k = 0; k < NWORK; k++)
+					sink++;
+				sys_yield();
+			}
+			exit();
+		}
+	}
+	for (i = 0; i < NCHILD; i++)
+		wait(kids[i]);
+	t = read_tsc() - t;
+
+	cprintf("schedscale: %d children x %d rounds in %u Mcycles, "
+		"%u cycles per round\n",
+		NCHILD, NROUND, (uint32_t) (t / 1000000),
+		(uint32_t) (t / (NCHILD * NROUND)));
+	cprintf("schedscale is good\n");
+}
@@ -0,0 +1,41 @@
+// Measure shell command turnaround: run a script of trivial commands,
+// half of them two-stage pipelines, through /sh, and count how often
+// the shell and this environment ran while the commands did.
+
+#include <inc/lib.h>
+#include <inc/x86.h>
+
+#define NCMD	20
+#define MAXRUNS	3
+
+void
+umain(int argc, char **argv)
+{
+	uint32_t runs, waitruns;
+	uint64_t t;
+	envid_t sh;
+	int f, i, r;
+
+	if ((f = open("/shbench.sh", O_WRONLY|O_CREAT|O_TRUNC)) < 0)
+		panic("open /shbench.sh: %e", f);
+	for (i = 0; i < NCMD; i++)
+		fprintf(f, i % 2 ? "echo -n | cat\n" : "echo -n\n");
+	close(f);
+
+	t = read_tsc();
+	if ((sh = spawnl("/sh", "sh", "/shbench.sh", (char *) 0)) < 0)
+		panic("spawn /sh: %e", sh);
+	runs = thisenv->env_runs;
+	if ((r = wait(sh)) != 0)
+		panic("sh exited with %d", r);
+	waitruns = thisenv->env_runs - runs;
+	t = read_tsc() - t;
+
+	// Nothing has been created since sh went, so its slot still
+	// holds its counters.
+	cprintf("shbench: %d commands, %u cycles each; sh ran %u times, we ran %u times waiting\n",
+		NCMD, (uint32_t) (t / NCMD), envs[ENVX(sh)].env_runs, waitruns);
+	if (waitruns > MAXRUNS)
+		panic("woke up %u times waiting for sh", waitruns);
+	cprintf("shbench is good\n");
+}
@@ -0,0 +1,62 @@
+// Measure how fast programs can be spawned: this program, which is
+// small, and spawnbig, which carries 256KB of read-only data it never
+// touches.  Each is spawned over and over, exiting straight away, with
+// the program paged in on demand, loaded up front sharing its text
+// with the block cache, and loaded up front copying every page.
+
+#include <inc/lib.h>
+#include <inc/x86.h>
+
+#define NSPAWN	20
+
+static void
+bench(const char *prog, const char *name,
+      envid_t (*spawnfn)(const char *, const char **))
+{
+	const char *argv[] = { prog + 1, "child", 0 };
+	uint64_t t;
+	uint32_t nreq;
+	envid_t kid;
+	int i;
+
+	nreq = fsipc_nreq;
+	t = read_tsc();
+	for (i = 0; i < NSPAWN; i++) {
+		if ((kid = spawnfn(prog, argv)) < 0)
+			panic("%s %s: %e", name, prog, kid);
+		wait(kid);
+	}
+	t = read_tsc() - t;
+	cprintf("spawnbench %s %s: %d spawns, %u cycles and %d file requests each\n",
+		name, prog, NSPAWN, (uint32_t) (t / NSPAWN),
+		(fsipc_nreq - nreq) / NSPAWN);
+}
+
+void
+umain(int argc, char **argv)
+{
+	const char *progs[] = { "/spawnbench", "/spawnbig" };
+	const char *names[] = { "spawn", "spawn_eager", "spawn_copy" };
+	envid_t (*spawnfns[])(const char *, const char **) = {
+		spawn, spawn_eager, spawn_copy
+	};
+	const char *checkargv[] = { "spawnbig", 0 };
+	envid_t kid;
+	int i, j;
+
+	if (argc > 1)
+		return;
+
+	for (i = 0; i < 2; i++)
+		for (j = 0; j < 3; j++)
+			bench(progs[i], names[j], spawnfns[j]);
+
+	// The shared and demand-paged data must still read back intact.
+	for (i = 0; i < 3; i++) {
+		if ((kid = spawnfns[i]("/spawnbig", checkargv)) < 0)
+			panic("spawnbig: %e", kid);
+		if (wait(kid) != 0)
+			panic("spawnbig data is wrong");
+	}
+	cprintf("spawnbench is good\n");
+}
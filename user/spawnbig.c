@@ -0,0 +1,24 @@
+// A large program for spawnbench: 256KB of read-only data.  Given an
+// argument, as spawnbench's timed runs do, it exits without touching
+// the data; without one it reads all of it, to check it arrived intact.
+
+#include <inc/lib.h>
+
+#define NBALLAST	(64 * 1024)
+
+const uint32_t ballast[NBALLAST] = { 1, 2, 3, 4, 5, 6, 7, 8 };
+
+void
+umain(int argc, char **argv)
+{
+	int i;
+
+	if (argc > 1)
+		return;
+	for (i = 8; i < NBALLAST; i++)
+		if (ballast[i] != 0)
+			panic("ballast[%d] is %u", i, ballast[i]);
+	for (i = 0; i < 8; i++)
+		if (ballast[i] != i + 1)
+			panic("ballast[%d] is %u", i, ballast[i]);
+}
@@ -0,0 +1,100 @@
+// Contend for a lock from 1, 2 and 4 environments at once: a futex
+// mutex, whose waiters sleep in the kernel until the holder wakes
+// them, against a spinlock that waits with sys_yield, the only way to
+// wait on shared memory before.  Reports cycles per lock and unlock
+// pair, averaged over the environments.
+
+#include <inc/lib.h>
+#include <inc/x86.h>
+
+#define SHARED		((struct Shared *) 0x90000000)
+#define MAXKIDS		4
+#define NITER		2000
+#define WORK		200
+
+struct Shared {
+	struct Mutex m;
+	volatile uint32_t spin;
+	volatile uint32_t go;
+	volatile uint32_t counter;
+	uint64_t cycles[MAXKIDS];
+};
+
+static void
+work(void)
+{
+	volatile int i;
+
+	for (i = 0; i < WORK; i++)
+		/* do nothing */;
+}
+
+static void
+run(struct Shared *s, int id, bool futex)
+{
+	uint64_t t;
+	int i;
+
+	while (!s->go)
+		sys_yield();
+	t = read_tsc();
+	for (i = 0; i < NITER; i++) {
+		if (futex)
+			mutex_lock(&s->m);
+		else
+			while (xchg(&s->spin, 1) != 0)
+				sys_yield();
+		s->counter++;
+		work();
+		if (futex)
+			mutex_unlock(&s->m);
+		else
+			s->spin = 0;
+		work();
+	}
+	s->cycles[id] = read_tsc() - t;
+}
+
+// Cycles per iteration with nkids environments contending.
+static uint32_t
+bench(struct Shared *s, int nkids, bool futex)
+{
+	envid_t kids[MAXKIDS];
+	uint64_t total = 0;
+	int i;
+
+	s->go = 0;
+	s->counter = 0;
+	for (i = 0; i < nkids; i++) {
+		if ((kids[i] = fork()) < 0)
+			panic("fork: %e", kids[i]);
+		if (kids[i] == 0) {
+			run(s, i, futex);
+			exit();
+		}
+	}
+	s->go = 1;
+	for (i = 0; i < nkids; i++) {
+		wait(kids[i]);
+		total += s->cycles[i];
+	}
+	if (s->counter != nkids * NITER)
+		panic("%s: counter %u, want %u", futex ? "mutex" : "spinlock",
+		      s->counter, nkids * NITER);
+	return total / (nkids * NITER);
+}
+
+void
+umain(int argc, char **argv)
+{
+	int n, r;
+
+	if ((r = sys_page_alloc(0, SHARED, PTE_P|PTE_U|PTE_W|PTE_SHARE)) < 0)
+		panic("sys_page_alloc: %e", r);
+	mutex_init(&SHARED->m);
+
+	for (n = 1; n <= MAXKIDS; n *= 2)
+		cprintf("syncbench: %d envs: mutex %u cycles, yield spinlock %u cycles\n",
+			n, bench(SHARED, n, 1), bench(SHARED, n, 0));
+	cprintf("syncbench is good\n");
+}
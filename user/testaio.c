@@ -0,0 +1,66 @@
+// Test asynchronous file I/O: several transfers in flight at once,
+// completed out of submission order.
+
+#include <inc/lib.h>
+
+#define NPAGE	8
+
+char wbuf[PGSIZE];
+char rbuf[NPAGE][PGSIZE];
+
+void
+umain(int argc, char **argv)
+{
+	int f, i, r, res, done, spins;
+	uint32_t tag, seen;
+
+	if ((f = open("/aio", O_RDWR|O_CREAT|O_TRUNC)) < 0)
+		panic("open /aio: %e", f);
+
+	// Queue the pages back to front; the buffer is reusable at once.
+	for (i = NPAGE - 1; i >= 0; i--) {
+		memset(wbuf, 'a' + i, PGSIZE);
+		if ((r = aio_write(f, wbuf, PGSIZE, i * PGSIZE, i)) < 0)
+			panic("aio_write %d: %e", i, r);
+	}
+	if ((r = aio_submit()) < 0)
+		panic("aio_submit: %e", r);
+	for (seen = 0, done = 0; done < NPAGE; done++) {
+		if ((r = aio_wait(&tag, &res)) < 0)
+			panic("aio_wait: %e", r);
+		if (tag >= NPAGE || (seen & (1 << tag)) || res != PGSIZE)
+			panic("aio write completion tag %d res %d", tag, res);
+		seen |= 1 << tag;
+	}
+	cprintf("aio write is good\n");
+
+	// Read them back, polling while doing other work.
+	for (i = 0; i < NPAGE; i++)
+		if ((r = aio_read(f, rbuf[i], PGSIZE, i * PGSIZE, 100 + i)) < 0)
+			panic("aio_read %d: %e", i, r);
+	if ((r = aio_read(f, wbuf, PGSIZE, NPAGE * PGSIZE, 200)) < 0)
+		panic("aio_read past end: %e", r);
+	if ((r = aio_submit()) < 0)
+		panic("aio_submit: %e", r);
+	for (done = 0, spins = 0; done < NPAGE + 1; spins++) {
+		if (!aio_poll(&tag, &res)) {
+			sys_yield();
+			continue;
+		}
+		done++;
+		if (tag == 200 ? res != 0 : tag < 100 || tag >= 100 + NPAGE || res != PGSIZE)
+			panic("aio read completion tag %d res %d", tag, res);
+	}
+	for (i = 0; i < NPAGE; i++)
+		for (r = 0; r < PGSIZE; r++)
+			if (rbuf[i][r] != 'a' + i)
+				panic("aio read page %d byte %d: got %c", i, r, rbuf[i][r]);
+	if ((r = aio_wait(&tag, &res)) != -E_INVAL)
+		panic("aio_wait with nothing in flight: %e", r);
+	cprintf("aio read is good (%d polls)\n", spins);
+
+	// The synchronous interface sees the same data.
+	if ((r = readn(f, wbuf, PGSIZE)) != PGSIZE || wbuf[0] != 'a')
+		panic("read after aio: %e", r);
+	close(f);
+}
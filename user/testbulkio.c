@@ -0,0 +1,76 @@
+// Test multi-page reads and writes through the file server's bulk buffer.
+
+#include <inc/lib.h>
+
+#define BULKSIZE	(64 * PGSIZE)
+
+char buf[FSBUFSIZE + PGSIZE];
+
+static void
+fill(char *p, int off, int n)
+{
+	int i;
+
+	for (i = 0; i < n; i++)
+		p[i] = (off + i) * 7 + (off + i) / PGSIZE;
+}
+
+static void
+check(const char *p, int off, int n)
+{
+	int i;
+
+	for (i = 0; i < n; i++)
+		if (p[i] != (char) ((off + i) * 7 + (off + i) / PGSIZE))
+			panic("bad data at offset %d", off + i);
+}
+
+void
+umain(int argc, char **argv)
+{
+	int f, r, off, n;
+
+	if ((f = open("/bulk", O_RDWR|O_CREAT|O_TRUNC)) < 0)
+		panic("open /bulk: %e", f);
+
+	// A write larger than the bulk buffer comes back short.
+	fill(buf, 0, sizeof(buf));
+	if ((r = write(f, buf, sizeof(buf))) != FSBUFSIZE)
+		panic("write /bulk returned %d, want %d", r, FSBUFSIZE);
+	for (off = r; off < BULKSIZE; off += r) {
+		n = MIN(sizeof(buf), BULKSIZE - off);
+		fill(buf, off, n);
+		if ((r = write(f, buf, n)) <= 0)
+			panic("write /bulk@%d: %e", off, r);
+	}
+	cprintf("bulk write is good\n");
+
+	// Read it back with unaligned offsets and sizes.
+	if ((r = seek(f, 100)) < 0)
+		panic("seek /bulk: %e", r);
+	for (off = 100; off < BULKSIZE; off += r) {
+		n = MIN(3 * PGSIZE + 17, BULKSIZE - off);
+		if ((r = readn(f, buf, n)) != n)
+			panic("readn /bulk@%d returned %d, want %d", off, r, n);
+		check(buf, off, r);
+	}
+	if ((r = read(f, buf, sizeof(buf))) != 0)
+		panic("read past end of /bulk returned %d", r);
+	close(f);
+	cprintf("bulk read is good\n");
+
+	// A forked child must register its own buffer rather than
+	// scribbling over the parent's.
+	if ((r = fork()) < 0)
+		panic("fork: %e", r);
+	if ((f = open("/bulk", O_RDONLY)) < 0)
+		panic("open /bulk: %e", f);
+	if ((n = readn(f, buf, FSBUFSIZE)) != FSBUFSIZE)
+		panic("readn /bulk returned %d", n);
+	check(buf, 0, n);
+	close(f);
+	if (r == 0)
+		exit();
+	wait(r);
+	cprintf("bulk fork is good\n");
+}
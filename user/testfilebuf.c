@@ -0,0 +1,101 @@
+// Test the client-side file buffer and count the file server requests
+// it saves for getchar-style reads (sh scripts) and small writes.
+
+#include <inc/lib.h>
+
+char direct[1024], buffered[1024];
+
+// Read 'path' one byte at a time, the way readline() does through
+// getchar().  Returns the number of file server requests it took.
+static int
+bytewise(const char *path, int mode, char *buf, int *len)
+{
+	uint32_t nreq;
+	int f, r;
+
+	nreq = fsipc_nreq;
+	if ((f = open(path, O_RDONLY|mode)) < 0)
+		panic("open %s: %e", path, f);
+	for (*len = 0; *len < 1024 && (r = read(f, buf + *len, 1)) == 1; (*len)++)
+		;
+	close(f);
+	return fsipc_nreq - nreq;
+}
+
+// Write buf to 'path' one line at a time, like fprintf does.
+// Returns the number of file server requests it took.
+static int
+linewise(const char *path, int mode, const char *buf, int len)
+{
+	uint32_t nreq;
+	int f, i, n, r;
+
+	nreq = fsipc_nreq;
+	if ((f = open(path, O_WRONLY|O_CREAT|O_TRUNC|mode)) < 0)
+		panic("open %s: %e", path, f);
+	for (i = 0; i < len; i += n) {
+		for (n = 1; i + n < len && buf[i + n - 1] != '\n'; n++)
+			;
+		if ((r = write(f, buf + i, n)) != n)
+			panic("write %s: %e", path, r);
+	}
+	close(f);
+	return fsipc_nreq - nreq;
+}
+
+void
+umain(int argc, char **argv)
+{
+	int f, r, n, len, len2;
+	char c;
+
+	n = bytewise("/lorem", O_DIRECT, direct, &len);
+	r = bytewise("/lorem", 0, buffered, &len2);
+	if (len != len2 || memcmp(direct, buffered, len) != 0)
+		panic("buffered read of /lorem differs");
+	cprintf("bytewise read of %d bytes: %d requests direct, %d buffered\n",
+		len, n, r);
+
+	n = linewise("/lorem-copy", O_DIRECT, direct, len);
+	r = linewise("/lorem-copy", 0, direct, len);
+	cprintf("linewise write of %d bytes: %d requests direct, %d buffered\n",
+		len, n, r);
+	bytewise("/lorem-copy", 0, buffered, &len2);
+	if (len != len2 || memcmp(direct, buffered, len) != 0)
+		panic("buffered write of /lorem-copy lost data");
+	cprintf("file buffer read/write is good\n");
+
+	// A forked child shares the buffer along with the file position.
+	if ((f = open("/lorem", O_RDONLY)) < 0)
+		panic("open /lorem: %e", f);
+	if ((r = readn(f, buffered, 10)) != 10)
+		panic("readn /lorem: %e", r);
+	if ((r = fork()) < 0)
+		panic("fork: %e", r);
+	if (r == 0) {
+		if (read(f, &c, 1) != 1 || c != direct[10])
+			panic("child read wrong byte at 10");
+		exit();
+	}
+	wait(r);
+	if (read(f, &c, 1) != 1 || c != direct[11])
+		panic("parent read wrong byte at 11 after child");
+	close(f);
+
+	// So is a pending write: the child's data lands before the parent's.
+	if ((f = open("/lorem-copy", O_WRONLY|O_TRUNC)) < 0)
+		panic("open /lorem-copy: %e", f);
+	if ((r = fork()) < 0)
+		panic("fork: %e", r);
+	if (r == 0) {
+		write(f, "child ", 6);
+		exit();
+	}
+	wait(r);
+	write(f, "parent", 6);
+	close(f);
+	bytewise("/lorem-copy", 0, buffered, &len2);
+	if (len2 != 12 || memcmp(buffered, "child parent", 12) != 0)
+		panic("shared write buffer lost data");
+	cprintf("file buffer sharing is good\n");
+}
@@ -0,0 +1,93 @@
+// Check ipc_call and ipc_reply_recv: a caller takes the reply from
+// the env it called and nobody else.  Then check that short calls
+// carry all their words both ways, that a short call still gets a
+// plain reply's value, and that a call fails if the env called exits
+// without replying.
+
+#include <inc/lib.h>
+
+#define NCALL	10
+
+void
+umain(int argc, char **argv)
+{
+	envid_t parent = thisenv->env_id, caller, who;
+	uint32_t w[IPC_NWORDS];
+	const volatile uint32_t *rw;
+	int32_t v;
+	int i, r;
+
+	if ((caller = fork()) < 0)
+		panic("fork: %e", caller);
+	if (caller == 0) {
+		for (i = 0; i < NCALL; i++)
+			if ((v = ipc_call(parent, i, NULL, 0, NULL, NULL)) != i * i)
+				panic("call %d: reply %d", i, v);
+		for (; i < 2 * NCALL - 1; i++) {
+			w[0] = i, w[1] = 2 * i, w[2] = 3 * i, w[3] = 4 * i;
+			if ((v = ipc_call_short(parent, w)) != i * i
+			    || w[1] != 4 * i || w[2] != 3 * i || w[3] != 2 * i)
+				panic("short call %d: reply %d %u %u %u",
+				      i, v, w[1], w[2], w[3]);
+		}
+		w[0] = i, w[1] = w[2] = w[3] = 1;
+		if ((v = ipc_call_short(parent, w)) != i * i
+		    || w[1] != 0 || w[2] != 0 || w[3] != 0)
+			panic("short call with plain reply: %d %u %u %u",
+			      v, w[1], w[2], w[3]);
+		ipc_send(parent, ~0U, NULL, 0);
+		return;
+	}
+
+	v = ipc_recv(&who, NULL, NULL);
+	for (i = 0; v != ~0; i++) {
+		if (who != caller || v != i)
+			panic("request %d: got %d from %08x", i, v, who);
+		// The caller is waiting, but for us alone.
+		if (i == 0) {
+			if ((r = fork()) < 0)
+				panic("fork: %e", r);
+			if (r == 0) {
+				if ((r = sys_ipc_try_send(caller, 0, (void *) UTOP, 0))
+				    != -E_IPC_NOT_RECV)
+					panic("third party got through: %e", r);
+				return;
+			}
+			wait(r);
+		}
+		if (i < NCALL) {
+			if (thisenv->env_ipc_nwords != 0)
+				panic("request %d: plain call arrived short", i);
+			v = ipc_reply_recv(caller, i * i, NULL, 0, &who, NULL, NULL);
+		} else if (i < 2 * NCALL - 1) {
+			rw = thisenv->env_ipc_words;
+			if (thisenv->env_ipc_nwords != IPC_NWORDS || rw[0] != i
+			    || rw[1] != 2 * i || rw[2] != 3 * i || rw[3] != 4 * i)
+				panic("short request %d: got %u %u %u %u",
+				      i, rw[0], rw[1], rw[2], rw[3]);
+			w[0] = i * i, w[1] = rw[3], w[2] = rw[2], w[3] = rw[1];
+			v = ipc_reply_recv_short(caller, w, &who, NULL);
+		} else
+			v = ipc_reply_recv(caller, i * i, NULL, 0, &who, NULL, NULL);
+	}
+	wait(caller);
+
+	// Each server takes the call and exits without a reply.
+	for (i = 0; i < 2; i++) {
+		if ((r = fork()) < 0)
+			panic("fork: %e", r);
+		if (r == 0) {
+			ipc_recv(NULL, NULL, NULL);
+			return;
+		}
+		w[0] = w[1] = w[2] = w[3] = 0;
+		if (i == 0)
+			v = sys_ipc_call(r, 0, (void *) UTOP, 0, (void *) UTOP);
+		else
+			v = sys_ipc_call_short(r, w);
+		if (v != -E_BAD_ENV)
+			panic("%scall to an exiting env: %e", i ? "short " : "", v);
+	}
+	cprintf("call to an exiting env fails\n");
+	cprintf("testipccall is good\n");
+}
@@ -0,0 +1,69 @@
+// Check the IPC message queues: sends to an env that is not receiving
+// are queued, in order and with their pages, up to IPC_QUEUE_MAX; the
+// next send waits for room; and messages an env dies with let go of
+// their pages.
+
+#include <inc/lib.h>
+
+#define TEMP	((char *) 0xa00000)
+
+void
+umain(int argc, char **argv)
+{
+	envid_t parent = thisenv->env_id, child, who;
+	int i, perm, r;
+	uint32_t v;
+
+	if ((child = fork()) < 0)
+		panic("fork: %e", child);
+	if (child == 0) {
+		while (thisenv->env_ipc_qlen < IPC_QUEUE_MAX)
+			sys_yield();
+		for (i = 0; i <= IPC_QUEUE_MAX; i++) {
+			v = ipc_recv(&who, TEMP, &perm);
+			if (v != i || who != parent)
+				panic("message %d: got %u from %08x", i, v, who);
+			if (i == 0 && (!(perm & PTE_P)
+				       || strcmp(TEMP, "queued page") != 0))
+				panic("message 0: page missing");
+			if (i != 0 && perm != 0)
+				panic("message %d: unexpected page", i);
+		}
+		if (thisenv->env_ipc_qlen != 0
+		    || thisenv->env_ipc_qmax != IPC_QUEUE_MAX)
+			panic("queue length %u, most %u",
+			      thisenv->env_ipc_qlen, thisenv->env_ipc_qmax);
+		return;
+	}
+
+	if ((r = sys_page_alloc(0, TEMP, PTE_P|PTE_U|PTE_W)) < 0)
+		panic("sys_page_alloc: %e", r);
+	strcpy(TEMP, "queued page");
+	for (i = 0; i < IPC_QUEUE_MAX; i++)
+		if ((r = sys_ipc_send(child, i, i == 0 ? TEMP : (void *) UTOP,
+				      PTE_P|PTE_U|PTE_W)) < 0)
+			panic("send %d: %e", i, r);
+	if (pageref(TEMP) != 2)
+		panic("queued page has %d references, not 2", pageref(TEMP));
+	if ((r = sys_ipc_send(child, i, (void *) UTOP, 0)) != -E_IPC_QUEUE_FULL)
+		panic("send to a full queue: %e", r);
+	ipc_send(child, i, NULL, 0);
+	wait(child);
+
+	// An env that dies with messages queued drops them.  The child
+	// shares TEMP copy-on-write, so it can only be sent read-only.
+	if ((child = fork()) < 0)
+		panic("fork: %e", child);
+	if (child == 0)
+		while (1)
+			sys_yield();
+	if ((r = sys_ipc_send(child, 0, TEMP, PTE_P|PTE_U)) < 0)
+		panic("send: %e", r);
+	if (pageref(TEMP) != 3)
+		panic("queued page has %d references, not 3", pageref(TEMP));
+	sys_env_destroy(child);
+	wait(child);
+	if (pageref(TEMP) != 1)
+		panic("dropped page has %d references, not 1", pageref(TEMP));
+	cprintf("testipcqueue is good\n");
+}
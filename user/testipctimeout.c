@@ -0,0 +1,50 @@
+// Test receives with a timeout: one that expires, one that a message
+// beats, and that the timer of the second does not fire on a later
+// receive.
+
+#include <inc/lib.h>
+
+#define SHORT_US	20000
+#define LONG_US		5000000
+
+void
+umain(int argc, char **argv)
+{
+	envid_t child, from;
+	int32_t r;
+	int i, perm;
+
+	// Nobody sends
+	if ((r = ipc_recv_timeout(&from, NULL, &perm, SHORT_US)) != -E_TIMEOUT)
+		panic("receive with no sender returned %d", r);
+	if (from != 0 || perm != 0)
+		panic("timed-out receive set from %08x, perm %x", from, perm);
+	cprintf("receive timed out\n");
+
+	// A message comes in time, then another once the first receive's
+	// timeout would have run out
+	if ((child = fork()) < 0)
+		panic("fork: %e", child);
+	if (child == 0) {
+		for (i = 0; i < 10; i++)
+			sys_yield();
+		ipc_send(thisenv->env_parent_id, 1, NULL, 0);
+		ipc_recv(NULL, NULL, NULL);
+		ipc_send(thisenv->env_parent_id, 2, NULL, 0);
+		exit();
+	}
+	if ((r = ipc_recv_timeout(&from, NULL, NULL, SHORT_US * 10)) != 1
+	    || from != child)
+		panic("timed receive got %d from %08x", r, from);
+	// Outlast the first receive's timeout before asking for more.
+	if ((r = ipc_recv_timeout(&from, NULL, NULL, SHORT_US * 20)) != -E_TIMEOUT)
+		panic("idle receive returned %d", r);
+	ipc_send(child, 0, NULL, 0);
+	if ((r = ipc_recv_timeout(&from, NULL, NULL, LONG_US)) != 2
+	    || from != child)
+		panic("second timed receive got %d from %08x", r, from);
+	wait(child);
+	cprintf("receive beat its timeout\n");
+
+	cprintf("testipctimeout is good\n");
+}
@@ -0,0 +1,67 @@
+// Test notification bits: pending bits, waking a waiter, NOTIFY_IPC
+// for a receive armed with sys_ipc_recv_nb, and who may bind an IRQ.
+
+#include <inc/lib.h>
+
+void
+umain(int argc, char **argv)
+{
+	envid_t child;
+	int r, i;
+
+	// Bad masks
+	if ((r = sys_notify_wait(0)) != -E_INVAL)
+		panic("wait for no bits: %e", r);
+	if ((r = sys_notify_wait(0x80000000)) != -E_INVAL)
+		panic("wait for bit 31: %e", r);
+
+	// Bits stay pending until waited for, one at a time
+	if ((r = sys_notify(0, 0x5)) < 0)
+		panic("notify self: %e", r);
+	if ((r = sys_notify_wait(0x6)) != 0x4)
+		panic("wait for 0x6 got %x", r);
+	if ((r = sys_notify_wait(0x1)) != 0x1)
+		panic("wait for 0x1 got %x", r);
+
+	// Waking a waiter
+	if ((child = fork()) < 0)
+		panic("fork: %e", child);
+	if (child == 0) {
+		if ((r = sys_notify_wait(0x8)) != 0x8)
+			panic("child: wait for 0x8 got %x", r);
+		if ((r = sys_notify_wait(0x10)) != 0x10)
+			panic("child: wait for 0x10 got %x", r);
+		exit();
+	}
+	for (i = 0; i < 10 && envs[ENVX(child)].env_status != ENV_NOT_RUNNABLE; i++)
+		sys_yield();
+	if ((r = sys_notify(child, 0x18)) < 0)
+		panic("notify child: %e", r);
+	wait(child);
+	cprintf("notify wakeup ok\n");
+
+	// A message at an armed receive
+	if ((child = fork()) < 0)
+		panic("fork: %e", child);
+	if (child == 0) {
+		ipc_send(thisenv->env_parent_id, 42, NULL, 0);
+		exit();
+	}
+	if ((r = sys_ipc_recv_nb((void *) UTOP)) < 0)
+		panic("sys_ipc_recv_nb: %e", r);
+	if ((r = sys_notify_wait(NOTIFY_IPC)) != NOTIFY_IPC)
+		panic("wait for NOTIFY_IPC got %x", r);
+	if (thisenv->env_ipc_recving || thisenv->env_ipc_value != 42
+	    || thisenv->env_ipc_from != child)
+		panic("NOTIFY_IPC before the message");
+	wait(child);
+	cprintf("notify ipc ok\n");
+
+	// Only environments with I/O privileges drive devices
+	if ((r = sys_irq_bind(IRQ_TIMER, 1)) != -E_INVAL)
+		panic("bind the timer: %e", r);
+	if ((r = sys_irq_bind(IRQ_IDE, 1)) != -E_BAD_ENV)
+		panic("bind the disk: %e", r);
+
+	cprintf("testnotify is good\n");
+}
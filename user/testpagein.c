@@ -0,0 +1,48 @@
+// Test that system calls page in a demand-paged program's memory: a
+// spawned child hands pages it has never touched to sys_cputs and
+// ipc_send, which must fault them in through the file server rather
+// than fail or crash the kernel.
+
+#include <inc/lib.h>
+
+#define TMPVA	((void *) 0xB0000000)
+
+// Each on a page of its own, untouched until passed to the kernel.
+char greeting[PGSIZE] __attribute__((aligned(PGSIZE))) =
+	"cputs of an untouched data page ok\n";
+char bsspage[PGSIZE] __attribute__((aligned(PGSIZE)));
+char sendpage[PGSIZE] __attribute__((aligned(PGSIZE)));
+
+static void
+child(void)
+{
+	sys_cputs(greeting, strlen("cputs of an untouched data page ok\n"));
+	sys_cputs(bsspage, sizeof(bsspage));
+	cprintf("cputs of an untouched bss page ok\n");
+	ipc_send(thisenv->env_parent_id, 0, sendpage, PTE_P|PTE_U);
+}
+
+void
+umain(int argc, char **argv)
+{
+	envid_t kid, from;
+	int i, r, perm;
+
+	if (argc > 1) {
+		child();
+		return;
+	}
+	if ((kid = spawnl("/testpagein", "testpagein", "child", 0)) < 0)
+		panic("spawn /testpagein: %e", kid);
+	if ((r = ipc_recv(&from, TMPVA, &perm)) < 0)
+		panic("ipc_recv: %e", r);
+	if (from != kid || !(perm & PTE_P))
+		panic("got %08x perm %x, want a page from %08x", from, perm, kid);
+	for (i = 0; i < PGSIZE; i++)
+		if (((char *) TMPVA)[i] != 0)
+			panic("sent bss page has %02x at %d",
+			      ((char *) TMPVA)[i], i);
+	cprintf("ipc_send of an untouched bss page ok\n");
+	wait(kid);
+	cprintf("testpagein is good\n");
+}
@@ -0,0 +1,81 @@
+// Test sendfile from a file to another file and to a pipe, and compare
+// it with copying through read and write.
+
+#include <inc/lib.h>
+#include <inc/x86.h>
+
+char want[4 * PGSIZE + 100];
+char got[sizeof(want)];
+
+static void
+check(const char *what, int n)
+{
+	if (n != sizeof(want))
+		panic("%s: copied %d bytes, want %d", what, n, sizeof(want));
+	if (memcmp(got, want, sizeof(want)) != 0)
+		panic("%s: data differs", what);
+}
+
+void
+umain(int argc, char **argv)
+{
+	int src, dst, p[2], i, n, r;
+	uint64_t t;
+	envid_t kid;
+
+	for (i = 0; i < sizeof(want); i++)
+		want[i] = 'a' + i % 26 + i / PGSIZE;
+	if ((src = open("/sendsrc", O_RDWR|O_CREAT|O_TRUNC)) < 0)
+		panic("open /sendsrc: %e", src);
+	if ((r = write(src, want, sizeof(want))) != sizeof(want))
+		panic("write /sendsrc: %d", r);
+
+	// File to file, through the server.  The position of src stays put.
+	if ((dst = open("/senddst", O_RDWR|O_CREAT|O_TRUNC)) < 0)
+		panic("open /senddst: %e", dst);
+	t = read_tsc();
+	if ((n = sendfile(dst, src, 0, sizeof(want) + 1000)) < 0)
+		panic("sendfile file: %e", n);
+	cprintf("sendfile file-to-file: %u cycles\n", (uint32_t) (read_tsc() - t));
+	if ((r = seek(dst, 0)) < 0 || (r = readn(dst, got, sizeof(got))) < 0)
+		panic("read /senddst: %e", r);
+	check("sendfile file-to-file", n);
+	if ((r = write(src, "x", 1)) != 1 || (r = seek(src, sizeof(want))) < 0
+	    || (r = readn(src, got, 2)) != 1 || got[0] != 'x')
+		panic("sendfile moved the source position");
+	if ((r = ftruncate(src, sizeof(want))) < 0)
+		panic("ftruncate: %e", r);
+
+	// The same copy through read and write, for comparison.
+	seek(dst, 0);
+	seek(src, 0);
+	t = read_tsc();
+	for (i = 0; (r = read(src, got, PGSIZE)) > 0; i += r)
+		write(dst, got, r);
+	cprintf("read/write file-to-file: %u cycles\n", (uint32_t) (read_tsc() - t));
+	cprintf("sendfile file-to-file is good\n");
+
+	// File to pipe: pipes have no dev_sendfile, so this is the
+	// read/write fallback in sendfile.
+	if ((r = pipe(p)) < 0)
+		panic("pipe: %e", r);
+	if ((kid = fork()) < 0)
+		panic("fork: %e", kid);
+	if (kid == 0) {
+		close(p[1]);
+		n = readn(p[0], got, sizeof(got));
+		check("sendfile file-to-pipe", n);
+		if ((r = read(p[0], got, 1)) != 0)
+			panic("sendfile file-to-pipe: %d extra bytes", r);
+		cprintf("sendfile file-to-pipe is good\n");
+		exit();
+	}
+	close(p[0]);
+	t = read_tsc();
+	for (i = 0; i < sizeof(want); i += n)
+		if ((n = sendfile(p[1], src, i, sizeof(want) + 1000)) <= 0)
+			panic("sendfile pipe: %e", n);
+	cprintf("sendfile file-to-pipe: %u cycles\n", (uint32_t) (read_tsc() - t));
+	close(p[1]);
+	wait(kid);
+}
@@ -0,0 +1,53 @@
+// Check stride scheduling: three CPU-bound children holding 1, 2 and 4
+// shares of tickets should run in roughly those proportions.  Each
+// child spins without yielding, so every run is one timer quantum and
+// env_runs counts its CPU time.  Needs a kernel built with
+// SCHED=stride, and CPUS=1.
+
+#include <inc/lib.h>
+
+#define NKID	3
+#define TICKETS	100
+#define NRUNS	200	// Run until the biggest share has had this many
+
+void
+umain(int argc, char **argv)
+{
+	envid_t kids[NKID];
+	uint32_t base[NKID], runs[NKID], want;
+	int i, r;
+
+	// Stay out of the children's way while they are measured.
+	if ((r = sys_env_set_tickets(0, TICKETS / 10)) < 0)
+		panic("sys_env_set_tickets: %e", r);
+
+	for (i = 0; i < NKID; i++) {
+		if ((kids[i] = fork()) < 0)
+			panic("fork: %e", kids[i]);
+		if (kids[i] == 0)
+			while (1)
+				/* do nothing */;
+		if ((r = sys_env_set_tickets(kids[i], TICKETS << i)) < 0)
+			panic("sys_env_set_tickets: %e", r);
+	}
+
+	for (i = 0; i < NKID; i++)
+		base[i] = envs[ENVX(kids[i])].env_runs;
+	while (envs[ENVX(kids[NKID - 1])].env_runs - base[NKID - 1] < NRUNS)
+		sys_yield();
+	for (i = 0; i < NKID; i++) {
+		runs[i] = envs[ENVX(kids[i])].env_runs - base[i];
+		sys_env_destroy(kids[i]);
+	}
+
+	cprintf("testshares: 1:2:4 shares ran %u:%u:%u quanta\n",
+		runs[0], runs[1], runs[2]);
+	for (i = 0; i < NKID; i++) {
+		// Allow 15% either way.
+		want = runs[NKID - 1] >> (NKID - 1 - i);
+		if (runs[i] * 100 < want * 85 || runs[i] * 100 > want * 115)
+			panic("share %d ran %u quanta, expected about %u",
+			      1 << i, runs[i], want);
+	}
+	cprintf("testshares is good\n");
+}
@@ -0,0 +1,138 @@
+// Test the mutexes, condition variables and semaphores of lib/sync.c
+// between forked environments sharing a PTE_SHARE page.
+
+#include <inc/lib.h>
+
+#define SHARED		((struct Shared *) 0x90000000)
+#define NKIDS		4
+#define NINC		1000
+#define NITEM		200
+#define NSLOT		4
+
+struct Shared {
+	struct Mutex m;
+	uint32_t counter;
+
+	struct Sem empty, full;
+	uint32_t buf[NSLOT];
+
+	struct Cond c;
+	bool ready;
+	uint32_t woken;
+};
+
+static envid_t
+fork_or_die(void)
+{
+	envid_t e;
+
+	if ((e = fork()) < 0)
+		panic("fork: %e", e);
+	return e;
+}
+
+static void
+test_mutex(struct Shared *s)
+{
+	envid_t kids[NKIDS];
+	uint32_t v;
+	int i, j;
+
+	for (i = 0; i < NKIDS; i++) {
+		if ((kids[i] = fork_or_die()) != 0)
+			continue;
+		for (j = 0; j < NINC; j++) {
+			mutex_lock(&s->m);
+			v = s->counter;
+			// Give up the CPU now and then with the lock held,
+			// so that the others have to sleep for it.
+			if (j % 100 == 0)
+				sys_yield();
+			s->counter = v + 1;
+			mutex_unlock(&s->m);
+		}
+		exit();
+	}
+	for (i = 0; i < NKIDS; i++)
+		wait(kids[i]);
+	if (s->counter != NKIDS * NINC)
+		panic("mutex: counter %u, want %u", s->counter, NKIDS * NINC);
+	if (!mutex_trylock(&s->m) || mutex_trylock(&s->m))
+		panic("mutex_trylock");
+	mutex_unlock(&s->m);
+	cprintf("mutex ok\n");
+}
+
+static void
+test_sem(struct Shared *s)
+{
+	envid_t kid;
+	uint32_t v;
+	int i;
+
+	sem_init(&s->empty, NSLOT);
+	sem_init(&s->full, 0);
+	if ((kid = fork_or_die()) == 0) {
+		for (i = 0; i < NITEM; i++) {
+			sem_wait(&s->empty);
+			s->buf[i % NSLOT] = i;
+			sem_post(&s->full);
+		}
+		exit();
+	}
+	for (i = 0; i < NITEM; i++) {
+		sem_wait(&s->full);
+		if ((v = s->buf[i % NSLOT]) != i)
+			panic("semaphore: item %d is %u", i, v);
+		sem_post(&s->empty);
+	}
+	wait(kid);
+	if (sem_trywait(&s->full))
+		panic("sem_trywait on an empty semaphore");
+	cprintf("semaphore ok\n");
+}
+
+static void
+test_cond(struct Shared *s)
+{
+	envid_t kids[NKIDS];
+	int i;
+
+	cond_init(&s->c);
+	for (i = 0; i < NKIDS; i++) {
+		if ((kids[i] = fork_or_die()) != 0)
+			continue;
+		mutex_lock(&s->m);
+		while (!s->ready)
+			cond_wait(&s->c, &s->m);
+		s->woken++;
+		mutex_unlock(&s->m);
+		exit();
+	}
+	for (i = 0; i < 10; i++)
+		sys_yield();
+	mutex_lock(&s->m);
+	s->ready = 1;
+	cond_broadcast(&s->c);
+	mutex_unlock(&s->m);
+	for (i = 0; i < NKIDS; i++)
+		wait(kids[i]);
+	if (s->woken != NKIDS)
+		panic("condvar: %u woken, want %u", s->woken, NKIDS);
+	cprintf("condvar ok\n");
+}
+
+void
+umain(int argc, char **argv)
+{
+	int r;
+
+	if ((r = sys_page_alloc(0, SHARED, PTE_P|PTE_U|PTE_W|PTE_SHARE)) < 0)
+		panic("sys_page_alloc: %e", r);
+	mutex_init(&SHARED->m);
+
+	test_mutex(SHARED);
+	test_sem(SHARED);
+	test_cond(SHARED);
+	cprintf("testsync is good\n");
+}
@@ -0,0 +1,169 @@
+// Test threads made with sfork: each has its own thisenv and stack,
+// globals are shared both ways, a fork from a threaded program does not
+// unshare them, join returns the thread's exit status, and threads can
+// read files at the same time.
+
+#include <inc/lib.h>
+
+#define NTHREAD		4
+#define NINC		1000
+
+#define FILESIZE	(4 * PGSIZE + 123)
+
+struct Mutex m;
+uint32_t counter;
+volatile uint32_t flag;
+volatile int stackval;
+char want[FILESIZE];
+char got[NTHREAD][FILESIZE];
+
+static int
+check_self(void *arg)
+{
+	envid_t parent = (envid_t) arg;
+
+	if (thisenv->env_id != sys_getenvid() || thisenv->env_id == parent)
+		panic("thread thisenv is %08x, not %08x",
+		      thisenv->env_id, sys_getenvid());
+	if (flag != 1)
+		panic("thread sees flag %u before writing it", flag);
+	flag = 2;
+	return 7;
+}
+
+static int
+count(void *arg)
+{
+	int i;
+
+	for (i = 0; i < NINC; i++) {
+		mutex_lock(&m);
+		counter++;
+		mutex_unlock(&m);
+	}
+	return (int) arg;
+}
+
+static int
+stack(void *arg)
+{
+	volatile int *p = arg;
+
+	// arg points into the parent's stack at the same address as ours,
+	// which is private: the parent's later writes don't show here.
+	while (flag != 3)
+		sys_yield();
+	return *p;
+}
+
+static int
+watch(void *arg)
+{
+	int i;
+
+	for (i = 0; i < 10000 && flag != 5; i++)
+		sys_yield();
+	if (flag != 5)
+		return 0;
+	flag = 6;
+	return 1;
+}
+
+// Read /threadfile through an fd of our own, in pieces small enough
+// for the client-side buffer and large enough for the bulk buffer.
+static int
+readfile(void *arg)
+{
+	int i = (int) arg, fd, n, r;
+	char *buf = got[i];
+
+	if ((fd = open("/threadfile", O_RDONLY)) < 0)
+		panic("thread %d: open /threadfile: %e", i, fd);
+	for (n = 0; n < FILESIZE; n += r) {
+		r = (n / PGSIZE + i) % 2 ? 3 * PGSIZE : 100 + i;
+		if ((r = read(fd, buf + n, MIN(r, FILESIZE - n))) <= 0)
+			panic("thread %d: read at %d: %e", i, n, r);
+		sys_yield();
+	}
+	close(fd);
+	if (memcmp(buf, want, FILESIZE) != 0)
+		panic("thread %d read the wrong data", i);
+	return i;
+}
+
+void
+umain(int argc, char **argv)
+{
+	volatile int local = 5;
+	envid_t t[NTHREAD], child;
+	int i, r;
+
+	// Per-thread thisenv, and shared globals
+	flag = 1;
+	if ((t[0] = uthread_create(check_self, (void *) thisenv->env_id)) < 0)
+		panic("uthread_create: %e", t[0]);
+	if ((r = uthread_join(t[0])) != 7)
+		panic("thread exit status %d", r);
+	if (flag != 2)
+		panic("parent sees flag %u after the thread wrote 2", flag);
+	if (thisenv->env_id != sys_getenvid())
+		panic("thread changed our thisenv");
+	cprintf("thread thisenv ok\n");
+
+	// Private stacks
+	if ((t[0] = uthread_create(stack, (void *) &local)) < 0)
+		panic("uthread_create: %e", t[0]);
+	local = 6;
+	flag = 3;
+	if ((r = uthread_join(t[0])) != 5)
+		panic("thread saw our stack write: %d", r);
+	cprintf("thread stack ok\n");
+
+	// A mutex shared by threads
+	mutex_init(&m);
+	for (i = 0; i < NTHREAD; i++)
+		if ((t[i] = uthread_create(count, (void *) i)) < 0)
+			panic("uthread_create: %e", t[i]);
+	for (i = 0; i < NTHREAD; i++)
+		if ((r = uthread_join(t[i])) != i)
+			panic("thread %d exit status %d", i, r);
+	if (counter != NTHREAD * NINC)
+		panic("counter is %u, not %u", counter, NTHREAD * NINC);
+	cprintf("thread mutex ok\n");
+
+	// A fork gives the child a copy of the globals and leaves them
+	// shared with our running threads
+	if ((t[0] = uthread_create(watch, NULL)) < 0)
+		panic("uthread_create: %e", t[0]);
+	if ((child = fork()) < 0)
+		panic("fork: %e", child);
+	if (child == 0) {
+		flag = 4;
+		exit();
+	}
+	wait(child);
+	if (flag != 3)
+		panic("forked child wrote our flag");
+	flag = 5;
+	if ((r = uthread_join(t[0])) != 1 || flag != 6)
+		panic("fork unshared the globals from our threads");
+	cprintf("thread fork ok\n");
+
+	// Threads reading files at once
+	for (i = 0; i < FILESIZE; i++)
+		want[i] = 'a' + (i * 7) % 26;
+	if ((r = open("/threadfile", O_RDWR|O_CREAT|O_TRUNC)) < 0)
+		panic("open /threadfile: %e", r);
+	if ((i = write(r, want, FILESIZE)) != FILESIZE)
+		panic("write /threadfile: %d", i);
+	close(r);
+	for (i = 0; i < NTHREAD; i++)
+		if ((t[i] = uthread_create(readfile, (void *) i)) < 0)
+			panic("uthread_create: %e", t[i]);
+	for (i = 0; i < NTHREAD; i++)
+		if ((r = uthread_join(t[i])) != i)
+			panic("thread %d exit status %d", i, r);
+	cprintf("thread file reads ok\n");
+
+	cprintf("testthread is good\n");
+}
@@ -0,0 +1,55 @@
+// Check the exit statuses that wait() reports.
+
+#include <inc/lib.h>
+
+static envid_t
+child(int how)
+{
+	envid_t kid;
+
+	if ((kid = fork()) < 0)
+		panic("fork: %e", kid);
+	if (kid > 0)
+		return kid;
+	switch (how) {
+	case 0:
+		exit();
+	case 1:
+		exit_status(7);
+	case 2:
+		exit_status(0x1234);
+	case 3:
+		*(volatile int *) 0 = 0;
+	case 4:
+		while (1)
+			sys_yield();
+	}
+	panic("child %d still here", how);
+}
+
+void
+umain(int argc, char **argv)
+{
+	envid_t kid;
+	int r;
+
+	if ((r = wait(child(0))) != 0)
+		panic("exit(): status %d", r);
+	if ((r = wait(child(1))) != 7)
+		panic("exit_status(7): status %d", r);
+	if ((r = wait(child(2))) != 0x34)
+		panic("exit_status(0x1234): status %d", r);
+	if ((r = wait(child(3))) != ENV_EXIT_KILLED)
+		panic("faulting child: status %d", r);
+
+	kid = child(4);
+	sys_env_destroy(kid);
+	if ((r = wait(kid)) != ENV_EXIT_KILLED)
+		panic("destroyed child: status %d", r);
+
+	if ((r = sys_env_wait(thisenv->env_id)) != -E_INVAL)
+		panic("waiting for ourselves: %d", r);
+	if ((r = sys_env_wait(kid + NENV)) != -E_BAD_ENV)
+		panic("waiting for nobody: %d", r);
+	cprintf("testwait is good\n");
+}
@@ -0,0 +1,73 @@
+// Sum a large array with 1, 2 and 4 threads, each summing a slice, to
+// see how a parallel computation scales with threads made by sfork.
+// Times are in cycles from creating the first thread to joining the
+// last, so they include sfork.
+
+#include <inc/lib.h>
+#include <inc/x86.h>
+
+#define MAXTHREAD	4
+#define NELEM		(256 * 1024)
+#define NPASS		20
+
+uint32_t array[NELEM];
+uint32_t partial[MAXTHREAD];
+int nthread;
+
+static int
+sum(void *arg)
+{
+	int id = (int) arg, i, pass;
+	uint32_t s = 0;
+
+	for (pass = 0; pass < NPASS; pass++)
+		for (i = id * (NELEM / nthread); i < (id + 1) * (NELEM / nthread); i++)
+			s += array[i];
+	partial[id] = s;
+	return 0;
+}
+
+// Cycles to sum the array with n threads.
+static uint32_t
+bench(int n)
+{
+	envid_t t[MAXTHREAD];
+	uint64_t start;
+	uint32_t s = 0;
+	int i;
+
+	nthread = n;
+	start = read_tsc();
+	for (i = 0; i < n; i++)
+		if ((t[i] = uthread_create(sum, (void *) i)) < 0)
+			panic("uthread_create: %e", t[i]);
+	for (i = 0; i < n; i++)
+		if (uthread_join(t[i]) != 0)
+			panic("thread %d failed", i);
+	start = read_tsc() - start;
+
+	for (i = 0; i < n; i++)
+		s += partial[i];
+	if (s != NPASS * (NELEM / 2u) * (NELEM - 1u))
+		panic("%d threads: sum is %u", n, s);
+	return start;
+}
+
+void
+umain(int argc, char **argv)
+{
+	uint32_t one, cycles;
+	int i, n;
+
+	for (i = 0; i < NELEM; i++)
+		array[i] = i;
+
+	one = bench(1);
+	cprintf("threadbench: 1 threads: %u cycles\n", one);
+	for (n = 2; n <= MAXTHREAD; n *= 2) {
+		cycles = bench(n);
+		cprintf("threadbench: %d threads: %u cycles, speedup %u.%02u\n",
+			n, cycles, one / cycles, one * 100ULL / cycles % 100);
+	}
+	cprintf("threadbench is good\n");
+}
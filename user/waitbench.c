@@ -0,0 +1,92 @@
+// Count how often a parent runs while it waits for a busy child: in
+// wait(), in a pipe read and in ipc_send to a child whose message
+// queue is full, and then polling the child's status with sys_yield,
+// the way all three used to wait.  Blocked on a wait queue, the parent
+// should only run to make the calls themselves.
+
+#include <inc/lib.h>
+
+#define SPIN		20000000
+#define MAXRUNS		10
+
+static void
+busy(void)
+{
+	volatile int i;
+
+	for (i = 0; i < SPIN; i++)
+		/* do nothing */;
+}
+
+static envid_t
+spawn_busy(int pfd)
+{
+	envid_t child;
+
+	if ((child = fork()) < 0)
+		panic("fork: %e", child);
+	if (child == 0) {
+		busy();
+		if (pfd >= 0 && write(pfd, "x", 1) != 1)
+			panic("write to pipe");
+		exit();
+	}
+	return child;
+}
+
+void
+umain(int argc, char **argv)
+{
+	uint32_t runs, waitruns, piperuns, ipcruns, pollruns;
+	envid_t child;
+	int i, p[2], r;
+	char c;
+
+	// wait()
+	child = spawn_busy(-1);
+	runs = thisenv->env_runs;
+	wait(child);
+	waitruns = thisenv->env_runs - runs;
+
+	// Reading an empty pipe
+	if ((r = pipe(p)) < 0)
+		panic("pipe: %e", r);
+	child = spawn_busy(p[1]);
+	close(p[1]);
+	runs = thisenv->env_runs;
+	if ((r = readn(p[0], &c, 1)) != 1)
+		panic("read from pipe: %d", r);
+	piperuns = thisenv->env_runs - runs;
+	close(p[0]);
+	wait(child);
+
+	// Sending to a child that is busy before it receives: the sends
+	// are queued until the last, which has to wait for room
+	if ((child = fork()) < 0)
+		panic("fork: %e", child);
+	if (child == 0) {
+		busy();
+		for (i = 0; i <= IPC_QUEUE_MAX; i++)
+			ipc_recv(NULL, NULL, NULL);
+		exit();
+	}
+	runs = thisenv->env_runs;
+	for (i = 0; i <= IPC_QUEUE_MAX; i++)
+		ipc_send(child, i, NULL, 0);
+	ipcruns = thisenv->env_runs - runs;
+	wait(child);
+
+	// Polling, for comparison
+	child = spawn_busy(-1);
+	runs = thisenv->env_runs;
+	while (envs[ENVX(child)].env_id == child
+	       && envs[ENVX(child)].env_status != ENV_FREE)
+		sys_yield();
+	pollruns = thisenv->env_runs - runs;
+
+	cprintf("waitbench: runs while waiting: wait %u, pipe %u, ipc_send %u, polling %u\n",
+		waitruns, piperuns, ipcruns, pollruns);
+	if (waitruns > MAXRUNS || piperuns > MAXRUNS || ipcruns > MAXRUNS)
+		panic("blocked waits ran too often");
+	cprintf("waitbench is good\n");
+}